@@ -0,0 +1,377 @@
+"""Runtime benchmarks for the code pyxc generates.
+
+Every kernel is run under the JIT (`pyxc -O<n> kernel.pyxc`) and as an
+`--emit exe` binary at each -O level. All configurations of a kernel must
+print the same numbers; a kernel that disagrees with itself is reported as
+an error. Times are wall-clock medians. JIT times include start-up and
+compilation, so JIT rows also give "run", the execution phase reported by
+pyxc's own --time-report-json.
+
+    python3 bench.py                       run everything, print a table
+    python3 bench.py --json out.json       also write the results as JSON
+    python3 bench.py --save-baseline       store them in baselines/
+    python3 bench.py --compare             run, then flag regressions
+                                           against the stored baseline
+    python3 bench.py --compare old.json --input new.json
+                                           compare two result files
+
+The stored baseline is baselines/<system>-<machine>.json, so Linux and
+macOS hosts each keep their own. Only compare runs from the same machine.
+Exit status: 0 if all went well, 1 on a regression or a kernel error.
+"""
+
+import argparse
+import datetime
+import json
+import os
+import platform
+import statistics
+import subprocess
+import sys
+import tempfile
+import time
+from pathlib import Path
+
+ROOT = Path(__file__).resolve().parent
+DEFAULT_PYXC = ROOT.parent / "chapter-16" / "build" / "pyxc"
+BASELINE_DIR = ROOT / "baselines"
+SCHEMA = 1
+
+
+
+def kernel_paths() -> dict:
+    """Kernel name -> source. mandel is shared with bench.sh."""
+    kernels = {p.stem: p for p in sorted((ROOT / "kernels").glob("*.pyxc"))}
+    kernels["mandel"] = ROOT / "mandel_pyxc.pyxc"
+    return dict(sorted(kernels.items()))
+
+
+def host_info() -> dict:
+    return {
+        "system": platform.system(),
+        "release": platform.release(),
+        "machine": platform.machine(),
+        "node": platform.node(),
+        "cpus": os.cpu_count(),
+        "python": platform.python_version(),
+    }
+
+
+def default_baseline(prefix: str = "") -> Path:
+    name = f"{prefix}{platform.system().lower()}-{platform.machine()}.json"
+    return BASELINE_DIR / name
+
+
+def measure(cmd: list) -> dict:
+    """Run cmd; return its wall time, peak RSS, exit status and output.
+
+    os.wait4 gives the rusage of this child alone, which subprocess.run
+    cannot. Output goes to temporary files so neither pipe can fill up."""
+    with tempfile.TemporaryFile() as out, tempfile.TemporaryFile() as err:
+        start = time.perf_counter()
+        proc = subprocess.Popen(cmd, stdout=out, stderr=err)
+        _, status, usage = os.wait4(proc.pid, 0)
+        wall = time.perf_counter() - start
+        proc.returncode = os.waitstatus_to_exitcode(status)
+        out.seek(0)
+        err.seek(0)
+        # ru_maxrss is in KiB on Linux and in bytes on macOS.
+        rss = usage.ru_maxrss
+        if sys.platform == "darwin":
+            rss //= 1024
+        return {
+            "wall": wall,
+            "max_rss_kib": rss,
+            "returncode": proc.returncode,
+            "stdout": out.read().decode(errors="replace"),
+            "stderr": err.read().decode(errors="replace"),
+        }
+
+
+def phase_seconds(report: Path, phase: str) -> float:
+    """Sum the wall time of one phase over all files in a --time-report-json
+    file. Keys look like "time.pyxc.<file>.<phase>.wall"."""
+    data = json.loads(report.read_text())
+    suffix = f".{phase}.wall"
+    return sum(v for k, v in data.items() if k.endswith(suffix))
+
+
+def parse_numbers(output: str) -> list:
+    numbers = []
+    for line in output.split():
+        try:
+            numbers.append(float(line))
+        except ValueError:
+            numbers.append(line)
+    return numbers
+
+
+def same_output(a: list, b: list, rel_tol: float) -> bool:
+    """Different -O levels and targets may fuse or reorder floating-point
+    operations differently, so numbers only need to agree to rel_tol."""
+    if len(a) != len(b):
+        return False
+    for x, y in zip(a, b):
+        if isinstance(x, float) and isinstance(y, float):
+            if abs(x - y) > rel_tol * max(abs(x), abs(y), 1e-12):
+                return False
+        elif x != y:
+            return False
+    return True
+
+
+def summarize(samples: list) -> dict:
+    return {
+        "median": statistics.median(samples),
+        "min": min(samples),
+        "max": max(samples),
+        "samples": samples,
+    }
+
+
+def run_config(args, kernel: str, source: Path, mode: str, opt: int,
+               workdir: Path) -> dict:
+    """Benchmark one kernel in one mode at one -O level."""
+    result = {"kernel": kernel, "mode": mode, "opt": opt}
+    flags = [f"-O{opt}"] + args.pyxc_arg
+    report = workdir / f"{kernel}-{mode}-O{opt}.time.json"
+
+    if mode == "exe":
+        exe = workdir / f"{kernel}-O{opt}"
+        build = measure([str(args.pyxc), "--emit", "exe", *flags,
+                         "-o", str(exe), str(source)])
+        if build["returncode"] != 0:
+            result["error"] = "compile failed:\n" + build["stderr"]
+            return result
+        result["compile"] = build["wall"]
+        cmd = [str(exe)]
+    else:
+        cmd = [str(args.pyxc), *flags, f"--time-report-json={report}",
+               str(source)]
+
+    walls, runs, rss, output = [], [], 0, None
+    for i in range(args.warmup + args.repeat):
+        r = measure(cmd)
+        if r["returncode"] != 0:
+            result["error"] = (f"exited with status {r['returncode']}:\n" +
+                               r["stderr"])
+            return result
+        if output is None:
+            output = r["stdout"]
+        if i < args.warmup:
+            continue
+        walls.append(r["wall"])
+        rss = max(rss, r["max_rss_kib"])
+        if mode == "jit":
+            runs.append(phase_seconds(report, "run"))
+
+    result.update(summarize(walls))
+    if runs:
+        result["run_median"] = statistics.median(runs)
+    result["max_rss_kib"] = rss
+    result["output"] = output.strip()
+    return result
+
+
+def run_all(args) -> dict:
+    kernels = kernel_paths()
+    names = args.kernels.split(",") if args.kernels else list(kernels)
+    unknown = [n for n in names if n not in kernels]
+    if unknown:
+        sys.exit(f"bench.py: unknown kernel(s) {', '.join(unknown)}; "
+                 f"choose from {', '.join(kernels)}")
+    if not args.pyxc.exists():
+        sys.exit(f"bench.py: {args.pyxc} not found; build chapter-16 or "
+                 "pass --pyxc")
+
+    modes = args.modes.split(",")
+    opts = [int(o) for o in args.opt.split(",")]
+    results = {}
+    errors = 0
+    with tempfile.TemporaryDirectory(prefix="pyxc-bench-") as tmp:
+        for name in names:
+            reference = None
+            for mode in modes:
+                for opt in opts:
+                    key = f"{name}/{mode}/O{opt}"
+                    print(f"  {key} ...", file=sys.stderr, flush=True)
+                    r = run_config(args, name, kernels[name], mode, opt,
+                                   Path(tmp))
+                    if "error" not in r:
+                        numbers = parse_numbers(r["output"])
+                        if reference is None:
+                            reference = (key, numbers)
+                        elif not same_output(reference[1], numbers,
+                                             args.rel_tol):
+                            r["error"] = (f"output differs from "
+                                          f"{reference[0]}:\n{r['output']}")
+                    if "error" in r:
+                        errors += 1
+                        print(f"error: {key}: {r['error']}", file=sys.stderr)
+                    results[key] = r
+
+    return {
+        "schema": SCHEMA,
+        "created": datetime.datetime.now(datetime.timezone.utc)
+                   .isoformat(timespec="seconds"),
+        "host": host_info(),
+        "pyxc": {"path": str(args.pyxc), "args": args.pyxc_arg},
+        "repeat": args.repeat,
+        "errors": errors,
+        "results": results,
+    }
+
+
+def fmt_seconds(value) -> str:
+    return "-" if value is None else f"{value:.3f}"
+
+
+def print_table(data: dict) -> None:
+    print(f"{'kernel':<10} {'mode':<4} {'opt':<3} {'median':>8} {'min':>8} "
+          f"{'run':>8} {'rss MiB':>8}")
+    for r in data["results"].values():
+        if "error" in r:
+            print(f"{r['kernel']:<10} {r['mode']:<4} O{r['opt']:<2} error")
+            continue
+        print(f"{r['kernel']:<10} {r['mode']:<4} O{r['opt']:<2} "
+              f"{fmt_seconds(r['median']):>8} {fmt_seconds(r['min']):>8} "
+              f"{fmt_seconds(r.get('run_median')):>8} "
+              f"{r['max_rss_kib'] / 1024:>8.1f}")
+
+
+def compare(base: dict, cur: dict, threshold: float, metrics: dict) -> int:
+    """Print how cur differs from base; return the number of regressions.
+
+    metrics maps each compared metric (lower is better) to its min_delta. A
+    metric regresses when it grows by more than threshold (a fraction) and
+    also by more than min_delta, so timer noise on short runs is not
+    reported."""
+    for field in ("system", "machine"):
+        if base["host"].get(field) != cur["host"].get(field):
+            print(f"warning: baseline {field} is "
+                  f"{base['host'].get(field)}, this run is "
+                  f"{cur['host'].get(field)}", file=sys.stderr)
+
+    regressions = 0
+    print(f"{'config':<20} {'metric':<10} {'base':>8} {'now':>8} "
+          f"{'change':>8}")
+    for key, now in cur["results"].items():
+        old = base["results"].get(key)
+        if old is None:
+            print(f"{key:<20} (not in baseline)")
+            continue
+        if "error" in now or "error" in old:
+            continue
+        for metric, min_delta in metrics.items():
+            b, c = old.get(metric), now.get(metric)
+            if b is None or c is None:
+                continue
+            change = (c - b) / b if b > 0 else 0.0
+            verdict = ""
+            if change > threshold and c - b > min_delta:
+                verdict = "REGRESSION"
+                regressions += 1
+            elif change < -threshold and b - c > min_delta:
+                verdict = "improved"
+            print(f"{key:<20} {metric:<10} {fmt_seconds(b):>8} "
+                  f"{fmt_seconds(c):>8} {change:>+7.1%} {verdict}")
+    skipped = [k for k in base["results"] if k not in cur["results"]]
+    if skipped:
+        print(f"({len(skipped)} baseline configuration(s) not run)")
+    return regressions
+
+
+def load(path: Path) -> dict:
+    data = json.loads(path.read_text())
+    if data.get("schema") != SCHEMA:
+        sys.exit(f"bench.py: {path} has schema {data.get('schema')}, "
+                 f"expected {SCHEMA}")
+    return data
+
+
+def main() -> int:
+    parser = argparse.ArgumentParser(
+        description="Benchmark pyxc-generated code (JIT and --emit exe).")
+    parser.add_argument("--pyxc", type=Path,
+                        default=Path(os.environ.get("PYXC", DEFAULT_PYXC)),
+                        help="pyxc binary (default: $PYXC or the "
+                             "chapter-16 build)")
+    parser.add_argument("--pyxc-arg", action="append", default=[],
+                        metavar="ARG",
+                        help="extra pyxc flag for every compile, e.g. "
+                             "-march=native (repeatable)")
+    parser.add_argument("--kernels",
+                        help="comma-separated kernels (default: all of "
+                             + ", ".join(kernel_paths()) + ")")
+    parser.add_argument("--modes", default="jit,exe",
+                        help="comma-separated: jit, exe (default: both)")
+    parser.add_argument("--opt", default="0,1,2,3",
+                        help="comma-separated -O levels (default: 0,1,2,3)")
+    parser.add_argument("--repeat", type=int, default=5,
+                        help="timed runs per configuration (default: 5)")
+    parser.add_argument("--warmup", type=int, default=1,
+                        help="untimed runs first (default: 1)")
+    parser.add_argument("--rel-tol", type=float, default=1e-6,
+                        help="allowed relative difference between the "
+                             "numbers configurations print (default: 1e-6)")
+    parser.add_argument("--json", type=Path, metavar="FILE",
+                        help="write the results to FILE")
+    parser.add_argument("--save-baseline", action="store_true",
+                        help="write the results to " +
+                             str(default_baseline().relative_to(ROOT)))
+    parser.add_argument("--compare", type=Path, nargs="?", metavar="FILE",
+                        const=default_baseline(),
+                        help="flag regressions against FILE (default: the "
+                             "stored baseline for this host)")
+    parser.add_argument("--input", type=Path, metavar="FILE",
+                        help="with --compare, read the results from FILE "
+                             "instead of running")
+    parser.add_argument("--threshold", type=float, default=0.05,
+                        help="slowdown that counts as a regression, as a "
+                             "fraction (default: 0.05)")
+    parser.add_argument("--min-delta", type=float, default=0.01,
+                        help="ignore changes smaller than this many seconds "
+                             "(default: 0.01)")
+    args = parser.parse_args()
+    args.pyxc = args.pyxc.resolve()
+
+    if args.input and not args.compare:
+        parser.error("--input requires --compare")
+    if args.repeat < 1 or args.warmup < 0:
+        parser.error("--repeat must be at least 1 and --warmup at least 0")
+    for mode in args.modes.split(","):
+        if mode not in ("jit", "exe"):
+            parser.error(f"unknown mode '{mode}'")
+
+    if args.input:
+        data = load(args.input)
+    else:
+        data = run_all(args)
+        print_table(data)
+
+    outputs = [args.json] if args.json else []
+    if args.save_baseline:
+        BASELINE_DIR.mkdir(exist_ok=True)
+        outputs.append(default_baseline())
+    for path in outputs:
+        path.write_text(json.dumps(data, indent=2) + "\n")
+        print(f"wrote {path}", file=sys.stderr)
+
+    status = 1 if data["errors"] else 0
+    if args.compare:
+        if not args.compare.exists():
+            sys.exit(f"bench.py: no baseline at {args.compare}; create one "
+                     "with --save-baseline")
+        print()
+        metrics = {"median": args.min_delta, "run_median": args.min_delta}
+        regressions = compare(load(args.compare), data, args.threshold,
+                              metrics)
+        if regressions:
+            print(f"{regressions} regression(s) beyond "
+                  f"{args.threshold:.0%}", file=sys.stderr)
+            status = 1
+    return status
+
+
+if __name__ == "__main__":
+    sys.exit(main())
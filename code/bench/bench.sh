@@ -1,27 +1,33 @@
 #!/usr/bin/env bash
+# Compare pyxc with Python, C, C++ and Rust on the same program.
+#
+#   bench.sh [fib|mandel]...      (default: mandel)
+#
+# CC, CXX, RUSTC, PYTHON and PYXC override the tools; a missing compiler is
+# skipped. For pyxc's own JIT vs --emit exe numbers across -O levels, with
+# JSON output and baseline comparison, use bench.py.
 set -euo pipefail
 set +H
 
 ROOT="$(cd "$(dirname "$0")" && pwd)"
-PYXC_BIN="$ROOT/../chapter-16/build/pyxc"
+PYXC_BIN="${PYXC:-$ROOT/../chapter-16/build/pyxc}"
+CC="${CC:-cc}"
+CXX="${CXX:-c++}"
+RUSTC="${RUSTC:-rustc}"
+PYTHON="${PYTHON:-python3}"
 
-# Build binaries
-"$PYXC_BIN" --emit exe -O3 -o "$ROOT/mandel_pyxc" "$ROOT/mandel_pyxc.pyxc"
-
-xcrun clang -O3 -ffp-contract=off "$ROOT/mandel.c" -o "$ROOT/mandel_c"
-xcrun clang++ -O3 -ffp-contract=off "$ROOT/mandel.cpp" -o "$ROOT/mandel_cpp"
-rustc -O "$ROOT/mandel.rs" -o "$ROOT/mandel_rs"
+have() {
+  command -v "$1" >/dev/null 2>&1
+}
 
 run_times() {
   local label="$1"
   shift
   local cmd=("$@")
-  local tmp
-  tmp="$(mktemp)"
   echo "$label"
   for i in 1 2 3 4 5; do
-    /usr/bin/time -p "${cmd[@]}" 2>"$tmp" >/dev/null
-    awk '/^real /{print $2}' "$tmp"
+    # The bash 'time' keyword, unlike /usr/bin/time, is always available.
+    { TIMEFORMAT='%R'; time "${cmd[@]}" >/dev/null 2>&1; } 2>&1
   done | awk '
     { a[NR] = $1 }
     END {
@@ -36,11 +42,34 @@ run_times() {
       printf("median: %.2f\n\n", median)
     }
   '
-  rm -f "$tmp"
 }
 
-run_times "Python" python3 "$ROOT/mandel_py.py"
-run_times "Pyxc" "$ROOT/mandel_pyxc"
-run_times "C" "$ROOT/mandel_c"
-run_times "C++" "$ROOT/mandel_cpp"
-run_times "Rust" "$ROOT/mandel_rs"
+for prog in "${@:-mandel}"; do
+  # Build binaries
+  "$PYXC_BIN" --emit exe -O3 -o "$ROOT/${prog}_pyxc" "$ROOT/${prog}_pyxc.pyxc"
+  if have "$CC"; then
+    "$CC" -O3 -ffp-contract=off "$ROOT/$prog.c" -o "$ROOT/${prog}_c"
+  fi
+  if have "$CXX"; then
+    "$CXX" -O3 -ffp-contract=off "$ROOT/$prog.cpp" -o "$ROOT/${prog}_cpp"
+  fi
+  if have "$RUSTC"; then
+    "$RUSTC" -O "$ROOT/$prog.rs" -o "$ROOT/${prog}_rs"
+  fi
+
+  echo "== $prog =="
+  echo
+  if have "$PYTHON"; then
+    run_times "Python" "$PYTHON" "$ROOT/${prog}_py.py"
+  fi
+  run_times "Pyxc" "$ROOT/${prog}_pyxc"
+  if have "$CC"; then
+    run_times "C" "$ROOT/${prog}_c"
+  fi
+  if have "$CXX"; then
+    run_times "C++" "$ROOT/${prog}_cpp"
+  fi
+  if have "$RUSTC"; then
+    run_times "Rust" "$ROOT/${prog}_rs"
+  fi
+done
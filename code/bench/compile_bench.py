@@ -0,0 +1,383 @@
+"""Compile-time benchmarks for pyxc itself.
+
+Generates large synthetic programs, compiles each with `--emit exe`, and
+reports the throughput of every phase in lines per second, plus pyxc's peak
+RSS. The phases come from pyxc's --time-report-json:
+
+    lex      a separate --lex-only run, which times the lexer alone
+    parse    the front end (the parser pulls tokens as it goes) minus lex
+    codegen  IR codegen
+    optimize function and module passes
+    emit     object emission
+    link     lld
+    total    wall time of the whole --emit exe run
+
+The pass timers that --time-report-json turns on add a little to optimize.
+
+    python3 compile_bench.py                     all profiles, -O0 and -O2
+    python3 compile_bench.py --lines 100000      bigger programs
+    python3 compile_bench.py --keep gen/         keep the generated sources
+    python3 compile_bench.py --save-baseline     store the results
+    python3 compile_bench.py --compare           flag regressions
+
+Results, baselines and --compare work as in bench.py; the stored baseline is
+baselines/compile-<system>-<machine>.json. `cmake --build build --target
+bench-compile` in chapter-16 runs this against the pyxc it just built.
+"""
+
+import argparse
+import datetime
+import json
+import os
+import statistics
+import sys
+import tempfile
+from pathlib import Path
+
+from bench import (BASELINE_DIR, DEFAULT_PYXC, SCHEMA, compare,
+                   default_baseline, host_info, load, measure, phase_seconds)
+
+BASELINE_PREFIX = "compile-"
+PHASES = ("lex", "parse", "codegen", "optimize", "emit", "link", "total")
+
+#===----------------------------------------------------------------------===#
+# Program generator
+#===----------------------------------------------------------------------===#
+
+# Every profile can use these, so they are defined at the top of each
+# program. pyxc operators are single punctuation characters, so there are
+# only a handful to choose from.
+OPERATORS = """\
+@binary(15)
+def %(a: float64, b: float64) -> float64: return a * 0.5 + b
+
+@binary(25)
+def |(a: float64, b: float64) -> float64: return a + b * 0.5
+
+@binary(30)
+def &(a: float64, b: float64) -> float64: return a * b + 1.0
+
+@binary(35)
+def ^(a: float64, b: float64) -> float64: return a - b * 0.25
+
+@unary
+def !(a: float64) -> float64: return 1.0 - a
+"""
+
+
+def gen_functions(i: int) -> list:
+    """A small function that calls the previous one."""
+    call = f"f{i - 1}(b, c)" if i > 0 else "b"
+    return [
+        f"def f{i}(a: int, b: int) -> int:",
+        f"    var c: int = a + b * {i % 7 + 2}",
+        f"    if c > {i % 100}:",
+        f"        c = c - {call}",
+        "    return c",
+        "",
+    ]
+
+
+def gen_nesting(i: int, depth: int = 16) -> list:
+    """A function whose loops and ifs nest depth levels deep."""
+    lines = [f"def n{i}(x: int) -> int:", "    var acc: int = 0"]
+
+    def level(k: int, indent: str) -> None:
+        if k == depth:
+            lines.append(f"{indent}acc = acc + {i % 9 + 1}")
+            return
+        inner = indent + "    "
+        kind = (k + i) % 3
+        if kind == 0:
+            lines.append(f"{indent}for var v{k}: int = 0, v{k} < x, 1:")
+            level(k + 1, inner)
+        elif kind == 1:
+            lines.append(f"{indent}if acc > {k}:")
+            level(k + 1, inner)
+            lines.append(f"{indent}else:")
+            lines.append(f"{inner}acc = acc - {k}")
+        else:
+            lines.append(f"{indent}var w{k}: int = x")
+            lines.append(f"{indent}while w{k} > {k}:")
+            lines.append(f"{inner}w{k} = w{k} - 1")
+            level(k + 1, inner)
+        lines.append(f"{indent}acc = acc + {k}")
+
+    level(0, "    ")
+    lines += ["    return acc", ""]
+    return lines
+
+
+def gen_blocks(i: int, length: int = 200) -> list:
+    """A function with one long straight-line block of int and float64
+    locals, each computed from earlier ones."""
+    lines = [f"def b{i}(x: int, y: float64) -> float64:",
+             "    var s0: int = x",
+             "    var t0: float64 = y"]
+    ints = floats = 1
+    for j in range(length):
+        if j % 2:
+            lines.append(f"    var s{ints}: int = s{ints - 1} * {j % 5 + 2} "
+                         f"+ s{ints // 2} - {j}")
+            ints += 1
+        else:
+            lines.append(f"    var t{floats}: float64 = t{floats - 1} * 0.5 "
+                         f"+ float64(s{ints - 1}) - {j}.25")
+            floats += 1
+    lines += [f"    return t{floats - 1}", ""]
+    return lines
+
+
+def gen_globals(i: int, count: int = 32) -> list:
+    """count globals, some initialized from earlier ones, and a function
+    that reads them all."""
+    lines = []
+    for j in range(count):
+        g = i * count + j
+        if j == 0:
+            lines.append(f"var g{g}: int = {g % 13 + 1}")
+        else:
+            lines.append(f"var g{g}: int = g{g - 1} * 3 + {g % 11}")
+    lines.append(f"def sum_g{i}() -> int:")
+    lines.append(f"    var s: int = g{i * count}")
+    for j in range(1, count):
+        lines.append(f"    s = s + g{i * count + j}")
+    lines += ["    return s", ""]
+    return lines
+
+
+def gen_operators(i: int, length: int = 24) -> list:
+    """A function made of long expressions over the custom operators."""
+    lines = [f"def o{i}(x: float64, y: float64) -> float64:",
+             "    var r: float64 = x & y | !x ^ y % 2.0"]
+    for j in range(length):
+        lines.append(f"    r = r & x | !r ^ {j}.5 % y & r | x ^ !y & "
+                     f"{i % 17}.0")
+    lines += ["    return r", ""]
+    return lines
+
+
+UNITS = {
+    "functions": gen_functions,
+    "nesting": gen_nesting,
+    "blocks": gen_blocks,
+    "globals": gen_globals,
+    "operators": gen_operators,
+}
+PROFILES = list(UNITS) + ["mixed"]
+
+
+def generate(profile: str, target_lines: int) -> str:
+    """A program of about target_lines lines in the given shape. "mixed"
+    interleaves the other shapes."""
+    units = list(UNITS.values()) if profile == "mixed" else [UNITS[profile]]
+    header = f"# Generated by compile_bench.py ({profile}).\n\n" + OPERATORS
+    lines = header.splitlines() + [""]
+    i = 0
+    while len(lines) < target_lines:
+        lines += units[i % len(units)](i // len(units))
+        i += 1
+    lines += ["def main() -> int:", "    return 0", ""]
+    return "\n".join(lines)
+
+
+#===----------------------------------------------------------------------===#
+# Measurement
+#===----------------------------------------------------------------------===#
+
+
+def run_profile(args, profile: str, source: Path, opt: int,
+                workdir: Path) -> dict:
+    lines = source.read_text().count("\n")
+    result = {"profile": profile, "opt": opt, "lines": lines}
+    report = workdir / "time.json"
+    lex_cmd = [str(args.pyxc), "--lex-only", f"--time-report-json={report}",
+               str(source)]
+    build_cmd = [str(args.pyxc), "--emit", "exe", f"-O{opt}",
+                 *args.pyxc_arg, f"--time-report-json={report}",
+                 "-o", str(workdir / profile), str(source)]
+
+    samples = {phase: [] for phase in PHASES}
+    rss = 0
+    for i in range(args.warmup + args.repeat):
+        lex = measure(lex_cmd)
+        if lex["returncode"] != 0:
+            result["error"] = "--lex-only failed:\n" + lex["stderr"]
+            return result
+        lex_time = phase_seconds(report, "lex")
+
+        build = measure(build_cmd)
+        if build["returncode"] != 0:
+            result["error"] = "compile failed:\n" + build["stderr"]
+            return result
+        if i < args.warmup:
+            continue
+        samples["lex"].append(lex_time)
+        samples["parse"].append(
+            max(phase_seconds(report, "frontend") - lex_time, 0.0))
+        samples["codegen"].append(phase_seconds(report, "codegen"))
+        samples["optimize"].append(phase_seconds(report, "function-passes") +
+                              phase_seconds(report, "module-passes"))
+        samples["emit"].append(phase_seconds(report, "emit"))
+        samples["link"].append(phase_seconds(report, "link"))
+        samples["total"].append(build["wall"])
+        rss = max(rss, build["max_rss_kib"])
+
+    throughput = {}
+    for phase in PHASES:
+        seconds = statistics.median(samples[phase])
+        result[phase] = seconds
+        throughput[phase] = lines / seconds if seconds > 0 else None
+    result["lines_per_sec"] = throughput
+    result["max_rss_mib"] = rss / 1024
+    return result
+
+
+def run_all(args) -> dict:
+    if not args.pyxc.exists():
+        sys.exit(f"compile_bench.py: {args.pyxc} not found; build "
+                 "chapter-16 or pass --pyxc")
+    profiles = args.profiles.split(",")
+    for p in profiles:
+        if p not in PROFILES:
+            sys.exit(f"compile_bench.py: unknown profile '{p}'; choose from "
+                     f"{', '.join(PROFILES)}")
+    opts = [int(o) for o in args.opt.split(",")]
+
+    results = {}
+    errors = 0
+    with tempfile.TemporaryDirectory(prefix="pyxc-compile-bench-") as tmp:
+        srcdir = args.keep or Path(tmp)
+        srcdir.mkdir(parents=True, exist_ok=True)
+        for profile in profiles:
+            source = srcdir / f"{profile}.pyxc"
+            source.write_text(generate(profile, args.lines))
+            for opt in opts:
+                key = f"{profile}/O{opt}"
+                print(f"  {key} ...", file=sys.stderr, flush=True)
+                r = run_profile(args, profile, source, opt, Path(tmp))
+                if "error" in r:
+                    errors += 1
+                    print(f"error: {key}: {r['error']}", file=sys.stderr)
+                results[key] = r
+
+    return {
+        "schema": SCHEMA,
+        "created": datetime.datetime.now(datetime.timezone.utc)
+                   .isoformat(timespec="seconds"),
+        "host": host_info(),
+        "pyxc": {"path": str(args.pyxc), "args": args.pyxc_arg},
+        "repeat": args.repeat,
+        "errors": errors,
+        "results": results,
+    }
+
+
+def print_table(data: dict) -> None:
+    print("thousands of lines per second; rss in MiB")
+    print(f"{'profile':<10} {'opt':<3} {'lines':>7} " +
+          " ".join(f"{p:>8}" for p in PHASES) + f" {'rss':>7}")
+    for r in data["results"].values():
+        head = f"{r['profile']:<10} O{r['opt']:<2} {r['lines']:>7}"
+        if "error" in r:
+            print(f"{head} error")
+            continue
+        cells = []
+        for phase in PHASES:
+            rate = r["lines_per_sec"][phase]
+            cell = "-" if rate is None else f"{rate / 1000:.1f}"
+            cells.append(f"{cell:>8}")
+        print(f"{head} {' '.join(cells)} {r['max_rss_mib']:>7.1f}")
+
+
+def main() -> int:
+    parser = argparse.ArgumentParser(
+        description="Benchmark pyxc's own compile speed on generated "
+                    "programs.")
+    parser.add_argument("--pyxc", type=Path,
+                        default=Path(os.environ.get("PYXC", DEFAULT_PYXC)),
+                        help="pyxc binary (default: $PYXC or the "
+                             "chapter-16 build)")
+    parser.add_argument("--pyxc-arg", action="append", default=[],
+                        metavar="ARG",
+                        help="extra pyxc flag for every compile "
+                             "(repeatable)")
+    parser.add_argument("--profiles", default=",".join(PROFILES),
+                        help="comma-separated program shapes (default: "
+                             "all of " + ", ".join(PROFILES) + ")")
+    parser.add_argument("--lines", type=int, default=20000,
+                        help="approximate lines per program (default: "
+                             "20000)")
+    parser.add_argument("--opt", default="0,2",
+                        help="comma-separated -O levels (default: 0,2)")
+    parser.add_argument("--repeat", type=int, default=3,
+                        help="timed compiles per configuration (default: 3)")
+    parser.add_argument("--warmup", type=int, default=1,
+                        help="untimed compiles first (default: 1)")
+    parser.add_argument("--keep", type=Path, metavar="DIR",
+                        help="write the generated programs to DIR and keep "
+                             "them")
+    parser.add_argument("--json", type=Path, metavar="FILE",
+                        help="write the results to FILE")
+    parser.add_argument("--save-baseline", action="store_true",
+                        help="write the results to " + str(
+                            default_baseline(BASELINE_PREFIX).relative_to(
+                                BASELINE_DIR.parent)))
+    parser.add_argument("--compare", type=Path, nargs="?", metavar="FILE",
+                        const=default_baseline(BASELINE_PREFIX),
+                        help="flag regressions against FILE (default: the "
+                             "stored baseline for this host)")
+    parser.add_argument("--input", type=Path, metavar="FILE",
+                        help="with --compare, read the results from FILE "
+                             "instead of running")
+    parser.add_argument("--threshold", type=float, default=0.05,
+                        help="growth that counts as a regression, as a "
+                             "fraction (default: 0.05)")
+    parser.add_argument("--min-delta", type=float, default=0.01,
+                        help="ignore phase time changes smaller than this "
+                             "many seconds (default: 0.01)")
+    parser.add_argument("--min-rss-delta", type=float, default=4.0,
+                        help="ignore peak RSS changes smaller than this many "
+                             "MiB (default: 4)")
+    args = parser.parse_args()
+    args.pyxc = args.pyxc.resolve()
+
+    if args.input and not args.compare:
+        parser.error("--input requires --compare")
+    if args.repeat < 1 or args.warmup < 0 or args.lines < 1:
+        parser.error("--repeat and --lines must be at least 1 and --warmup "
+                     "at least 0")
+
+    if args.input:
+        data = load(args.input)
+    else:
+        data = run_all(args)
+        print_table(data)
+
+    outputs = [args.json] if args.json else []
+    if args.save_baseline:
+        BASELINE_DIR.mkdir(exist_ok=True)
+        outputs.append(default_baseline(BASELINE_PREFIX))
+    for path in outputs:
+        path.write_text(json.dumps(data, indent=2) + "\n")
+        print(f"wrote {path}", file=sys.stderr)
+
+    status = 1 if data["errors"] else 0
+    if args.compare:
+        if not args.compare.exists():
+            sys.exit(f"compile_bench.py: no baseline at {args.compare}; "
+                     "create one with --save-baseline")
+        print()
+        metrics = {phase: args.min_delta for phase in PHASES}
+        metrics["max_rss_mib"] = args.min_rss_delta
+        regressions = compare(load(args.compare), data, args.threshold,
+                              metrics)
+        if regressions:
+            print(f"{regressions} regression(s) beyond "
+                  f"{args.threshold:.0%}", file=sys.stderr)
+            status = 1
+    return status
+
+
+if __name__ == "__main__":
+    sys.exit(main())
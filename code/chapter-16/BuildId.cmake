@@ -0,0 +1,20 @@
+# BuildId.cmake — write a header that identifies this pyxc build.
+#
+# Usage: cmake -DOUTPUT=<file.inc> -DSOURCES=<file>[|<file>...] -P BuildId.cmake
+#
+# PYXC_BUILD_ID is a SHA-256 over the given sources, so cache keys change
+# whenever pyxc's own code does, committed or not, and stay the same across
+# rebuilds of identical code.
+
+string(REPLACE "|" ";" _sources "${SOURCES}")
+set(_hashes "")
+foreach(_source IN LISTS _sources)
+  file(SHA256 "${_source}" _hash)
+  string(APPEND _hashes "${_hash}\n")
+endforeach()
+string(SHA256 _id "${_hashes}")
+string(SUBSTRING "${_id}" 0 16 _id)
+
+file(WRITE "${OUTPUT}"
+  "// Generated by BuildId.cmake. Do not edit.\n"
+  "#define PYXC_BUILD_ID \"${_id}\"\n")
@@ -0,0 +1,460 @@
+//===- PyxcJIT16.h - The chapter 16 JIT for pyxc ---*- C++ -*-===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// Contains the JIT used by chapter 16: the thin LLJIT wrapper from
+// include/PyxcJIT.h extended with lazy compilation, a materialization thread pool,
+// tier-up, an object cache, JITLink and debugger/perf registration. Earlier
+// chapters keep using include/PyxcJIT.h.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef LLVM_EXECUTIONENGINE_ORC_PYXCJIT16_H
+#define LLVM_EXECUTIONENGINE_ORC_PYXCJIT16_H
+
+#include "llvm/ADT/SmallString.h"
+#include "llvm/ADT/StringExtras.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/ExecutionEngine/JITEventListener.h"
+#include "llvm/ExecutionEngine/ObjectCache.h"
+#include "llvm/ExecutionEngine/Orc/CompileOnDemandLayer.h"
+#include "llvm/ExecutionEngine/Orc/CompileUtils.h"
+#include "llvm/ExecutionEngine/Orc/Core.h"
+#include "llvm/ExecutionEngine/Orc/DebugObjectManagerPlugin.h"
+#include "llvm/ExecutionEngine/Orc/Debugging/DebuggerSupportPlugin.h"
+#include "llvm/ExecutionEngine/Orc/Debugging/PerfSupportPlugin.h"
+#include "llvm/ExecutionEngine/Orc/EHFrameRegistrationPlugin.h"
+#include "llvm/ExecutionEngine/Orc/EPCDebugObjectRegistrar.h"
+#include "llvm/ExecutionEngine/Orc/EPCIndirectionUtils.h"
+#include "llvm/ExecutionEngine/Orc/ExecutionUtils.h"
+#include "llvm/ExecutionEngine/Orc/ExecutorProcessControl.h"
+#include "llvm/ExecutionEngine/Orc/IRCompileLayer.h"
+#include "llvm/ExecutionEngine/Orc/JITTargetMachineBuilder.h"
+#include "llvm/ExecutionEngine/Orc/MapperJITLinkMemoryManager.h"
+#include "llvm/ExecutionEngine/Orc/MemoryMapper.h"
+#include "llvm/ExecutionEngine/Orc/ObjectLinkingLayer.h"
+#include "llvm/ExecutionEngine/Orc/RTDyldObjectLinkingLayer.h"
+#include "llvm/ExecutionEngine/Orc/SelfExecutorProcessControl.h"
+#include "llvm/ExecutionEngine/Orc/Shared/ExecutorSymbolDef.h"
+#include "llvm/ExecutionEngine/Orc/TargetProcess/JITLoaderGDB.h"
+#include "llvm/ExecutionEngine/Orc/TargetProcess/JITLoaderPerf.h"
+#include "llvm/ExecutionEngine/Orc/TaskDispatch.h"
+#include "llvm/ExecutionEngine/SectionMemoryManager.h"
+#include "llvm/IR/DataLayout.h"
+#include "llvm/IR/LLVMContext.h"
+#include "llvm/Support/CodeGen.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/SHA256.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/TargetParser/Triple.h"
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace llvm {
+namespace orc {
+
+/// PyxcJITOptions - Settings for PyxcJIT::Create(). The defaults give the
+/// eager JIT used by the earlier chapters.
+struct PyxcJITOptions {
+  /// Compile each function on its first call instead of when its module is
+  /// added.
+  bool Lazy = false;
+
+  /// Number of threads used to materialize (compile and link) modules. Zero
+  /// runs all materialization on the thread that triggers it.
+  unsigned NumCompileThreads = 0;
+
+  /// Allow functions to be installed behind indirect stubs that can later be
+  /// repointed at a new body (see addRedirectableFunction). Used for tiered
+  /// compilation.
+  bool RedirectableFunctions = false;
+
+  /// Target CPU and subtarget features ("+avx2", ...) for JIT'd code. An
+  /// empty CPU keeps the target's generic CPU.
+  std::string CPU;
+  std::vector<std::string> Features;
+
+  /// Backend optimisation level for JIT'd code.
+  CodeGenOptLevel CodeGenLevel = CodeGenOptLevel::Default;
+
+  /// When the backend may fuse a multiply and an add into an FMA.
+  FPOpFusion::FPOpFusionMode FPOpFusion = FPOpFusion::Standard;
+
+  /// Link JIT'd objects with JITLink instead of RuntimeDyld, as pyxc's
+  /// --jit-linker does by default. COFF targets always use RuntimeDyld.
+  bool UseJITLink = true;
+
+  /// Register JIT'd objects with the GDB JIT interface
+  /// (__jit_debug_register_code), so debuggers see their symbols and, with
+  /// -g, their source lines.
+  bool GDBRegistration = false;
+
+  /// Describe JIT'd code in a perf jitdump file (jit-<pid>.dump), which
+  /// 'perf inject --jit' merges into a recording. ELF targets only.
+  bool PerfSupport = false;
+
+  /// Address space JITLink reserves at a time. Every module is carved out of
+  /// one of these slabs, and its pages return to the pool when its
+  /// ResourceTracker is removed.
+  size_t JITLinkSlabSize = 64 * 1024 * 1024;
+
+  /// Keep compiled objects in this directory and reuse them in later
+  /// processes (see PyxcObjectCache). Empty disables the cache.
+  std::string ObjectCacheDir;
+
+  /// Identifies everything the cached objects depend on besides the module
+  /// name: source, flags, compiler build.
+  std::string ObjectCacheKey;
+};
+
+/// PyxcObjectCache - An ObjectCache that stores JIT'd objects on disk, so a
+/// later process that builds the same modules can load them instead of
+/// running the backend again.
+///
+/// Each object is stored as jit-<hash>.o, where the hash covers the cache key
+/// and the module identifier. The caller chooses a key that changes whenever
+/// the objects would, and names modules so that the same input always yields
+/// the same identifiers. Writes are best-effort: a failure only costs a
+/// recompile next time.
+class PyxcObjectCache : public ObjectCache {
+  std::string Dir;
+  std::string Key;
+  std::atomic<unsigned> Hits{0};
+  std::atomic<unsigned> Misses{0};
+
+  std::string getPath(const Module *M) const {
+    SHA256 Hasher;
+    Hasher.update(Key);
+    Hasher.update(StringRef("\0", 1));
+    Hasher.update(M->getModuleIdentifier());
+    SmallString<256> Path(Dir);
+    sys::path::append(Path,
+                      "jit-" + toHex(Hasher.final(), /*LowerCase=*/true) +
+                          ".o");
+    return std::string(Path);
+  }
+
+public:
+  PyxcObjectCache(std::string Dir, std::string Key)
+      : Dir(std::move(Dir)), Key(std::move(Key)) {}
+
+  void notifyObjectCompiled(const Module *M, MemoryBufferRef Obj) override {
+    if (sys::fs::create_directories(Dir))
+      return;
+    // Write through a unique temporary and rename it into place, so a
+    // concurrent run never loads a partially written object.
+    std::string Path = getPath(M);
+    int FD = -1;
+    SmallString<256> TmpPath;
+    if (sys::fs::createUniqueFile(Path + ".tmp-%%%%%%", FD, TmpPath))
+      return;
+    raw_fd_ostream OS(FD, /*shouldClose=*/true);
+    OS << Obj.getBuffer();
+    OS.close();
+    if (OS.has_error()) {
+      OS.clear_error();
+      sys::fs::remove(TmpPath);
+      return;
+    }
+    if (sys::fs::rename(TmpPath, Path))
+      sys::fs::remove(TmpPath);
+  }
+
+  std::unique_ptr<MemoryBuffer> getObject(const Module *M) override {
+    auto ObjOrErr = MemoryBuffer::getFile(getPath(M));
+    if (!ObjOrErr) {
+      ++Misses;
+      return nullptr;
+    }
+    ++Hits;
+    return std::move(*ObjOrErr);
+  }
+
+  unsigned getHits() const { return Hits; }
+  unsigned getMisses() const { return Misses; }
+};
+
+class PyxcJIT {
+private:
+  std::unique_ptr<ExecutionSession> ES;
+  // Only set for lazy or redirectable JITs: owns the stubs and the lazy
+  // call-through trampolines used by CODLayer.
+  std::unique_ptr<EPCIndirectionUtils> EPCIU;
+
+  DataLayout DL;
+  MangleAndInterner Mangle;
+
+  // Declared before CompileLayer, whose compiler holds a pointer to it.
+  std::unique_ptr<PyxcObjectCache> ObjCache;
+
+  // A copy of the builder CompileLayer's compiler owns, so the optimisation
+  // pipeline can be tuned for the same target and options.
+  JITTargetMachineBuilder JTMB;
+
+  std::unique_ptr<ObjectLayer> ObjLayer;
+  IRCompileLayer CompileLayer;
+  std::unique_ptr<CompileOnDemandLayer> CODLayer;
+
+  // Stubs for redirectable functions, keyed by mangled name. Guarded by
+  // StubsMutex since redirects may come from background compile threads.
+  std::unique_ptr<IndirectStubsManager> StubsMgr;
+  std::mutex StubsMutex;
+
+  JITDylib &MainJD;
+
+  static void handleLazyCallThroughError() {
+    errs() << "LazyCallThrough error: Could not find function body";
+    exit(1);
+  }
+
+  static Error makeJITError(const Twine &Message) {
+    return make_error<StringError>(Message, inconvertibleErrorCode());
+  }
+
+  /// createObjectLayer - The layer that links compiled objects into the
+  /// process.
+  ///
+  /// RuntimeDyld gives every object its own SectionMemoryManager, so each
+  /// small REPL module holds at least a page per section kind for the rest
+  /// of the session. JITLink instead allocates from large slabs reserved up
+  /// front, and memory freed through a ResourceTracker is reused by later
+  /// modules.
+  ///
+  /// The debugger and perf hooks are the in-process target-process functions
+  /// from OrcTargetProcess, passed by address so nothing has to be looked up
+  /// in (or exported from) the pyxc binary.
+  static Expected<std::unique_ptr<ObjectLayer>>
+  createObjectLayer(ExecutionSession &ES, const Triple &TT,
+                    const PyxcJITOptions &Opts) {
+    if (Opts.PerfSupport && !TT.isOSBinFormatELF())
+      return makeJITError("perf support needs an ELF target");
+
+    if (Opts.UseJITLink && !TT.isOSBinFormatCOFF()) {
+      auto MemMgr =
+          MapperJITLinkMemoryManager::CreateWithMapper<InProcessMemoryMapper>(
+              Opts.JITLinkSlabSize);
+      if (!MemMgr)
+        return MemMgr.takeError();
+      auto Layer = std::make_unique<ObjectLinkingLayer>(ES, std::move(*MemMgr));
+      // Register JIT'd unwind info, as RuntimeDyld's memory manager does.
+      auto EHFrames = EHFrameRegistrationPlugin::Create(ES);
+      if (!EHFrames)
+        return EHFrames.takeError();
+      Layer->addPlugin(std::move(*EHFrames));
+
+      if (Opts.GDBRegistration) {
+        if (TT.isOSBinFormatMachO())
+          Layer->addPlugin(std::make_unique<GDBJITDebugInfoRegistrationPlugin>(
+              ExecutorAddr::fromPtr(
+                  &llvm_orc_registerJITLoaderGDBAllocAction)));
+        else
+          Layer->addPlugin(std::make_unique<DebugObjectManagerPlugin>(
+              ES,
+              std::make_unique<EPCDebugObjectRegistrar>(
+                  ES,
+                  ExecutorAddr::fromPtr(&llvm_orc_registerJITLoaderGDBWrapper)),
+              /*RequireDebugSections=*/false, /*AutoRegisterCode=*/true));
+      }
+      if (Opts.PerfSupport)
+        Layer->addPlugin(std::make_unique<PerfSupportPlugin>(
+            ES.getExecutorProcessControl(),
+            ExecutorAddr::fromPtr(&llvm_orc_registerJITLoaderPerfStart),
+            ExecutorAddr::fromPtr(&llvm_orc_registerJITLoaderPerfEnd),
+            ExecutorAddr::fromPtr(&llvm_orc_registerJITLoaderPerfImpl),
+            /*EmitDebugInfo=*/true, /*EmitUnwindInfo=*/true));
+      return std::move(Layer);
+    }
+
+    auto Layer = std::make_unique<RTDyldObjectLinkingLayer>(
+        ES, [](const MemoryBuffer &) {
+          return std::make_unique<SectionMemoryManager>();
+        });
+    if (TT.isOSBinFormatCOFF()) {
+      Layer->setOverrideObjectFlagsWithResponsibilityFlags(true);
+      Layer->setAutoClaimResponsibilityForObjectSymbols(true);
+    }
+    // RuntimeDyld reports objects to JITEventListeners instead; both
+    // listeners are process-wide singletons owned by LLVM.
+    if (Opts.GDBRegistration)
+      Layer->registerJITEventListener(
+          *JITEventListener::createGDBRegistrationListener());
+    if (Opts.PerfSupport) {
+      JITEventListener *Perf = JITEventListener::createPerfJITEventListener();
+      if (!Perf)
+        return makeJITError("this LLVM was built without perf support "
+                            "(LLVM_USE_PERF)");
+      Layer->registerJITEventListener(*Perf);
+    }
+    return std::move(Layer);
+  }
+
+public:
+  PyxcJIT(std::unique_ptr<ExecutionSession> ES,
+          std::unique_ptr<EPCIndirectionUtils> EPCIU,
+          std::unique_ptr<ObjectLayer> ObjLayer,
+          JITTargetMachineBuilder JTMB, DataLayout DL,
+          const PyxcJITOptions &Opts = PyxcJITOptions())
+      : ES(std::move(ES)), EPCIU(std::move(EPCIU)), DL(std::move(DL)),
+        Mangle(*this->ES, this->DL),
+        ObjCache(Opts.ObjectCacheDir.empty()
+                     ? nullptr
+                     : std::make_unique<PyxcObjectCache>(
+                           Opts.ObjectCacheDir, Opts.ObjectCacheKey)),
+        JTMB(JTMB), ObjLayer(std::move(ObjLayer)),
+        CompileLayer(*this->ES, *this->ObjLayer,
+                     std::make_unique<ConcurrentIRCompiler>(std::move(JTMB),
+                                                            ObjCache.get())),
+        MainJD(this->ES->createBareJITDylib("<main>")) {
+    MainJD.addGenerator(
+        cantFail(DynamicLibrarySearchGenerator::GetForCurrentProcess(
+            DL.getGlobalPrefix())));
+    if (this->EPCIU && Opts.Lazy)
+      CODLayer = std::make_unique<CompileOnDemandLayer>(
+          *this->ES, CompileLayer, this->EPCIU->getLazyCallThroughManager(),
+          [this] { return this->EPCIU->createIndirectStubsManager(); });
+
+    // Partitions split out of one module share its LLVMContext, whose lock
+    // would serialize them; give each its own context so they compile in
+    // parallel.
+    if (CODLayer && Opts.NumCompileThreads > 0)
+      CODLayer->setCloneToNewContextOnEmit(true);
+
+    if (this->EPCIU && Opts.RedirectableFunctions)
+      StubsMgr = this->EPCIU->createIndirectStubsManager();
+  }
+
+  ~PyxcJIT() {
+    StubsMgr.reset();
+    if (auto Err = ES->endSession())
+      ES->reportError(std::move(Err));
+    if (EPCIU)
+      if (auto Err = EPCIU->cleanup())
+        ES->reportError(std::move(Err));
+  }
+
+  static Expected<std::unique_ptr<PyxcJIT>>
+  Create(const PyxcJITOptions &Opts = PyxcJITOptions()) {
+    std::unique_ptr<TaskDispatcher> Dispatcher;
+    if (Opts.NumCompileThreads > 0)
+      Dispatcher = std::make_unique<DynamicThreadPoolTaskDispatcher>(
+          Opts.NumCompileThreads);
+
+    auto EPC =
+        SelfExecutorProcessControl::Create(nullptr, std::move(Dispatcher));
+    if (!EPC)
+      return EPC.takeError();
+
+    auto ES = std::make_unique<ExecutionSession>(std::move(*EPC));
+
+    std::unique_ptr<EPCIndirectionUtils> EPCIU;
+    if (Opts.Lazy || Opts.RedirectableFunctions) {
+      auto EPCIUOrErr = EPCIndirectionUtils::Create(*ES);
+      if (!EPCIUOrErr)
+        return EPCIUOrErr.takeError();
+      EPCIU = std::move(*EPCIUOrErr);
+      EPCIU->createLazyCallThroughManager(
+          *ES, ExecutorAddr::fromPtr(&handleLazyCallThroughError));
+      if (auto Err = setUpInProcessLCTMReentryViaEPCIU(*EPCIU))
+        return std::move(Err);
+    }
+
+    JITTargetMachineBuilder JTMB(
+        ES->getExecutorProcessControl().getTargetTriple());
+    JTMB.setCPU(Opts.CPU);
+    JTMB.addFeatures(Opts.Features);
+    JTMB.setCodeGenOptLevel(Opts.CodeGenLevel);
+    JTMB.getOptions().AllowFPOpFusion = Opts.FPOpFusion;
+
+    auto DL = JTMB.getDefaultDataLayoutForTarget();
+    if (!DL)
+      return DL.takeError();
+
+    auto ObjLayer = createObjectLayer(*ES, JTMB.getTargetTriple(), Opts);
+    if (!ObjLayer)
+      return ObjLayer.takeError();
+
+    return std::make_unique<PyxcJIT>(std::move(ES), std::move(EPCIU),
+                                     std::move(*ObjLayer), std::move(JTMB),
+                                     std::move(*DL), Opts);
+  }
+
+  const DataLayout &getDataLayout() const { return DL; }
+
+  const Triple &getTargetTriple() const { return JTMB.getTargetTriple(); }
+
+  /// createTargetMachine - A new TargetMachine configured like the one the
+  /// JIT compiles with. A TargetMachine may only be used by one thread at a
+  /// time, so each thread that needs one should create its own.
+  Expected<std::unique_ptr<TargetMachine>> createTargetMachine() {
+    return JTMB.createTargetMachine();
+  }
+
+  JITDylib &getMainJITDylib() { return MainJD; }
+
+  /// getObjectCache - The on-disk object cache, or null if
+  /// PyxcJITOptions::ObjectCacheDir was empty.
+  PyxcObjectCache *getObjectCache() { return ObjCache.get(); }
+
+  Error addModule(ThreadSafeModule TSM, ResourceTrackerSP RT = nullptr) {
+    if (!RT)
+      RT = MainJD.getDefaultResourceTracker();
+    if (CODLayer)
+      return CODLayer->add(RT, std::move(TSM));
+    return CompileLayer.add(RT, std::move(TSM));
+  }
+
+  Expected<ExecutorSymbolDef> lookup(StringRef Name) {
+    return ES->lookup({&MainJD}, Mangle(Name.str()));
+  }
+
+  /// addRedirectableFunction - Add TSM, which defines the body of function
+  /// Name under the symbol BodyName, and bind Name to an indirect stub that
+  /// jumps to that body. Callers (including the body itself) should call
+  /// Name, so a later redirectFunction() takes effect for every call site.
+  Error addRedirectableFunction(ThreadSafeModule TSM, StringRef Name,
+                                StringRef BodyName,
+                                ResourceTrackerSP RT = nullptr) {
+    assert(StubsMgr && "JIT was not created with RedirectableFunctions");
+    {
+      std::lock_guard<std::mutex> Lock(StubsMutex);
+      SymbolStringPtr MangledName = Mangle(Name.str());
+      if (!StubsMgr->findStub(*MangledName, false).getAddress()) {
+        if (auto Err = StubsMgr->createStub(*MangledName, ExecutorAddr(),
+                                            JITSymbolFlags::Exported |
+                                                JITSymbolFlags::Callable))
+          return Err;
+        auto Stub = StubsMgr->findStub(*MangledName, false);
+        if (auto Err = MainJD.define(absoluteSymbols({{MangledName, Stub}})))
+          return Err;
+      }
+    }
+    if (auto Err = addModule(std::move(TSM), RT))
+      return Err;
+    return redirectFunction(Name, BodyName);
+  }
+
+  /// redirectFunction - Point the stub for Name at the symbol BodyName,
+  /// compiling it if needed. Calls already running finish in the old body.
+  /// Safe to call from any thread.
+  Error redirectFunction(StringRef Name, StringRef BodyName) {
+    auto Body = lookup(BodyName);
+    if (!Body)
+      return Body.takeError();
+    std::lock_guard<std::mutex> Lock(StubsMutex);
+    return StubsMgr->updatePointer(*Mangle(Name.str()), Body->getAddress());
+  }
+};
+
+} // end namespace orc
+} // end namespace llvm
+
+#endif // LLVM_EXECUTIONENGINE_ORC_PYXCJIT16_H
@@ -1,8 +1,22 @@
-#include "../include/PyxcJIT.h"
+#include "PyxcJIT16.h"
+#include "../include/PyxcServer.h"
+#include "../include/runtime.h"
 #include "lld/Common/Driver.h"
+#include "llvm/Analysis/TargetLibraryInfo.h"
 #include "llvm/ADT/APFloat.h"
 #include "llvm/ADT/APInt.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/DenseSet.h"
+#include "llvm/ADT/ScopeExit.h"
+#include "llvm/ADT/SmallString.h"
+#include "llvm/ADT/StringExtras.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/ADT/StringSwitch.h"
 #include "llvm/BinaryFormat/Dwarf.h"
+#include "llvm/Bitcode/BitcodeReader.h"
+#include "llvm/Bitcode/BitcodeWriter.h"
+#include "llvm/CodeGen/CommandFlags.h"
+#include "llvm/Config/llvm-config.h"
 #include "llvm/IR/BasicBlock.h"
 #include "llvm/IR/CFG.h"
 #include "llvm/IR/Constants.h"
@@ -12,48 +26,82 @@
 #include "llvm/IR/Function.h"
 #include "llvm/IR/IRBuilder.h"
 #include "llvm/IR/Instructions.h"
+#include "llvm/IR/Intrinsics.h"
 #include "llvm/IR/LLVMContext.h"
 #include "llvm/IR/LegacyPassManager.h"
 #include "llvm/IR/Module.h"
 #include "llvm/IR/NoFolder.h"
+#include "llvm/IR/PassInstrumentation.h"
 #include "llvm/IR/PassManager.h"
+#include "llvm/IR/PassTimingInfo.h"
 #include "llvm/IR/Type.h"
 #include "llvm/IR/Verifier.h"
 #include "llvm/MC/TargetRegistry.h"
 #include "llvm/Passes/OptimizationLevel.h"
 #include "llvm/Passes/PassBuilder.h"
+#include "llvm/Support/Allocator.h"
 #include "llvm/Support/CodeGen.h"
+#include "llvm/Support/EndianStream.h"
 #include "llvm/Support/FileSystem.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/PGOOptions.h"
 #include "llvm/Support/Path.h"
 #include "llvm/Support/Program.h"
+#include "llvm/Support/SHA256.h"
 #include "llvm/Support/TargetSelect.h"
+#include "llvm/Support/ThreadPool.h"
+#include "llvm/Support/Threading.h"
+#include "llvm/Support/Timer.h"
 #include "llvm/Support/VersionTuple.h"
+#include "llvm/Support/VirtualFileSystem.h"
 #include "llvm/Support/raw_ostream.h"
 #include "llvm/Target/TargetMachine.h"
 #include "llvm/Target/TargetOptions.h"
 #include "llvm/TargetParser/Host.h"
+#include "llvm/TargetParser/SubtargetFeature.h"
 #include "llvm/TargetParser/Triple.h"
+#include "llvm/Transforms/IPO/ThinLTOBitcodeWriter.h"
 #include "llvm/Transforms/Scalar.h"
 #include "llvm/Transforms/Scalar/GVN.h"
 #include "llvm/Transforms/Scalar/Reassociate.h"
+#include "llvm/Transforms/Utils/Evaluator.h"
 #include "llvm/Transforms/Utils/Mem2Reg.h"
+#include "llvm/Transforms/Utils/SplitModule.h"
 #include <algorithm>
+#include <atomic>
+#include <cassert>
 #include <cctype>
+#include <cerrno>
+#include <chrono>
+#include <cstddef>
 #include <cstdint>
 #include <cstdio>
 #include <cstdlib>
+#include <cstring>
 #include <deque>
 #include <iomanip>
 #include <map>
 #include <memory>
+#include <mutex>
 #include <optional>
 #include <set>
 #include <sstream>
 #include <string>
+#include <type_traits>
 #include <unistd.h>
 #include <utility>
 #include <vector>
 
+#ifndef _WIN32
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#endif
+
 using namespace std;
 using namespace llvm;
 using namespace llvm::orc;
@@ -83,28 +131,217 @@ static cl::opt<bool> VerboseIR("v", cl::desc("Alias for --dump-ir"),
 // Emit DWARF debug info.
 static cl::opt<bool> DebugInfo("g", cl::desc("Emit DWARF debug info"),
                                cl::init(false), cl::cat(PyxcCategory));
+// Cheaper debug info for optimized builds.
+static cl::opt<bool> LineTablesOnly(
+    "gline-tables-only",
+    cl::desc("Emit only line tables, no variables or types (implies -g)"),
+    cl::init(false), cl::cat(PyxcCategory));
+static cl::opt<bool> SplitDwarf(
+    "gsplit-dwarf",
+    cl::desc("Write DWARF to a .dwo file per input and link only a skeleton "
+             "(ELF, --emit obj or exe; implies -g)"),
+    cl::init(false), cl::cat(PyxcCategory));
 
 // Emit output file in file mode.
 static cl::opt<std::string>
-    EmitKindOpt("emit", cl::desc("Emit output: llvm-ir | asm | obj | exe"),
+    EmitKindOpt("emit",
+                cl::desc("Emit output: llvm-ir | asm | obj | exe | interface"),
                 cl::init(""), cl::cat(PyxcCategory));
 static cl::opt<std::string> OutputFile("o", cl::desc("Output filename"),
                                        cl::value_desc("filename"), cl::init(""),
                                        cl::cat(PyxcCategory));
 
+// Module interfaces (--emit interface) declaring other inputs' functions.
+static cl::list<std::string>
+    Interfaces("interface",
+               cl::desc("Declare the functions and operators in a module "
+                        "interface written by --emit interface"),
+               cl::value_desc("file.pyxi"), cl::cat(PyxcCategory));
+
 // Optimization level.
 static cl::opt<unsigned> OptLevel("O", cl::desc("Optimization level"),
                                   cl::value_desc("0|1|2|3"), cl::Prefix,
                                   cl::init(0), cl::cat(PyxcCategory));
 
-static FILE *Input = stdin;
+// Profile-guided optimization.
+static cl::opt<std::string> ProfileGenerate(
+    "profile-generate", cl::ValueOptional,
+    cl::desc("Instrument the output to write an IR profile at exit (to "
+             "<file>, else $LLVM_PROFILE_FILE or default.profraw)"),
+    cl::value_desc("file"), cl::init(""), cl::cat(PyxcCategory));
+static cl::opt<std::string>
+    ProfileUse("profile-use",
+               cl::desc("Optimize using a profile merged by llvm-profdata"),
+               cl::value_desc("file.profdata"), cl::init(""),
+               cl::cat(PyxcCategory));
+
+// Function-level profiling without an external profiler.
+static cl::opt<std::string> Instrument(
+    "instrument",
+    cl::desc("Instrument the program: calls (count calls and time per "
+             "function and print them to stderr at exit)"),
+    cl::value_desc("calls"), cl::init(""), cl::cat(PyxcCategory));
+
+// Floating-point semantics.
+static cl::opt<bool>
+    FastMath("ffast-math",
+             cl::desc("Allow value-changing floating-point optimizations "
+                      "(reassociation, FMA, no NaN/Inf) in every function"),
+             cl::init(false), cl::cat(PyxcCategory));
+static cl::opt<std::string> FPContractOpt(
+    "ffp-contract",
+    cl::desc("Fuse floating-point multiply-add: off | on (within an "
+             "expression) | fast (anywhere; default with -ffast-math)"),
+    cl::value_desc("off|on|fast"), cl::init(""), cl::cat(PyxcCategory));
+
+// Target CPU and features (--mcpu, --mattr, -march) for both the JIT and
+// emitted code. These are LLVM's shared codegen flags rather than pyxc-local
+// options: the in-process lld registers the same names, so pyxc registers
+// them the same (idempotent) way and reads them through llvm::codegen.
+static codegen::RegisterCodeGenFlags CodeGenFlags;
+
+// Number of threads used to compile .pyxc inputs in --emit exe mode.
+static cl::opt<unsigned>
+    JobCount("j",
+             cl::desc("Compile --emit exe inputs on N threads (0 = one per "
+                      "core)"),
+             cl::value_desc("N"), cl::Prefix, cl::init(1),
+             cl::cat(PyxcCategory));
+
+// Link-time optimization across --emit exe inputs.
+static cl::opt<std::string>
+    LTOModeOpt("lto",
+               cl::desc("Optimize across --emit exe inputs at link time: "
+                        "full | thin"),
+               cl::value_desc("full|thin"), cl::init(""),
+               cl::cat(PyxcCategory));
+
+// Parallel code generation within one --emit exe input.
+static cl::opt<unsigned> CodegenThreads(
+    "codegen-threads",
+    cl::desc("Split each --emit exe input into N partitions and generate "
+             "code for them in parallel"),
+    cl::value_desc("N"), cl::init(1), cl::cat(PyxcCategory));
+
+// Persistent object cache for --emit exe and for running a script.
+static cl::opt<std::string>
+    CacheDir("cache-dir",
+             cl::desc("Reuse objects from this directory when a source file "
+                      "and the compile flags are unchanged (--emit exe and "
+                      "file run mode)"),
+             cl::value_desc("dir"), cl::init(""), cl::cat(PyxcCategory));
+static cl::opt<bool>
+    CacheStats("cache-stats",
+               cl::desc("Print object cache hit/miss counts to stderr"),
+               cl::init(false), cl::cat(PyxcCategory));
+
+// Compile JIT'd functions on first call instead of when they are defined.
+static cl::opt<bool>
+    JITLazy("jit-lazy",
+            cl::desc("JIT each function on its first call (file and REPL "
+                     "modes)"),
+            cl::init(false), cl::cat(PyxcCategory));
+
+// Threads the JIT uses to compile and link modules in the background.
+static cl::opt<unsigned>
+    JITThreads("jit-threads",
+               cl::desc("Materialize JIT modules on N threads (0 = on the "
+                        "calling thread)"),
+               cl::value_desc("N"), cl::init(0), cl::cat(PyxcCategory));
+
+// How JIT'd objects are linked into the process.
+static cl::opt<std::string>
+    JITLinker("jit-linker",
+              cl::desc("Link JIT'd code with: jitlink (the default; its "
+                       "pooled slab keeps many small modules cheap to "
+                       "allocate and close together) | rtdyld (the older "
+                       "linker, for comparison; always used on COFF)"),
+              cl::value_desc("jitlink|rtdyld"), cl::init("jitlink"),
+              cl::cat(PyxcCategory));
+
+// Describe JIT'd code to debuggers and profilers.
+static cl::opt<bool>
+    JITDebugger("jit-debugger",
+                cl::desc("Register JIT'd code with the GDB JIT interface so "
+                         "GDB and LLDB can symbolize it"),
+                cl::init(false), cl::cat(PyxcCategory));
+static cl::opt<bool>
+    JITPerf("jit-perf",
+            cl::desc("Write a jitdump file so 'perf inject --jit' can "
+                     "symbolize JIT'd code (Linux)"),
+            cl::init(false), cl::cat(PyxcCategory));
+
+// Tiered JIT: run baseline code first, recompile hot functions at -O3.
+static cl::opt<bool>
+    JITTiered("jit-tiered",
+              cl::desc("Start JIT'd functions at the -O level and recompile "
+                       "hot ones at -O3 in the background"),
+              cl::init(false), cl::cat(PyxcCategory));
+static cl::opt<unsigned> JITTierThreshold(
+    "jit-tier-threshold",
+    cl::desc("Calls before a --jit-tiered function is recompiled"),
+    cl::value_desc("N"), cl::init(1000), cl::cat(PyxcCategory));
+static cl::opt<bool>
+    JITTierLog("jit-tier-log",
+               cl::desc("Report functions recompiled by --jit-tiered"),
+               cl::init(false), cl::cat(PyxcCategory));
+
+// Compile-time breakdown.
+static cl::opt<bool>
+    TimeReport("time-report",
+               cl::desc("Print wall/CPU time per input file and phase, and "
+                        "per-pass timings, to stderr"),
+               cl::init(false), cl::cat(PyxcCategory));
+static cl::opt<std::string>
+    TimeReportJSON("time-report-json",
+                   cl::desc("Write the --time-report timings as JSON to file"),
+                   cl::value_desc("file"), cl::init(""),
+                   cl::cat(PyxcCategory));
+static cl::opt<bool>
+    LexOnly("lex-only",
+            cl::desc("Only tokenize the input files; with --time-report, "
+                     "this times the lexer on its own"),
+            cl::init(false), cl::cat(PyxcCategory));
+
+// Compile server: a warm pyxc that runs --emit jobs sent by pyxc-client.
+static cl::opt<std::string>
+    ServerSocket("server",
+                 cl::desc("Serve compile requests from pyxc-client on this "
+                          "Unix socket"),
+                 cl::value_desc("socket"), cl::init(""),
+                 cl::cat(PyxcCategory));
+static cl::opt<unsigned> ServerIdleTimeout(
+    "server-idle-timeout",
+    cl::desc("Stop the --server after N seconds without requests (0 = "
+             "never)"),
+    cl::value_desc("N"), cl::init(0), cl::cat(PyxcCategory));
+
+static thread_local FILE *Input = stdin;
+// InputBuffer - The whole source file in file mode (memory-mapped when large
+// enough). When set, the lexer reads from InputCur..InputEnd instead of Input.
+static thread_local std::unique_ptr<MemoryBuffer> InputBuffer;
+static thread_local const char *InputCur = nullptr;
+static thread_local const char *InputEnd = nullptr;
 static bool IsRepl = true;
 
-enum class EmitKind { None, LLVMIR, ASM, OBJ, EXE };
+enum class EmitKind { None, LLVMIR, ASM, OBJ, EXE, Interface };
 static EmitKind EmitMode = EmitKind::None;
 static string EmitOutputPath;
 
+enum class LTOKind { None, Full, Thin };
+static LTOKind LTOMode = LTOKind::None;
+
+// ProfileUseHash - SHA-256 of the --profile-use file, for the object cache key.
+static string ProfileUseHash;
+// InterfaceHash - SHA-256 of the --interface files, for the object cache key.
+static string InterfaceHash;
+
+enum class FPContractKind { Off, On, Fast };
+static FPContractKind FPContract = FPContractKind::Off;
+
 static bool ShouldDumpIR() { return DumpIR || VerboseIR; }
+static bool IsProfileGenerate() { return ProfileGenerate.getNumOccurrences(); }
+static bool IsInstrumentCalls() { return Instrument == "calls"; }
 static bool IsEmitMode() { return EmitMode != EmitKind::None; }
 
 //===----------------------------------------===//
@@ -167,9 +404,17 @@ enum Token {
   tok_none = -31,
   tok_true = -32,
   tok_false = -33,
+
+  // loop control
+  tok_while = -34,
+  tok_break = -35,
+  tok_continue = -36,
+
+  // vector types
+  tok_vec = -37,
 };
 
-enum class ValueType {
+enum class ValueType : unsigned {
   None,
   Int, /* depends on system default for int */
   Int8,
@@ -183,32 +428,117 @@ enum class ValueType {
   Error
 };
 
-static string IdentifierStr;    // Filled in if tok_identifier
-static string NumLiteralStr;    // Raw number literal text (no sign)
-static bool NumIsFloat = false; // True if the literal contains '.' or e/E.
-static int LexerLastChar =
+// Vector types share ValueType: vec[T, N] is T with the lane count N stored
+// above the low byte, so scalars (N == 0) keep their values. A vector matches
+// no enumerator, though, so a switch over ValueType sends it to default: or
+// an Error path. Callers that can see vectors must test IsVectorType first,
+// as ParseTopLevelExpr does before dropping a vector result; the type helpers
+// (TypeName, LLVMTypeFor, ...) assert in default: that none slipped through.
+// Use VectorOf/ElementType/VectorLanes rather than the encoding.
+static constexpr unsigned VectorLaneShift = 8;
+static constexpr unsigned MaxVectorLanes = 64;
+
+static ValueType VectorOf(ValueType Elem, unsigned Lanes) {
+  return static_cast<ValueType>(static_cast<unsigned>(Elem) |
+                                Lanes << VectorLaneShift);
+}
+
+static unsigned VectorLanes(ValueType Type) {
+  return static_cast<unsigned>(Type) >> VectorLaneShift;
+}
+
+static bool IsVectorType(ValueType Type) { return VectorLanes(Type) != 0; }
+
+/// ElementType - The lane type of a vector type; a scalar type is its own
+/// element type.
+static ValueType ElementType(ValueType Type) {
+  return static_cast<ValueType>(static_cast<unsigned>(Type) &
+                                ((1u << VectorLaneShift) - 1));
+}
+
+//===----------------------------------------===//
+// Identifier interning
+//===----------------------------------------===//
+
+/// SymbolID - A small integer naming one distinct identifier spelling. The
+/// parser's symbol tables are keyed on these instead of strings.
+using SymbolID = unsigned;
+
+/// SymbolInfo - What the interner knows about a spelling: its ID and, for
+/// keywords, the token the lexer returns for it.
+struct SymbolInfo {
+  SymbolID ID = 0;
+  int Kind = tok_identifier;
+};
+
+/// StringInterner - Owns one copy of every identifier spelling seen so far.
+///
+/// Interning is a single hash lookup that yields both the spelling's
+/// SymbolID and its token kind, because the keywords are interned up front.
+/// The stored spellings never move, so the StringRefs handed out stay valid
+/// for the life of the interner.
+class StringInterner {
+  StringMap<SymbolInfo, BumpPtrAllocator> Symbols;
+
+public:
+  StringInterner() {
+    // Keywords like `def`, `extern` and `return`. The lexer will return the
+    // associated Token. Additional language keywords can easily be added here.
+    static const pair<const char *, Token> Keywords[] = {
+        {"def", tok_def},         {"extern", tok_extern},
+        {"return", tok_return},   {"if", tok_if},
+        {"else", tok_else},       {"for", tok_for},
+        {"binary", tok_binary},   {"unary", tok_unary},
+        {"var", tok_var},         {"int", tok_int},
+        {"int8", tok_int8},       {"int16", tok_int16},
+        {"int32", tok_int32},     {"int64", tok_int64},
+        {"float", tok_float},     {"float32", tok_float32},
+        {"float64", tok_float64}, {"bool", tok_bool},
+        {"None", tok_none},       {"True", tok_true},
+        {"False", tok_false},     {"while", tok_while},
+        {"break", tok_break},     {"continue", tok_continue},
+        {"vec", tok_vec}};
+    for (const auto &KW : Keywords)
+      intern(KW.first).second.Kind = KW.second;
+  }
+
+  /// intern - Return the entry for Name, adding it if this is a new spelling.
+  StringMapEntry<SymbolInfo> &intern(StringRef Name) {
+    auto Result = Symbols.try_emplace(Name);
+    if (Result.second)
+      Result.first->second.ID = Symbols.size() - 1;
+    return *Result.first;
+  }
+};
+
+// Lexer, parser, and codegen state is thread_local throughout this file so
+// `--emit exe -j N` can compile each input file on its own thread, each with a
+// private LLVMContext/Module/lexer/parser (see EmitExecutable). Single-threaded
+// modes see exactly one copy, as before.
+static thread_local StringInterner Interner;
+// Filled in if tok_identifier (or a keyword): the interned spelling and its
+// symbol. IdentifierStr points into Interner and stays valid.
+static thread_local StringRef IdentifierStr;
+static thread_local SymbolID IdentifierSym = 0;
+// Scratch buffer the lexer collects identifier characters in.
+static thread_local SmallString<32> IdentifierBuf;
+static thread_local string NumLiteralStr; // Raw number literal text (no sign)
+// True if the literal contains '.' or e/E.
+static thread_local bool NumIsFloat = false;
+static thread_local int LexerLastChar =
     ' '; // Last character read by the lexer (used for lookahead and whitespace
 // handling).
-static vector<int> IndentStack = {
+static thread_local vector<int> IndentStack = {
     0}; // Stack of indentation levels (0 is the base indent).
-static deque<int> PendingTokens; // Queue of synthetic tokens
-                                 // (INDENT/DEDENT/EOL) produced by the lexer.
-static bool AtLineStart =
+static thread_local deque<int> PendingTokens; // Queue of synthetic tokens
+                                              // (INDENT/DEDENT/EOL) produced by
+                                              // the lexer.
+static thread_local bool AtLineStart =
     true; // True when the lexer is positioned at the start of a new line.
 
-// Keywords like `def`, `extern` and `return`. The lexer will return the
-// associated Token. Additional language keywords can easily be added here.
-static map<string, Token> Keywords = {
-    {"def", tok_def},         {"extern", tok_extern},   {"return", tok_return},
-    {"if", tok_if},           {"else", tok_else},       {"for", tok_for},
-    {"binary", tok_binary},   {"unary", tok_unary},     {"var", tok_var},
-    {"int", tok_int},         {"int8", tok_int8},       {"int16", tok_int16},
-    {"int32", tok_int32},     {"int64", tok_int64},     {"float", tok_float},
-    {"float32", tok_float32}, {"float64", tok_float64}, {"bool", tok_bool},
-    {"None", tok_none},       {"True", tok_true},       {"False", tok_false}};
-
-// Debug-only token names. Kept separate from Keywords because this map is
-// purely for printing token stream output.
+// Debug-only token names. Kept separate from the keyword table (see
+// StringInterner) because this map is purely for printing token stream
+// output.
 static map<int, string> TokenNames = [] {
   // Unprintable character tokens, and multi-character tokens.
   static map<int, string> Names = {
@@ -228,7 +558,9 @@ static map<int, string> TokenNames = [] {
       {tok_float64, "'float64'"}, {tok_bool, "'bool'"},
       {tok_none, "'None'"},       {tok_true, "'True'"},
       {tok_false, "'False'"},     {tok_indent, "indent"},
-      {tok_dedent, "dedent"}};
+      {tok_dedent, "dedent"},     {tok_while, "'while'"},
+      {tok_break, "'break'"},     {tok_continue, "'continue'"},
+      {tok_vec, "'vec'"}};
 
   // Single character tokens.
   for (int ch = 0; ch <= 255; ++ch) {
@@ -265,21 +597,47 @@ struct SourceLocation {
   int Line;
   int Col;
 };
-static SourceLocation CurLoc;
-static SourceLocation LexLoc = {1, 0};
+static thread_local SourceLocation CurLoc;
+static thread_local SourceLocation LexLoc = {1, 0};
 
-/// SourceManager - Buffers every source line as it is read so that error
-/// messages can reprint the offending line with a caret underneath it.
+/// SourceManager - Gives error messages access to source lines so they can
+/// reprint the offending line with a caret underneath it.
+///
+/// Stream input (stdin/REPL): advance() calls onChar() for every character it
+/// consumes. When a '\n' arrives, the just-completed line is moved into
+/// CompletedLines and CurrentLine starts fresh.
+///
+/// Buffer input (file mode): the whole file is already in memory, so nothing
+/// is copied. LineStarts holds the offset of each line start, found lazily by
+/// scanning the buffer the first time a diagnostic asks for a line.
 ///
-/// advance() calls onChar() for every character it consumes. When a '\n'
-/// arrives, the just-completed line is moved into CompletedLines and
-/// CurrentLine starts fresh. getLine(N) returns a pointer to the Nth line
-/// (1-based): completed lines are stored in the vector; the line currently
-/// being assembled is in CurrentLine.
+/// getLine(N) returns the Nth line (1-based) in either mode.
 class SourceManager {
   vector<string> CompletedLines;
   string CurrentLine;
 
+  StringRef Buffer;
+  bool HasBuffer = false;
+  mutable vector<size_t> LineStarts;
+  mutable size_t ScanPos = 0;
+
+  /// scanLineStarts - Record line starts until Count are known or the buffer
+  /// is exhausted. '\r\n' and a bare '\r' each end one line, as in advance().
+  void scanLineStarts(size_t Count) const {
+    while (LineStarts.size() < Count) {
+      size_t Break = Buffer.find_first_of("\r\n", ScanPos);
+      if (Break == StringRef::npos) {
+        ScanPos = Buffer.size();
+        return;
+      }
+      ScanPos = Break + 1;
+      if (Buffer[Break] == '\r' && ScanPos < Buffer.size() &&
+          Buffer[ScanPos] == '\n')
+        ++ScanPos;
+      LineStarts.push_back(ScanPos);
+    }
+  }
+
 public:
   /// reset - Clear all buffered source lines.
   ///
@@ -288,6 +646,18 @@ public:
   void reset() {
     CompletedLines.clear();
     CurrentLine.clear();
+    Buffer = StringRef();
+    HasBuffer = false;
+    LineStarts.clear();
+    ScanPos = 0;
+  }
+
+  /// setBuffer - Serve lines from Buf, which must outlive this manager's use.
+  void setBuffer(StringRef Buf) {
+    reset();
+    Buffer = Buf;
+    HasBuffer = true;
+    LineStarts.push_back(0);
   }
 
   /// onChar - Feed one consumed character into the source buffer.
@@ -295,7 +665,10 @@ public:
   /// Preconditions:
   /// - Must be called for every character consumed by advance().
   /// - '\n' terminates the current line; EOF is ignored.
+  /// - No-op in buffer mode.
   void onChar(int C) {
+    if (HasBuffer)
+      return;
     if (C == '\n') {
       CompletedLines.push_back(CurrentLine);
       CurrentLine.clear();
@@ -305,47 +678,77 @@ public:
       CurrentLine.push_back(static_cast<char>(C));
   }
 
-  /// getLine - Return a pointer to a buffered source line by 1-based index.
+  /// getLine - Return a source line (without its line ending) by 1-based
+  /// index.
   ///
-  /// Completed lines come from CompletedLines; the in-progress line is
-  /// CurrentLine when OneBasedLine == CompletedLines.size() + 1.
+  /// In stream mode, completed lines come from CompletedLines; the
+  /// in-progress line is CurrentLine when OneBasedLine ==
+  /// CompletedLines.size() + 1. In buffer mode the line is a slice of Buffer.
   ///
   /// Preconditions:
-  /// - OneBasedLine is 1-based. Non-positive indices return nullptr.
+  /// - OneBasedLine is 1-based. Non-positive indices return std::nullopt.
   ///
   /// Note:
-  /// - Do not retain the returned pointer across advance()/onChar() calls;
-  ///   buffers may reallocate.
-  const string *getLine(int OneBasedLine) const {
+  /// - In stream mode, do not retain the result across advance()/onChar()
+  ///   calls; buffers may reallocate.
+  std::optional<StringRef> getLine(int OneBasedLine) const {
     if (OneBasedLine <= 0)
-      return nullptr;
+      return std::nullopt;
     size_t Index = static_cast<size_t>(OneBasedLine - 1);
+    if (HasBuffer) {
+      scanLineStarts(Index + 1);
+      if (Index >= LineStarts.size())
+        return std::nullopt;
+      size_t Start = LineStarts[Index];
+      size_t End = std::min(Buffer.find_first_of("\r\n", Start),
+                            Buffer.size());
+      return Buffer.slice(Start, End);
+    }
     if (Index < CompletedLines.size())
-      return &CompletedLines[Index];
+      return StringRef(CompletedLines[Index]);
     if (Index == CompletedLines.size())
-      return &CurrentLine;
-    return nullptr;
+      return StringRef(CurrentLine);
+    return std::nullopt;
   }
 };
 
-static SourceManager PyxcSourceMgr;
-static void PrintErrorSourceContext(SourceLocation Loc);
+static thread_local SourceManager PyxcSourceMgr;
+// CurrentSourcePath - Path used in debug info and diagnostics.
+static thread_local std::string CurrentSourcePath = "<stdin>";
+static void ReportError(SourceLocation Loc, const Twine &Message);
+
+/// ReadInputChar - Consume one raw character from InputBuffer if a file is
+/// loaded, otherwise from Input.
+static int ReadInputChar() {
+  if (InputBuffer)
+    return InputCur < InputEnd ? static_cast<unsigned char>(*InputCur++) : EOF;
+  return fgetc(Input);
+}
+
+/// PeekInputChar - Return the next raw character without consuming it.
+static int PeekInputChar() {
+  if (InputBuffer)
+    return InputCur < InputEnd ? static_cast<unsigned char>(*InputCur) : EOF;
+  int c = fgetc(Input);
+  if (c != EOF)
+    ungetc(c, Input);
+  return c;
+}
 
-/// advance - Read one character from Input, update LexLoc and SourceManager.
+/// advance - Read one character of input, update LexLoc and SourceManager.
 ///
 /// This is the single point through which all character consumption flows.
-/// Every token branch in gettok() calls advance() rather than fgetc()
-/// directly, so LexLoc and the source buffer are always in sync.
+/// Every token branch in gettok() calls advance() rather than reading the
+/// input directly, so LexLoc and the source buffer are always in sync.
 ///
 /// Windows line endings (\r\n) are coalesced to a single \n
 /// as are bare (old) Mac \r's (without a trailing \n)
 /// so the rest of the lexer never needs to handle \r.
 static int advance() {
-  int LastChar = fgetc(Input);
+  int LastChar = ReadInputChar();
   if (LastChar == '\r') {
-    int NextChar = fgetc(Input);
-    if (NextChar != '\n' && NextChar != EOF)
-      ungetc(NextChar, Input);
+    if (PeekInputChar() == '\n')
+      ReadInputChar();
     PyxcSourceMgr.onChar('\n');
     LexLoc.Line++;
     LexLoc.Col = 0;
@@ -369,12 +772,7 @@ static int advance() {
 /// Used by the two-character operator branches in gettok() to decide whether
 /// '=' should become '==' (tok_eq), '!' should become '!=' (tok_neq), etc.,
 /// without advancing LexLoc or notifying SourceManager.
-static int peek() {
-  int c = fgetc(Input);
-  if (c != EOF)
-    ungetc(c, Input);
-  return c;
-}
+static int peek() { return PeekInputChar(); }
 
 /// gettok - Return the next token from standard input.
 ///
@@ -470,10 +868,7 @@ static int gettok() {
         PendingTokens.push_back(tok_dedent);
       }
       if (IndentCol != IndentStack.back()) {
-        fprintf(stderr,
-                "Error (Line %d, Column %d): inconsistent indentation\n",
-                CurLoc.Line, CurLoc.Col);
-        PrintErrorSourceContext(CurLoc);
+        ReportError(CurLoc, "inconsistent indentation");
         return tok_error;
       }
       // We have at least one pending dedent token. Instead of looping, we just
@@ -507,12 +902,15 @@ static int gettok() {
   }
 
   if (isalpha(LexerLastChar) || LexerLastChar == '_') {
-    IdentifierStr = LexerLastChar;
+    IdentifierBuf.clear();
+    IdentifierBuf.push_back(static_cast<char>(LexerLastChar));
     while (isalnum((LexerLastChar = advance())) || LexerLastChar == '_')
-      IdentifierStr += LexerLastChar;
+      IdentifierBuf.push_back(static_cast<char>(LexerLastChar));
 
-    auto It = Keywords.find(IdentifierStr);
-    return (It == Keywords.end()) ? tok_identifier : It->second;
+    auto &Sym = Interner.intern(IdentifierBuf);
+    IdentifierStr = Sym.getKey();
+    IdentifierSym = Sym.second.ID;
+    return Sym.second.Kind;
   }
 
   if (isdigit(LexerLastChar) || LexerLastChar == '.') {
@@ -551,20 +949,14 @@ static int gettok() {
         LexerLastChar = advance();
       }
       if (!isdigit(LexerLastChar)) {
-        fprintf(stderr,
-                "Error (Line %d, Column %d): invalid number literal '%s'\n",
-                CurLoc.Line, CurLoc.Col, NumStr.c_str());
-        PrintErrorSourceContext(CurLoc);
+        ReportError(CurLoc, "invalid number literal '" + NumStr + "'");
         return tok_error;
       }
       ConsumeDigits();
     }
 
     if (NumStr == ".") {
-      fprintf(stderr,
-              "Error (Line %d, Column %d): invalid number literal '%s'\n",
-              CurLoc.Line, CurLoc.Col, NumStr.c_str());
-      PrintErrorSourceContext(CurLoc);
+      ReportError(CurLoc, "invalid number literal '" + NumStr + "'");
       return tok_error;
     }
 
@@ -648,6 +1040,8 @@ static void ResetLexerState() {
   CurLoc = {1, 0};
   LexerLastChar = ' ';
   PyxcSourceMgr.reset();
+  if (InputBuffer)
+    PyxcSourceMgr.setBuffer(InputBuffer->getBuffer());
 }
 
 //===----------------------------------------===//
@@ -669,7 +1063,7 @@ static SourceLocation GetDiagnosticAnchorLoc(SourceLocation Loc, int Tok) {
 
   // Tok == tok_eol && Loc.Line > 1
   int PrevLine = Loc.Line - 1;
-  const string *PrevLineText = PyxcSourceMgr.getLine(PrevLine);
+  std::optional<StringRef> PrevLineText = PyxcSourceMgr.getLine(PrevLine);
 
   // guard
   if (!PrevLineText)
@@ -686,7 +1080,7 @@ static SourceLocation GetDiagnosticAnchorLoc(SourceLocation Loc, int Tok) {
 /// entry.
 static string FormatTokenForMessage(int Tok) {
   if (Tok == tok_identifier)
-    return "identifier '" + IdentifierStr + "'";
+    return "identifier '" + IdentifierStr.str() + "'";
   if (Tok == tok_number)
     return "number '" + NumLiteralStr + "'";
 
@@ -696,30 +1090,63 @@ static string FormatTokenForMessage(int Tok) {
   return "unknown token";
 }
 
-/// PrintErrorSourceContext - Reprint the source line at Loc and place a
-/// '^~~~' caret under column Loc.Col. Col is 1-based, so we print Col-1
-/// spaces before the caret.
-static void PrintErrorSourceContext(SourceLocation Loc) {
-  const string *LineText = PyxcSourceMgr.getLine(Loc.Line);
-  if (!LineText)
-    return;
-
-  fprintf(stderr, "%s\n", LineText->c_str());
-  int spaces = max(0, Loc.Col - 1);
-  fprintf(stderr, "%*s", spaces, " ");
-  fprintf(stderr, "^~~~\n");
+/// ReportError - Print an error at Loc, then reprint the source line at Loc
+/// and place a '^~~~' caret under column Loc.Col. Col is 1-based, so we print
+/// Col-1 spaces before the caret.
+///
+/// With several inputs the message names the file, since -j compiles them on
+/// separate threads. The whole diagnostic is formatted first and written with
+/// one call, so diagnostics from different threads do not interleave.
+static void ReportError(SourceLocation Loc, const Twine &Message) {
+  string Text;
+  raw_string_ostream OS(Text);
+  if (InputFiles.size() > 1)
+    OS << CurrentSourcePath << ": ";
+  OS << "Error (Line " << Loc.Line << ", Column " << Loc.Col
+     << "): " << Message << "\n";
+  if (std::optional<StringRef> LineText = PyxcSourceMgr.getLine(Loc.Line)) {
+    OS << *LineText << "\n";
+    OS.indent(max(1, Loc.Col - 1)) << "^~~~\n";
+  }
+  fwrite(Text.data(), 1, Text.size(), stderr);
 }
 
 //===----------------------------------------===//
 // Abstract Syntax Tree (aka Parse Tree)
 //===----------------------------------------===//
+
+// ASTArena - Backing store for every ExprAST node of the current compilation
+// unit (one input file, or one top-level REPL item). Nodes are bump-allocated
+// so a file's expressions sit contiguously in a few large slabs instead of
+// one malloc each. Deleting a node runs its destructor but returns nothing;
+// ResetASTArena() releases the lot once the unit is finished.
+static thread_local BumpPtrAllocator ASTArena;
+// LiveASTNodes - Nodes allocated from ASTArena and not yet destroyed.
+static thread_local size_t LiveASTNodes = 0;
+
+/// ResetASTArena - Free every AST node allocated for the previous compilation
+/// unit. No ExprAST may still be alive.
+static void ResetASTArena() {
+  assert(LiveASTNodes == 0 && "AST node outlived its compilation unit");
+  ASTArena.Reset();
+}
+
 namespace {
 
 /// ExprAST - Base class for all expression nodes.
+///
+/// The class-level operator new/delete route every node, including those
+/// owned through unique_ptr<ExprAST>, through ASTArena.
 class ExprAST {
   ValueType Type = ValueType::Error;
 
 public:
+  static void *operator new(size_t Size) {
+    ++LiveASTNodes;
+    return ASTArena.Allocate(Size, alignof(std::max_align_t));
+  }
+  static void operator delete(void *, size_t) { --LiveASTNodes; }
+
   virtual ~ExprAST() = default;
   ValueType getType() const { return Type; }
   // getLValueName - If this node is a plain assignable variable, return its
@@ -727,6 +1154,9 @@ public:
   virtual const string *getLValueName() const { return nullptr; }
   // isReturnExpr - True iff this node is a return statement.
   virtual bool isReturnExpr() const { return false; }
+  // getAdditiveLHS - If this node is a built-in '+' or '-', return its left
+  // operand; otherwise return nullptr.
+  virtual const ExprAST *getAdditiveLHS() const { return nullptr; }
   // shouldPrintValue - Whether the REPL should print the value of this node
   // when it appears as a top-level form.
   virtual bool shouldPrintValue() const { return true; }
@@ -833,6 +1263,9 @@ public:
       : Op(Op), LHS(std::move(LHS)), RHS(std::move(RHS)) {
     setType(Type);
   }
+  const ExprAST *getAdditiveLHS() const override {
+    return Op == '+' || Op == '-' ? LHS.get() : nullptr;
+  }
   Value *codegen() override;
 };
 
@@ -878,6 +1311,66 @@ public:
   Value *codegen() override;
 };
 
+/// WhileExprAST - Expression class for while loops.
+///   while <cond>: <body>
+/// The condition is tested before every iteration. Like for, the loop is a
+/// statement and produces 0.0.
+class WhileExprAST : public ExprAST {
+  unique_ptr<ExprAST> Cond, Body;
+
+public:
+  WhileExprAST(unique_ptr<ExprAST> Cond, unique_ptr<ExprAST> Body)
+      : Cond(std::move(Cond)), Body(std::move(Body)) {
+    setType(ValueType::None);
+  }
+  bool shouldPrintValue() const override { return false; }
+  Value *codegen() override;
+};
+
+/// LoopExitAST - A break or continue statement. It jumps out of, or to the
+/// next iteration of, the innermost enclosing loop.
+class LoopExitAST : public ExprAST {
+  bool IsBreak;
+
+public:
+  LoopExitAST(bool IsBreak) : IsBreak(IsBreak) { setType(ValueType::None); }
+  bool shouldPrintValue() const override { return false; }
+  Value *codegen() override;
+};
+
+/// ParallelForExprAST - A for loop marked @parallel.
+///   @parallel(<reductions>)
+///   for var <var> = <start>, <var> < <bound>, <step>: <body>
+/// Start, bound, and step are evaluated once before the loop; the iterations
+/// are then independent and run in any order, on any thread. The body is
+/// outlined into its own function, which reads the enclosing function's
+/// locals through copies and may only update Reductions, each of which is
+/// summed per chunk and added into the variable after the loop.
+class ParallelForExprAST : public ExprAST {
+  string VarName;
+  ValueType VarType;
+  unique_ptr<ExprAST> Start, Bound, Step, Body;
+  bool InclusiveBound; // <var> <= <bound>
+  vector<pair<string, ValueType>> Reductions;
+
+public:
+  ParallelForExprAST(const string &VarName, ValueType VarType,
+                     unique_ptr<ExprAST> Start, unique_ptr<ExprAST> Bound,
+                     bool InclusiveBound, unique_ptr<ExprAST> Step,
+                     unique_ptr<ExprAST> Body,
+                     vector<pair<string, ValueType>> Reductions)
+      : VarName(VarName), VarType(VarType), Start(std::move(Start)),
+        Bound(std::move(Bound)), Step(std::move(Step)), Body(std::move(Body)),
+        InclusiveBound(InclusiveBound), Reductions(std::move(Reductions)) {
+    setType(ValueType::None);
+  }
+  bool shouldPrintValue() const override { return false; }
+  Value *codegen() override;
+
+private:
+  Function *outlineBody(ArrayRef<pair<string, AllocaInst *>> Captures);
+};
+
 /// UnaryExprAST - Expression class for a unary operator application.
 /// The operator is identified by its ASCII character (e.g. '-' or '!').
 /// Built-in unary minus is represented here with opcode '-' and lowered
@@ -908,6 +1401,49 @@ public:
   Value *codegen() override;
 };
 
+/// VectorExprAST - vec[T, N](a, b, ...): a vector built from one expression
+/// per lane. The one-argument splat form is a CastExprAST.
+class VectorExprAST : public ExprAST {
+  vector<unique_ptr<ExprAST>> Lanes;
+
+public:
+  VectorExprAST(ValueType VecType, vector<unique_ptr<ExprAST>> Lanes)
+      : Lanes(std::move(Lanes)) {
+    setType(VecType);
+  }
+  Value *codegen() override;
+};
+
+/// VectorBuiltin - The lane and horizontal builtins on vector values.
+enum class VectorBuiltin {
+  ExtractLane, // extract_lane(v, i) -> T
+  InsertLane,  // insert_lane(v, i, x) -> vec[T, N]
+  Select,      // select(mask, a, b) -> vec[T, N]
+  ReduceAdd,   // reduce_add(v) -> T
+  ReduceMul,   // reduce_mul(v) -> T
+  ReduceMin,   // reduce_min(v) -> T
+  ReduceMax,   // reduce_max(v) -> T
+  Any,         // any(mask) -> bool
+  All,         // all(mask) -> bool
+};
+
+/// VectorBuiltinExprAST - A call to one of the vector builtins. Lane indices
+/// are checked against the vector length by the parser, so Lane is only
+/// meaningful for extract_lane and insert_lane.
+class VectorBuiltinExprAST : public ExprAST {
+  VectorBuiltin Kind;
+  unsigned Lane;
+  vector<unique_ptr<ExprAST>> Args;
+
+public:
+  VectorBuiltinExprAST(VectorBuiltin Kind, unsigned Lane,
+                       vector<unique_ptr<ExprAST>> Args, ValueType ResultType)
+      : Kind(Kind), Lane(Lane), Args(std::move(Args)) {
+    setType(ResultType);
+  }
+  Value *codegen() override;
+};
+
 /// IfStmtAST - Statement form of if/else.
 /// Produces 0.0 and does not return a value.
 class IfStmtAST : public ExprAST {
@@ -954,6 +1490,20 @@ public:
 /// unary '!' operator. Precedence is only meaningful for binary operators — it
 /// is installed into BinopPrecedence at codegen time, making the new operator
 /// immediately available to the parser for subsequent expressions.
+///
+/// Decorators is a mask of FunctionDecorator bits set by '@name' lines above
+/// the 'def' (see ParseDecoratedDef).
+enum FunctionDecorator : unsigned {
+  FD_None = 0,
+  FD_FastMath = 1u << 0, // @fastmath
+  FD_Inline = 1u << 1,   // @inline: alwaysinline
+  FD_NoInline = 1u << 2, // @noinline: noinline
+  FD_Pure = 1u << 3,     // @pure: memory(none) or memory(read), willreturn
+  FD_Cold = 1u << 4,     // @cold: cold
+  // Every known bit, for checking masks read from interface files.
+  FD_All = FD_FastMath | FD_Inline | FD_NoInline | FD_Pure | FD_Cold,
+};
+
 class PrototypeAST {
   string Name;
   vector<pair<string, ValueType>> Args;
@@ -961,6 +1511,10 @@ class PrototypeAST {
   bool IsOperator;
   unsigned Precedence; // binary operators only
   SourceLocation Loc;
+  unsigned Decorators = FD_None;
+  // For @pure functions: the body, or a @pure function it calls, reads a
+  // global, so the function may read memory but not write it.
+  bool ReadsGlobals = false;
 
 public:
   PrototypeAST(const string &Name, vector<pair<string, ValueType>> Args,
@@ -994,9 +1548,18 @@ public:
 
   unsigned getBinaryPrecedence() const { return Precedence; }
 
+  bool hasDecorator(FunctionDecorator D) const { return Decorators & D; }
+  unsigned getDecorators() const { return Decorators; }
+  void addDecorators(unsigned Mask) { Decorators |= Mask; }
+  bool readsGlobals() const { return ReadsGlobals; }
+  void setReadsGlobals() { ReadsGlobals = true; }
+
   std::unique_ptr<PrototypeAST> clone() const {
-    return std::make_unique<PrototypeAST>(Name, Args, Loc, ReturnType,
-                                          IsOperator, Precedence);
+    auto Copy = std::make_unique<PrototypeAST>(Name, Args, Loc, ReturnType,
+                                               IsOperator, Precedence);
+    Copy->addDecorators(Decorators);
+    Copy->ReadsGlobals = ReadsGlobals;
+    return Copy;
   }
 
   Function *codegen();
@@ -1012,6 +1575,9 @@ public:
       : Proto(std::move(Proto)), Body(std::move(Body)) {}
   const string &getName() const { return Proto->getName(); }
   ValueType getReturnType() const { return Proto->getReturnType(); }
+  bool isOperator() const {
+    return Proto->isBinaryOp() || Proto->isUnaryOp();
+  }
   Function *codegen();
 };
 
@@ -1025,7 +1591,7 @@ public:
 /// getNextToken reads the next token from the lexer and stores it in CurTok.
 /// Every parse function assumes CurTok is already loaded before it is called,
 /// and leaves CurTok pointing at the first token it did not consume.
-static int CurTok;
+static thread_local int CurTok;
 static int getNextToken() { return CurTok = gettok(); }
 
 /// consumeNewlines - Consume all consecutive tok_eol tokens.
@@ -1038,7 +1604,7 @@ static void consumeNewlines() {
 }
 
 /// BinopPrecedence - Maps each binary operator token to its precedence.
-/// Higher numbers bind more tightly: '*' (40) > '+'/'-' (20) > comparisons
+/// Higher numbers bind more tightly: '*'/'/' (40) > '+'/'-' (20) > comparisons
 /// (10). The key is an int rather than char so it can hold both
 /// single-character ASCII operators ('+', '-', '*', '<', '>') and
 /// multi-character named token enums (tok_eq, tok_neq, tok_leq, tok_geq). All
@@ -1056,8 +1622,9 @@ static const map<int, int> DefaultBinopPrecedence = {
     {'+', 20},     // +
     {'-', 20},     // -
     {'*', 40},     // *
+    {'/', 40},     // /
 };
-static map<int, int> BinopPrecedence = DefaultBinopPrecedence;
+static thread_local map<int, int> BinopPrecedence = DefaultBinopPrecedence;
 
 static void ResetBinopPrecedence() { BinopPrecedence = DefaultBinopPrecedence; }
 
@@ -1067,7 +1634,8 @@ static void ResetBinopPrecedence() { BinopPrecedence = DefaultBinopPrecedence; }
 // Seed with '-' because unary minus is a built-in form handled by
 // ParseUnaryMinus(), so users cannot define a custom unary '-'.
 static const std::set<int> DefaultKnownUnaryOperators = {'-'};
-static std::set<int> KnownUnaryOperators = DefaultKnownUnaryOperators;
+static thread_local std::set<int> KnownUnaryOperators =
+    DefaultKnownUnaryOperators;
 
 static void ResetKnownUnaryOperators() {
   KnownUnaryOperators = DefaultKnownUnaryOperators;
@@ -1076,23 +1644,112 @@ static void ResetKnownUnaryOperators() {
 // FunctionProtos - Persistent prototype registry used by the parser to detect
 // redefinition of operators. Also used by codegen to re-emit declarations into
 // fresh modules. Declared here so parser functions can access it.
-static std::map<std::string, std::unique_ptr<PrototypeAST>> FunctionProtos;
+static thread_local StringMap<std::unique_ptr<PrototypeAST>> FunctionProtos;
+
+/// ScopedVarTable - Parse-time variable types for a stack of nested scopes.
+///
+/// Rather than one map per scope searched from the innermost outward, a
+/// single DenseMap holds the innermost binding of each symbol, so a lookup
+/// is one hash probe however deep the nesting. Each binding remembers the
+/// one it shadows, and popping a scope restores those in reverse order.
+class ScopedVarTable {
+  struct Binding {
+    SymbolID Sym;
+    ValueType Type;
+    unsigned Depth;
+    unsigned Shadowed; // Index of the binding this one hides, or NoBinding.
+  };
+  static constexpr unsigned NoBinding = ~0u;
+
+  vector<Binding> Bindings;
+  vector<unsigned> ScopeStarts; // Index of each scope's first binding.
+  DenseMap<SymbolID, unsigned> Innermost;
+
+  const Binding *find(SymbolID Sym) const {
+    auto It = Innermost.find(Sym);
+    return It == Innermost.end() ? nullptr : &Bindings[It->second];
+  }
+
+public:
+  bool empty() const { return ScopeStarts.empty(); }
+  size_t depth() const { return ScopeStarts.size(); }
+
+  void pushScope() { ScopeStarts.push_back(Bindings.size()); }
+
+  void popScope() {
+    assert(!empty() && "no scope to pop");
+    for (unsigned I = Bindings.size(); I-- > ScopeStarts.back();) {
+      if (Bindings[I].Shadowed == NoBinding)
+        Innermost.erase(Bindings[I].Sym);
+      else
+        Innermost[Bindings[I].Sym] = Bindings[I].Shadowed;
+    }
+    Bindings.resize(ScopeStarts.back());
+    ScopeStarts.pop_back();
+  }
+
+  void clear() {
+    Bindings.clear();
+    ScopeStarts.clear();
+    Innermost.clear();
+  }
+
+  /// declare - Bind Sym in the innermost scope, replacing an earlier binding
+  /// there and shadowing any in outer scopes.
+  void declare(SymbolID Sym, ValueType Type) {
+    assert(!empty() && "no scope to declare into");
+    unsigned Depth = ScopeStarts.size();
+    auto [It, Inserted] = Innermost.try_emplace(Sym, Bindings.size());
+    if (!Inserted && Bindings[It->second].Depth == Depth) {
+      Bindings[It->second].Type = Type;
+      return;
+    }
+    unsigned Shadowed = Inserted ? NoBinding : It->second;
+    It->second = Bindings.size();
+    Bindings.push_back({Sym, Type, Depth, Shadowed});
+  }
+
+  /// lookup - The type of the innermost binding of Sym, if any.
+  std::optional<ValueType> lookup(SymbolID Sym) const {
+    if (const Binding *B = find(Sym))
+      return B->Type;
+    return std::nullopt;
+  }
+
+  bool isDeclaredInInnermostScope(SymbolID Sym) const {
+    const Binding *B = find(Sym);
+    return B && B->Depth == ScopeStarts.size();
+  }
+
+  /// depthOf - The scope depth of the innermost binding of Sym, if any.
+  std::optional<unsigned> depthOf(SymbolID Sym) const {
+    if (const Binding *B = find(Sym))
+      return B->Depth;
+    return std::nullopt;
+  }
+};
 
 // Parse-time variable tracking for assignments and types.
 // Scopes are stacked: function scope plus nested block scopes.
 // for-loop variables are scoped to the loop body only.
-static vector<std::map<string, ValueType>> VarScopes;
+static thread_local ScopedVarTable VarScopes;
 // Global variables declared at top level (persist across modules).
-static std::map<string, ValueType> GlobalVarTypes;
+static thread_local DenseMap<SymbolID, ValueType> GlobalVarTypes;
 // Track which globals were declared in this translation unit (for redeclare
 // checks).
-static std::set<string> GlobalVarDecls;
+static thread_local DenseSet<SymbolID> GlobalVarDecls;
+
+/// InternName - The symbol for a name held as a string (for example one taken
+/// from the AST) rather than one just lexed.
+static SymbolID InternName(StringRef Name) {
+  return Interner.intern(Name).second.ID;
+}
 // True while parsing a top-level statement (var binds globals, not locals).
-static bool ParsingTopLevel = false;
+static thread_local bool ParsingTopLevel = false;
 // Set when we hit a parse/codegen error; used to abort further processing.
-static bool HadError = false;
+static thread_local bool HadError = false;
 // Current function's declared return type during parsing/codegen.
-static ValueType CurrentFunctionReturnType = ValueType::None;
+static thread_local ValueType CurrentFunctionReturnType = ValueType::None;
 
 struct TopLevelParseGuard {
   TopLevelParseGuard() { ParsingTopLevel = true; }
@@ -1101,55 +1758,53 @@ struct TopLevelParseGuard {
 
 static void BeginFunctionScope(const vector<pair<string, ValueType>> &Args) {
   VarScopes.clear();
-  VarScopes.emplace_back();
+  VarScopes.pushScope();
   for (const auto &Arg : Args)
-    VarScopes.front()[Arg.first] = Arg.second;
+    VarScopes.declare(InternName(Arg.first), Arg.second);
 }
 
 static void EndFunctionScope() { VarScopes.clear(); }
 
-static void DeclareVar(const string &Name, ValueType Type) {
+static void DeclareVar(SymbolID Sym, ValueType Type) {
   // Only declare into an active local scope; at top level VarScopes is empty.
   if (VarScopes.empty())
     return;
-  VarScopes.back()[Name] = Type;
+  VarScopes.declare(Sym, Type);
 }
 
-static void BeginBlockScope() { VarScopes.emplace_back(); }
+static void BeginBlockScope() { VarScopes.pushScope(); }
 
 // Pop a block scope if one is active.
-// Size > 1 means a nested block inside a function; never pop the function scope
-// here. Size == 1 is only popped for top-level blocks (function scope is popped
-// in EndFunctionScope).
+// Depth > 1 means a nested block inside a function; never pop the function
+// scope here. Depth == 1 is only popped for top-level blocks (function scope
+// is popped in EndFunctionScope).
 static void EndBlockScope() {
-  if (VarScopes.size() > 1)
-    VarScopes.pop_back();
-  else if (ParsingTopLevel && VarScopes.size() == 1)
-    VarScopes.pop_back();
+  if (VarScopes.depth() > 1)
+    VarScopes.popScope();
+  else if (ParsingTopLevel && VarScopes.depth() == 1)
+    VarScopes.popScope();
 }
 
 // Check only the innermost scope (used for redeclaration checks).
-static bool IsDeclaredInCurrentScope(const string &Name) {
-  if (VarScopes.empty())
-    return false;
-  return VarScopes.back().count(Name) > 0;
+static bool IsDeclaredInCurrentScope(SymbolID Sym) {
+  return VarScopes.isDeclaredInInnermostScope(Sym);
 }
 
 // Ensure a function scope exists, then add a new scope for the loop variable.
-static void EnterLoopScope(const string &Name, ValueType Type) {
+static void EnterLoopScope(SymbolID Sym, ValueType Type) {
   if (VarScopes.empty())
-    VarScopes.emplace_back();
-  VarScopes.emplace_back();
-  VarScopes.back()[Name] = Type;
+    VarScopes.pushScope();
+  VarScopes.pushScope();
+  VarScopes.declare(Sym, Type);
 }
 
-// Size == 1 is only popped for top-level blocks (function scope is popped in
+// Depth == 1 is only popped for top-level blocks (function scope is popped in
 // EndFunctionScope).
 static void ExitLoopScope() {
-  if (VarScopes.size() > 1)
-    VarScopes.pop_back();
-  if (ParsingTopLevel && VarScopes.size() == 1)
-    VarScopes.pop_back();
+  if (VarScopes.depth() > 1)
+    VarScopes.popScope();
+  if (ParsingTopLevel && VarScopes.depth() == 1)
+    VarScopes.popScope();
 }
 
 struct FunctionScopeGuard {
@@ -1160,9 +1815,7 @@ struct FunctionScopeGuard {
 };
 
 struct LoopScopeGuard {
-  LoopScopeGuard(const string &Name, ValueType Type) {
-    EnterLoopScope(Name, Type);
-  }
+  LoopScopeGuard(SymbolID Sym, ValueType Type) { EnterLoopScope(Sym, Type); }
   ~LoopScopeGuard() { ExitLoopScope(); }
 };
 
@@ -1171,6 +1824,56 @@ struct BlockScopeGuard {
   ~BlockScopeGuard() { EndBlockScope(); }
 };
 
+/// ParallelLoopContext - The innermost @parallel loop being parsed. Its body
+/// runs on several threads at once, so it may assign only variables declared
+/// inside the loop and the loop's reductions.
+struct ParallelLoopContext {
+  size_t Depth = 0; // VarScopes depth of the loop variable's scope.
+  unsigned LoopDepth = 0; // LoopDepth while parsing the body.
+  ParallelLoopContext *Outer = nullptr; // Enclosing @parallel loop, if any.
+  SmallVector<SymbolID, 4> Reductions;
+  vector<pair<string, ValueType>> ReductionVars;
+  bool InclusiveBound = false;
+};
+static thread_local ParallelLoopContext *CurParallelLoop = nullptr;
+
+// Number of loops enclosing the statement being parsed; break and continue
+// are only valid when it is non-zero.
+static thread_local unsigned LoopDepth = 0;
+
+struct LoopBodyGuard {
+  LoopBodyGuard() { ++LoopDepth; }
+  ~LoopBodyGuard() { --LoopDepth; }
+};
+
+struct ParallelLoopGuard {
+  ParallelLoopContext *Saved;
+  ParallelLoopGuard(ParallelLoopContext *Loop) : Saved(CurParallelLoop) {
+    CurParallelLoop = Loop;
+  }
+  ~ParallelLoopGuard() { CurParallelLoop = Saved; }
+};
+
+// The @pure function whose body is being parsed, or null. Its body may not
+// write globals or call functions that are not @pure; reading a global sets
+// its ReadsGlobals.
+static thread_local PrototypeAST *CurPureFunction = nullptr;
+
+struct PureFunctionGuard {
+  PrototypeAST *Saved;
+  PureFunctionGuard(PrototypeAST &Proto) : Saved(CurPureFunction) {
+    CurPureFunction = Proto.hasDecorator(FD_Pure) ? &Proto : nullptr;
+  }
+  ~PureFunctionGuard() {
+    // The registered prototype was cloned before the body was parsed.
+    if (CurPureFunction && CurPureFunction->readsGlobals())
+      if (auto It = FunctionProtos.find(CurPureFunction->getName());
+          It != FunctionProtos.end())
+        It->second->setReadsGlobals();
+    CurPureFunction = Saved;
+  }
+};
+
 struct ReturnTypeGuard {
   ValueType Saved;
   ReturnTypeGuard(ValueType Type) : Saved(CurrentFunctionReturnType) {
@@ -1179,25 +1882,23 @@ struct ReturnTypeGuard {
   ~ReturnTypeGuard() { CurrentFunctionReturnType = Saved; }
 };
 
-// IsDeclaredVar - Check all local scopes from innermost to outermost, then
+// IsGlobalVar - True if Sym names a global here, i.e. no local shadows it.
+static bool IsGlobalVar(SymbolID Sym) {
+  return !VarScopes.lookup(Sym) && GlobalVarTypes.count(Sym) > 0;
+}
+
+// IsDeclaredVar - Check the local scopes, innermost binding first, then
 // fall back to globals. Used to validate assignments and references.
-static bool IsDeclaredVar(const string &Name) {
-  for (auto It = VarScopes.rbegin(); It != VarScopes.rend(); ++It) {
-    if (It->count(Name))
-      return true;
-  }
-  return GlobalVarTypes.count(Name) > 0;
+static bool IsDeclaredVar(SymbolID Sym) {
+  return VarScopes.lookup(Sym) || GlobalVarTypes.count(Sym) > 0;
 }
 
 // LookupVarType - Return the type from the nearest enclosing local scope,
 // or from globals if not found; otherwise ValueType::Error.
-static ValueType LookupVarType(const string &Name) {
-  for (auto It = VarScopes.rbegin(); It != VarScopes.rend(); ++It) {
-    auto Found = It->find(Name);
-    if (Found != It->end())
-      return Found->second;
-  }
-  auto GI = GlobalVarTypes.find(Name);
+static ValueType LookupVarType(SymbolID Sym) {
+  if (auto Type = VarScopes.lookup(Sym))
+    return *Type;
+  auto GI = GlobalVarTypes.find(Sym);
   if (GI != GlobalVarTypes.end())
     return GI->second;
   return ValueType::Error;
@@ -1234,10 +1935,7 @@ void Log(const string &message) {
 /// type so parse functions can write: return LogError("message");
 unique_ptr<ExprAST> LogError(const char *Str) {
   HadError = true;
-  SourceLocation Anchor = GetDiagnosticAnchorLoc(CurLoc, CurTok);
-  fprintf(stderr, "Error (Line %d, Column %d): %s\n", Anchor.Line, Anchor.Col,
-          Str);
-  PrintErrorSourceContext(Anchor);
+  ReportError(GetDiagnosticAnchorLoc(CurLoc, CurTok), Str);
   return nullptr;
 }
 
@@ -1251,6 +1949,59 @@ unique_ptr<FunctionAST> LogErrorF(const char *Str) {
   return nullptr;
 }
 
+/// CheckPureAssignment - Inside a @pure function, reject an assignment to a
+/// global.
+static bool CheckPureAssignment(const string &Name, SymbolID Sym) {
+  if (!CurPureFunction || !IsGlobalVar(Sym))
+    return true;
+  LogError(("@pure function '" + CurPureFunction->getName() +
+            "' cannot assign to global '" + Name + "'")
+               .c_str());
+  return false;
+}
+
+/// CheckPureCall - Inside a @pure function, reject a call to a function that
+/// is not @pure, and note a call to one that reads globals.
+static bool CheckPureCall(const PrototypeAST &Callee) {
+  if (!CurPureFunction || Callee.getName() == CurPureFunction->getName())
+    return true;
+  if (!Callee.hasDecorator(FD_Pure)) {
+    LogError(("@pure function '" + CurPureFunction->getName() +
+              "' cannot call '" + Callee.getName() + "', which is not @pure")
+                 .c_str());
+    return false;
+  }
+  if (Callee.readsGlobals())
+    CurPureFunction->setReadsGlobals();
+  return true;
+}
+
+/// CheckParallelAssignment - Inside a @parallel loop body, reject an
+/// assignment to a variable that every iteration shares.
+static bool CheckParallelAssignment(const string &Name, SymbolID Sym) {
+  if (!CurParallelLoop || is_contained(CurParallelLoop->Reductions, Sym))
+    return true;
+  auto Depth = VarScopes.depthOf(Sym);
+  if (Depth && *Depth > CurParallelLoop->Depth)
+    return true;
+  LogError(("Cannot assign to '" + Name +
+            "' in a @parallel loop; it is shared by every iteration (list it "
+            "in @parallel(...) to sum into it)")
+               .c_str());
+  return false;
+}
+
+/// IsParallelReduction - True if Sym names a reduction of a @parallel loop
+/// whose body is being parsed. Inside the body it holds one thread's partial
+/// sum, so it may only be updated by ParseReductionUpdate, never read.
+static bool IsParallelReduction(SymbolID Sym) {
+  auto Depth = VarScopes.depthOf(Sym);
+  for (auto *Loop = CurParallelLoop; Loop; Loop = Loop->Outer)
+    if (Depth && *Depth < Loop->Depth && is_contained(Loop->Reductions, Sym))
+      return true;
+  return false;
+}
+
 static unique_ptr<ExprAST> ParseExpression();
 static unique_ptr<ExprAST> ParsePrimary();
 static unique_ptr<ExprAST> ParseVarStmt();
@@ -1261,16 +2012,16 @@ static unique_ptr<ExprAST> ParseFunctionBody(bool *BodyIsBlock);
 
 // Inside a block: true if the last statement was a compound block (if/for),
 // so the next statement can start without a tok_eol.
-static bool LastStatementWasBlock = false;
+static thread_local bool LastStatementWasBlock = false;
 
 // At top level: true if the last top‑level form ended with a block,
 // so the next top‑level form can start without a tok_eol.
-static bool LastTopLevelEndedWithBlock = false;
+static thread_local bool LastTopLevelEndedWithBlock = false;
 
 // Counter to give each anonymous top-level expression a unique name.
-static unsigned TopLevelExprCounter = 0;
+static thread_local unsigned TopLevelExprCounter = 0;
 // Whether the last top-level form should be printed in the REPL.
-static bool LastTopLevelShouldPrint = true;
+static thread_local bool LastTopLevelShouldPrint = true;
 
 static unique_ptr<ExprAST> ParseSuite(bool *EndedWithBlock);
 static ValueType ParseTypeToken();
@@ -1282,7 +2033,7 @@ static bool IsAssignable(ValueType Dest, ValueType Src);
 static Type *LLVMTypeFor(ValueType Type);
 static PrototypeAST *GetFunctionProto(const string &Name);
 // Optional expected type for numeric literals (used for float/float32).
-static ValueType ExpectedLiteralType = ValueType::Error;
+static thread_local ValueType ExpectedLiteralType = ValueType::Error;
 
 struct ExpectedLiteralTypeGuard {
   ValueType Saved;
@@ -1293,6 +2044,12 @@ struct ExpectedLiteralTypeGuard {
 };
 
 static unique_ptr<ExprAST> MakeZeroLiteral(ValueType Type) {
+  if (IsVectorType(Type)) {
+    auto Zero = MakeZeroLiteral(ElementType(Type));
+    if (!Zero)
+      return nullptr;
+    return make_unique<CastExprAST>(Type, std::move(Zero));
+  }
   if (IsIntType(Type)) {
     unsigned Bits = LLVMTypeFor(Type)->getIntegerBitWidth();
     return make_unique<NumberExprAST>(APInt(Bits, 0), Type);
@@ -1366,15 +2123,53 @@ static unique_ptr<ExprAST> ParseNumberExpr() {
   }
 }
 
+/// vectype
+///   = "vec" "[" type "," integer "]" ;
+/// The element type must be a number or bool type.
+static ValueType ParseVectorType() {
+  getNextToken(); // eat 'vec'
+  if (CurTok != '[') {
+    LogError("Expected '[' after 'vec'");
+    return ValueType::Error;
+  }
+  getNextToken(); // eat '['
+  ValueType Elem = ParseTypeToken();
+  if (Elem == ValueType::Error)
+    return ValueType::Error;
+  if (!IsNumericType(Elem) && Elem != ValueType::Bool) {
+    LogError("Vector element type must be a number or bool type");
+    return ValueType::Error;
+  }
+  if (CurTok != ',') {
+    LogError("Expected ',' after vector element type");
+    return ValueType::Error;
+  }
+  getNextToken(); // eat ','
+  unsigned Lanes = 0;
+  if (CurTok != tok_number || NumIsFloat ||
+      StringRef(NumLiteralStr).getAsInteger(10, Lanes) || Lanes < 2 ||
+      Lanes > MaxVectorLanes) {
+    LogError("Vector length must be an integer from 2 to 64");
+    return ValueType::Error;
+  }
+  getNextToken(); // eat the length
+  if (CurTok != ']') {
+    LogError("Expected ']' after vector length");
+    return ValueType::Error;
+  }
+  getNextToken(); // eat ']'
+  return VectorOf(Elem, Lanes);
+}
+
 /// type
 ///   = "int" | "int8" | "int16" | "int32" | "int64"
 ///   | "float" | "float32" | "float64"
-///   | "bool" | "None" ;
+///   | "bool" | "None" | vectype ;
 ///
 /// casttype
 ///   = "int" | "int8" | "int16" | "int32" | "int64"
 ///   | "float" | "float32" | "float64"
-///   | "bool" ;
+///   | "bool" | vectype ;
 static ValueType ParseTypeToken() {
   switch (CurTok) {
   case tok_int:
@@ -1407,14 +2202,19 @@ static ValueType ParseTypeToken() {
   case tok_none:
     getNextToken();
     return ValueType::None;
+  case tok_vec:
+    return ParseVectorType();
   default:
     LogError("Expected a type");
     return ValueType::Error;
   }
 }
 
+static unique_ptr<ExprAST> ParseVectorCastExpr(ValueType Type);
+
 /// castexpr
-///   = casttype "(" expression ")" ;
+///   = casttype "(" expression ")"
+///   | vectype "(" expression { "," expression } ")" ;
 static unique_ptr<ExprAST> ParseCastExpr() {
   ValueType Type = ParseTypeToken();
   if (Type == ValueType::Error)
@@ -1424,6 +2224,8 @@ static unique_ptr<ExprAST> ParseCastExpr() {
   if (CurTok != '(')
     return LogError("Expected '(' after cast type");
   getNextToken(); // eat '('
+  if (IsVectorType(Type))
+    return ParseVectorCastExpr(Type);
   auto Expr = ParseExpression();
   if (!Expr)
     return nullptr;
@@ -1433,6 +2235,56 @@ static unique_ptr<ExprAST> ParseCastExpr() {
   return make_unique<CastExprAST>(Type, std::move(Expr));
 }
 
+/// ParseVectorCastExpr - The argument list of vec[T, N](...), after the '('.
+/// One scalar argument is splatted into every lane, one vec[U, N] argument
+/// is converted lane by lane, and N arguments give the lanes in order.
+static unique_ptr<ExprAST> ParseVectorCastExpr(ValueType Type) {
+  ValueType Elem = ElementType(Type);
+  unsigned NumLanes = VectorLanes(Type);
+  vector<unique_ptr<ExprAST>> Args;
+  while (true) {
+    ExpectedLiteralTypeGuard Guard(Elem);
+    auto Arg = ParseExpression();
+    if (!Arg)
+      return nullptr;
+    Args.push_back(std::move(Arg));
+    if (CurTok == ')')
+      break;
+    if (CurTok != ',')
+      return LogError("Expected ')' or ',' in vector constructor");
+    getNextToken(); // eat ','
+  }
+  getNextToken(); // eat ')'
+
+  auto CanConvert = [&](ValueType From) {
+    return IsNumericType(From) || (From == ValueType::Bool && Elem == From);
+  };
+  if (Args.size() == 1) {
+    ValueType From = Args[0]->getType();
+    if (IsVectorType(From)) {
+      if (VectorLanes(From) != NumLanes)
+        return LogError(("Cannot convert " + string(TypeName(From)) + " to " +
+                         TypeName(Type))
+                            .c_str());
+      From = ElementType(From);
+    }
+    if (!CanConvert(From))
+      return LogError(("Cannot convert " + string(TypeName(From)) +
+                       " to " + TypeName(Type))
+                          .c_str());
+    return make_unique<CastExprAST>(Type, std::move(Args[0]));
+  }
+  if (Args.size() != NumLanes)
+    return LogError(("vec constructor takes 1 or " + to_string(NumLanes) +
+                     " arguments")
+                        .c_str());
+  for (auto &Arg : Args)
+    if (!CanConvert(Arg->getType()))
+      return LogError(("vector lane expects " + string(TypeName(Elem)))
+                          .c_str());
+  return make_unique<VectorExprAST>(Type, std::move(Args));
+}
+
 /// parenexpr
 ///   = "(" expression ")" ;
 static unique_ptr<ExprAST> ParseParenExpr() {
@@ -1447,18 +2299,133 @@ static unique_ptr<ExprAST> ParseParenExpr() {
   return V;
 }
 
+/// LookupVectorBuiltin - The vector builtin called Name, if any. A function
+/// the program defines with the same name takes precedence.
+static std::optional<VectorBuiltin> LookupVectorBuiltin(StringRef Name) {
+  return StringSwitch<std::optional<VectorBuiltin>>(Name)
+      .Case("extract_lane", VectorBuiltin::ExtractLane)
+      .Case("insert_lane", VectorBuiltin::InsertLane)
+      .Case("select", VectorBuiltin::Select)
+      .Case("reduce_add", VectorBuiltin::ReduceAdd)
+      .Case("reduce_mul", VectorBuiltin::ReduceMul)
+      .Case("reduce_min", VectorBuiltin::ReduceMin)
+      .Case("reduce_max", VectorBuiltin::ReduceMax)
+      .Case("any", VectorBuiltin::Any)
+      .Case("all", VectorBuiltin::All)
+      .Default(std::nullopt);
+}
+
+/// ParseVectorBuiltin - The argument list of a vector builtin call, after
+/// the '('. Lane indices must be integer literals below the vector length.
+///
+///   extract_lane(v, i)      lane i of v
+///   insert_lane(v, i, x)    v with lane i replaced by x
+///   select(mask, a, b)      a where mask is True, else b, lane by lane
+///   reduce_add(v), reduce_mul(v), reduce_min(v), reduce_max(v)
+///   any(mask), all(mask)
+static unique_ptr<ExprAST> ParseVectorBuiltin(const string &Name,
+                                              VectorBuiltin Kind) {
+  bool TakesLane =
+      Kind == VectorBuiltin::ExtractLane || Kind == VectorBuiltin::InsertLane;
+  size_t NumArgs = Kind == VectorBuiltin::ExtractLane  ? 2
+                   : Kind == VectorBuiltin::InsertLane ? 3
+                   : Kind == VectorBuiltin::Select     ? 3
+                                                       : 1;
+  string Prefix = Name + ": ";
+
+  vector<unique_ptr<ExprAST>> Args;
+  unsigned Lane = 0;
+  ValueType Elem = ValueType::Error;
+  for (size_t I = 0; I < NumArgs; ++I) {
+    if (I > 0) {
+      if (CurTok != ',')
+        return LogError((Prefix + "expected " + to_string(NumArgs) +
+                         " arguments")
+                            .c_str());
+      getNextToken(); // eat ','
+    }
+    if (TakesLane && I == 1) {
+      unsigned NumLanes = VectorLanes(Args[0]->getType());
+      if (CurTok != tok_number || NumIsFloat ||
+          StringRef(NumLiteralStr).getAsInteger(10, Lane) || Lane >= NumLanes)
+        return LogError((Prefix + "lane must be an integer literal below " +
+                         to_string(NumLanes))
+                            .c_str());
+      getNextToken(); // eat the lane
+      continue;
+    }
+    ExpectedLiteralTypeGuard Guard(Elem);
+    auto Arg = ParseExpression();
+    if (!Arg)
+      return nullptr;
+    if (I == 0) {
+      if (!IsVectorType(Arg->getType()))
+        return LogError((Prefix + "expected a vector argument").c_str());
+      Elem = ElementType(Arg->getType());
+    }
+    Args.push_back(std::move(Arg));
+  }
+  if (CurTok != ')')
+    return LogError((Prefix + "expected " + to_string(NumArgs) + " arguments")
+                        .c_str());
+  getNextToken(); // eat ')'
+
+  ValueType VecType = Args[0]->getType();
+  ValueType ResultType = Elem;
+  switch (Kind) {
+  case VectorBuiltin::ExtractLane:
+    break;
+  case VectorBuiltin::InsertLane:
+    if (!IsAssignable(Elem, Args[1]->getType()))
+      return LogError((Prefix + "lane value expects " + TypeName(Elem))
+                          .c_str());
+    ResultType = VecType;
+    break;
+  case VectorBuiltin::Select: {
+    ValueType A = Args[1]->getType(), B = Args[2]->getType();
+    if (Elem != ValueType::Bool)
+      return LogError((Prefix + "expected a vec[bool, N] mask").c_str());
+    if (A != B || !IsVectorType(A) || VectorLanes(A) != VectorLanes(VecType))
+      return LogError((Prefix + "expected two vectors of the same type with " +
+                       to_string(VectorLanes(VecType)) + " lanes")
+                          .c_str());
+    ResultType = A;
+    break;
+  }
+  case VectorBuiltin::Any:
+  case VectorBuiltin::All:
+    if (Elem != ValueType::Bool)
+      return LogError((Prefix + "expected a vec[bool, N] mask").c_str());
+    break;
+  default:
+    if (!IsNumericType(Elem))
+      return LogError((Prefix + "expected a numeric vector").c_str());
+    break;
+  }
+  return make_unique<VectorBuiltinExprAST>(Kind, Lane, std::move(Args),
+                                           ResultType);
+}
+
 /// identifierexpr
 ///   = identifier
 ///   | callexpr ;
 ///
 /// callexpr
 ///   = identifier "(" [ expression { "," expression } ] ")" ;
-static unique_ptr<ExprAST> ParseIdentifierExprWithName(string IdName) {
+static unique_ptr<ExprAST> ParseIdentifierExprWithName(string IdName,
+                                                       SymbolID IdSym) {
   if (CurTok != '(') { // Simple variable ref.
-    ValueType Type = LookupVarType(IdName);
+    ValueType Type = LookupVarType(IdSym);
     if (Type == ValueType::Error) {
       return LogError("Unknown variable name");
     }
+    if (IsParallelReduction(IdSym))
+      return LogError(("Cannot read reduction variable '" + IdName +
+                       "' in its @parallel loop; only update it as '" +
+                       IdName + " = " + IdName + " + expr'")
+                          .c_str());
+    if (CurPureFunction && IsGlobalVar(IdSym))
+      CurPureFunction->setReadsGlobals();
     return make_unique<VariableExprAST>(IdName, Type);
   }
 
@@ -1469,6 +2436,9 @@ static unique_ptr<ExprAST> ParseIdentifierExprWithName(string IdName) {
   // the token stream aligned; the “unknown function” error is raised later
   // during semantic/codegen.
   PrototypeAST *Proto = GetFunctionProto(IdName);
+  if (!Proto)
+    if (auto Builtin = LookupVectorBuiltin(IdName))
+      return ParseVectorBuiltin(IdName, *Builtin);
   vector<unique_ptr<ExprAST>> Args;
   if (CurTok != ')') {
     size_t ArgIndex = 0;
@@ -1501,6 +2471,8 @@ static unique_ptr<ExprAST> ParseIdentifierExprWithName(string IdName) {
     return LogError("Unknown function referenced");
   if (Proto->getNumArgs() != Args.size())
     return LogError("Incorrect # arguments passed");
+  if (!CheckPureCall(*Proto))
+    return nullptr;
 
   for (size_t i = 0; i < Args.size(); ++i) {
     ValueType ArgType = Args[i]->getType();
@@ -1517,19 +2489,25 @@ static unique_ptr<ExprAST> ParseIdentifierExprWithName(string IdName) {
 }
 
 static unique_ptr<ExprAST> ParseIdentifierExpr() {
-  string IdName = IdentifierStr;
+  string IdName = IdentifierStr.str();
+  SymbolID IdSym = IdentifierSym;
 
   getNextToken(); // eat identifier.
 
-  return ParseIdentifierExprWithName(std::move(IdName));
+  return ParseIdentifierExprWithName(std::move(IdName), IdSym);
 }
 
 // ParseForParts - Parse the "= start, cond, step : suite" tail of a for-loop.
 // Also validates the parts against VarType (start/step assignable, cond bool).
 // Returns true on success and fills Start/Cond/Step/Body plus BodyIsBlock.
-static bool ParseForParts(ValueType VarType, unique_ptr<ExprAST> &Start,
+// For a @parallel loop (Parallel set), the condition must be "var < bound" or
+// "var <= bound"; Cond is set to the bound and the body is parsed under the
+// loop's assignment rules.
+static bool ParseForParts(SymbolID VarSym, ValueType VarType,
+                          unique_ptr<ExprAST> &Start,
                           unique_ptr<ExprAST> &Cond, unique_ptr<ExprAST> &Step,
-                          unique_ptr<ExprAST> &Body, bool &BodyIsBlock) {
+                          unique_ptr<ExprAST> &Body, bool &BodyIsBlock,
+                          ParallelLoopContext *Parallel = nullptr) {
   if (CurTok != '=')
     return LogError("Expected '=' after for variable"), false;
   getNextToken(); // eat '='
@@ -1546,11 +2524,31 @@ static bool ParseForParts(ValueType VarType, unique_ptr<ExprAST> &Start,
     return LogError("Expected ',' after for start value"), false;
   getNextToken(); // eat ','
 
-  Cond = ParseExpression();
-  if (!Cond)
-    return false;
-  if (Cond->getType() != ValueType::Bool)
-    return LogError("For loop condition must be bool"), false;
+  if (Parallel) {
+    if (CurTok != tok_identifier || IdentifierSym != VarSym)
+      return LogError("@parallel loop condition must be '<var> < bound' or "
+                      "'<var> <= bound'"),
+             false;
+    getNextToken(); // eat loop variable
+    if (CurTok != '<' && CurTok != tok_leq)
+      return LogError("@parallel loop condition must be '<var> < bound' or "
+                      "'<var> <= bound'"),
+             false;
+    Parallel->InclusiveBound = CurTok == tok_leq;
+    getNextToken(); // eat '<' or '<='
+    ExpectedLiteralTypeGuard Guard(VarType);
+    Cond = ParseExpression();
+    if (!Cond)
+      return false;
+    if (!IsAssignable(VarType, Cond->getType()))
+      return LogError("For loop bound must match loop variable type"), false;
+  } else {
+    Cond = ParseExpression();
+    if (!Cond)
+      return false;
+    if (Cond->getType() != ValueType::Bool)
+      return LogError("For loop condition must be bool"), false;
+  }
 
   if (CurTok != ',')
     return LogError("Expected ',' after for condition"), false;
@@ -1567,6 +2565,10 @@ static bool ParseForParts(ValueType VarType, unique_ptr<ExprAST> &Start,
   getNextToken(); // eat ':'
 
   // Parse the suite after ':' (inline statement or indented block).
+  LoopBodyGuard LoopBody;
+  if (Parallel)
+    Parallel->LoopDepth = LoopDepth;
+  ParallelLoopGuard ParallelGuard(Parallel ? Parallel : CurParallelLoop);
   Body = ParseSuite(&BodyIsBlock);
   if (!Body)
     return false;
@@ -1580,7 +2582,9 @@ static bool ParseForParts(ValueType VarType, unique_ptr<ExprAST> &Start,
 ///
 /// "for var" introduces a new loop variable scoped to the loop statement.
 /// A plain "for i = ..." reuses an existing variable (error if undeclared).
-static unique_ptr<ExprAST> ParseForStmt() {
+/// Parallel is set for a loop under @parallel (see ParseParallelStmt).
+static unique_ptr<ExprAST>
+ParseForStmt(ParallelLoopContext *Parallel = nullptr) {
   getNextToken(); // eat 'for'
 
   bool IsVarDecl = false;
@@ -1589,9 +2593,12 @@ static unique_ptr<ExprAST> ParseForStmt() {
     getNextToken(); // optional 'var'
   }
 
+  if (Parallel && !IsVarDecl)
+    return LogError("@parallel loop must declare its variable with 'for var'");
   if (CurTok != tok_identifier)
     return LogError("Expected identifier after 'for'");
-  string VarName = IdentifierStr;
+  string VarName = IdentifierStr.str();
+  SymbolID VarSym = IdentifierSym;
   getNextToken(); // eat identifier
 
   ValueType VarType = ValueType::Error;
@@ -1605,36 +2612,152 @@ static unique_ptr<ExprAST> ParseForStmt() {
       return nullptr;
     if (VarType == ValueType::None)
       return LogError("For loop variable cannot have None type");
-    if (IsDeclaredInCurrentScope(VarName))
+    if (Parallel && !IsIntType(VarType))
+      return LogError("@parallel loop variable must be an integer");
+    if (IsDeclaredInCurrentScope(VarSym))
       return LogError(
           ("Variable '" + VarName + "' already declared in this scope")
               .c_str());
   } else {
     if (CurTok == ':')
       return LogError("For loop variable requires 'var' to declare a type");
-    VarType = LookupVarType(VarName);
+    VarType = LookupVarType(VarSym);
     if (VarType == ValueType::Error)
       return LogError("Assignment to undeclared variable");
+    if (!CheckPureAssignment(VarName, VarSym) ||
+        !CheckParallelAssignment(VarName, VarSym))
+      return nullptr;
   }
 
   unique_ptr<ExprAST> Start, Cond, Step, Body;
   bool BodyIsBlock = false;
 
   if (IsVarDecl) {
-    LoopScopeGuard LoopScope(VarName, VarType);
-    if (!ParseForParts(VarType, Start, Cond, Step, Body, BodyIsBlock))
+    LoopScopeGuard LoopScope(VarSym, VarType);
+    if (Parallel)
+      Parallel->Depth = VarScopes.depth();
+    if (!ParseForParts(VarSym, VarType, Start, Cond, Step, Body, BodyIsBlock,
+                       Parallel))
       return nullptr;
   } else {
-    if (!ParseForParts(VarType, Start, Cond, Step, Body, BodyIsBlock))
+    if (!ParseForParts(VarSym, VarType, Start, Cond, Step, Body, BodyIsBlock))
       return nullptr;
   }
 
   LastStatementWasBlock = BodyIsBlock;
+  if (Parallel)
+    return make_unique<ParallelForExprAST>(
+        VarName, VarType, std::move(Start), std::move(Cond),
+        Parallel->InclusiveBound, std::move(Step), std::move(Body),
+        std::move(Parallel->ReductionVars));
   return make_unique<ForExprAST>(VarName, IsVarDecl, VarType, std::move(Start),
                                  std::move(Cond), std::move(Step),
                                  std::move(Body));
 }
 
+/// whilestmt
+///   = "while" expression ":" suite ;
+static unique_ptr<ExprAST> ParseWhileStmt() {
+  getNextToken(); // eat 'while'
+
+  auto Cond = ParseExpression();
+  if (!Cond)
+    return nullptr;
+  if (Cond->getType() != ValueType::Bool)
+    return LogError("While condition must be bool");
+
+  if (CurTok != ':')
+    return LogError("Expected ':' after while condition");
+  getNextToken(); // eat ':'
+
+  bool BodyIsBlock = false;
+  unique_ptr<ExprAST> Body;
+  {
+    LoopBodyGuard LoopBody;
+    Body = ParseSuite(&BodyIsBlock);
+  }
+  if (!Body)
+    return nullptr;
+
+  LastStatementWasBlock = BodyIsBlock;
+  return make_unique<WhileExprAST>(std::move(Cond), std::move(Body));
+}
+
+/// breakstmt    = "break" ;
+/// continuestmt = "continue" ;
+/// Both apply to the innermost enclosing loop. A @parallel loop's iterations
+/// run independently, so its body may continue but not break.
+static unique_ptr<ExprAST> ParseLoopExitStmt() {
+  bool IsBreak = CurTok == tok_break;
+  const char *Keyword = IsBreak ? "break" : "continue";
+  if (LoopDepth == 0)
+    return LogError(("'" + string(Keyword) + "' outside a loop").c_str());
+  if (IsBreak && CurParallelLoop && CurParallelLoop->LoopDepth == LoopDepth)
+    return LogError("Cannot break out of a @parallel loop");
+  getNextToken(); // eat 'break' or 'continue'
+  return make_unique<LoopExitAST>(IsBreak);
+}
+
+/// parallelstmt
+///   = "@" "parallel" [ "(" identifier { "," identifier } ")" ] eols forstmt ;
+///
+/// The identifiers are the loop's reductions: numeric locals declared before
+/// the loop that the body adds to, as in "sum = sum + x". Each thread sums
+/// into a private copy that starts at zero; the copies are added into the
+/// variable when the loop finishes. The body may not otherwise read a
+/// reduction (see ParseReductionUpdate).
+static unique_ptr<ExprAST> ParseParallelStmt() {
+  getNextToken(); // eat '@'
+  if (CurTok != tok_identifier || IdentifierStr != "parallel")
+    return LogError("Only '@parallel' may decorate a statement");
+  if (ParsingTopLevel)
+    return LogError("@parallel loops must be inside a function");
+  if (CurPureFunction)
+    return LogError("@pure functions cannot contain @parallel loops");
+  getNextToken(); // eat 'parallel'
+
+  ParallelLoopContext Loop;
+  Loop.Outer = CurParallelLoop;
+  if (CurTok == '(') {
+    getNextToken(); // eat '('
+    while (true) {
+      if (CurTok != tok_identifier)
+        return LogError("Expected a reduction variable in '@parallel(...)'");
+      string Name = IdentifierStr.str();
+      SymbolID Sym = IdentifierSym;
+      auto Type = VarScopes.lookup(Sym);
+      if (!Type)
+        return LogError(("Reduction variable '" + Name +
+                         "' must be a local declared before the loop")
+                            .c_str());
+      if (!IsNumericType(*Type))
+        return LogError("Reduction variable must be numeric");
+      if (is_contained(Loop.Reductions, Sym))
+        return LogError(
+            ("Duplicate reduction variable '" + Name + "'").c_str());
+      if (!CheckParallelAssignment(Name, Sym))
+        return nullptr;
+      Loop.Reductions.push_back(Sym);
+      Loop.ReductionVars.push_back({Name, *Type});
+      getNextToken(); // eat identifier
+
+      if (CurTok == ')')
+        break;
+      if (CurTok != ',')
+        return LogError("Expected ',' or ')' in '@parallel(...)'");
+      getNextToken(); // eat ','
+    }
+    getNextToken(); // eat ')'
+  }
+
+  if (CurTok != tok_eol)
+    return LogError("Expected newline after '@parallel' decorator");
+  consumeNewlines();
+  if (CurTok != tok_for)
+    return LogError("Expected 'for' after '@parallel'");
+  return ParseForStmt(&Loop);
+}
+
 /// varstmt
 ///   = "var" varbinding { "," varbinding } ;
 ///
@@ -1651,7 +2774,8 @@ static unique_ptr<ExprAST> ParseVarStmt() {
     if (CurTok != tok_identifier)
       return LogError("Expected identifier after 'var'");
 
-    string Name = IdentifierStr;
+    string Name = IdentifierStr.str();
+    SymbolID Sym = IdentifierSym;
     getNextToken(); // eat identifier
 
     if (CurTok != ':')
@@ -1665,11 +2789,11 @@ static unique_ptr<ExprAST> ParseVarStmt() {
       return LogError("Variables cannot have None type");
 
     if (IsGlobalDecl) {
-      if (GlobalVarDecls.count(Name))
+      if (GlobalVarDecls.count(Sym))
         return LogError(
             ("Variable '" + Name + "' already declared in this scope").c_str());
     } else {
-      if (IsDeclaredInCurrentScope(Name))
+      if (IsDeclaredInCurrentScope(Sym))
         return LogError(
             ("Variable '" + Name + "' already declared in this scope").c_str());
     }
@@ -1692,9 +2816,9 @@ static unique_ptr<ExprAST> ParseVarStmt() {
 
     VarNames.push_back({Name, DeclType, std::move(Init)});
     if (IsGlobalDecl)
-      GlobalVarTypes[Name] = DeclType, GlobalVarDecls.insert(Name);
+      GlobalVarTypes[Sym] = DeclType, GlobalVarDecls.insert(Sym);
     else
-      DeclareVar(Name, DeclType);
+      DeclareVar(Sym, DeclType);
 
     if (CurTok != ',')
       break;
@@ -1787,7 +2911,7 @@ static bool IsComparisonOp(int Op) {
 }
 
 static bool IsArithmeticOp(int Op) {
-  return Op == '+' || Op == '-' || Op == '*';
+  return Op == '+' || Op == '-' || Op == '*' || Op == '/';
 }
 
 // GetBinaryResultType decision table (Op, L, R -> result)
@@ -1810,10 +2934,43 @@ static bool IsArithmeticOp(int Op) {
 // allowed)
 // - otherwise                                  -> Error
 //
+// Division (/) follows the arithmetic rules but needs a float result:
+// - int / int                                  -> Error
+//
+// Vector operands (see GetVectorBinaryResultType):
+// - vec[T, N] op vec[T, N]                     -> per lane, as for T op T
+// - vec[T, N] op scalar assignable to T        -> scalar splatted to N lanes
+// - arithmetic result                          -> vec[T, N]
+// - comparison result                          -> vec[bool, N]
+//
 // User-defined binary ops:
 // - float64 op float64                         -> float64
 // - otherwise                                  -> Error
+static ValueType GetBinaryResultType(int Op, ValueType L, ValueType R);
+
+static ValueType GetVectorBinaryResultType(int Op, ValueType L, ValueType R) {
+  ValueType VecType = IsVectorType(L) ? L : R;
+  ValueType Other = IsVectorType(L) ? R : L;
+  if (IsVectorType(Other) ? Other != VecType
+                          : !IsAssignable(ElementType(VecType), Other))
+    return ValueType::Error;
+  ValueType Elem = ElementType(VecType);
+  ValueType LaneResult = GetBinaryResultType(Op, Elem, Elem);
+  if (LaneResult == ValueType::Error)
+    return ValueType::Error;
+  return VectorOf(LaneResult, VectorLanes(VecType));
+}
+
 static ValueType GetBinaryResultType(int Op, ValueType L, ValueType R) {
+  if (IsVectorType(L) || IsVectorType(R)) {
+    if (!IsComparisonOp(Op) && !IsArithmeticOp(Op))
+      return ValueType::Error;
+    return GetVectorBinaryResultType(Op, L, R);
+  }
+  if (Op == '/') {
+    ValueType Result = GetBinaryResultType('*', L, R);
+    return IsFloatType(Result) ? Result : ValueType::Error;
+  }
   if (IsArithmeticOp(Op)) {
     if (!IsNumericType(L) || !IsNumericType(R))
       return ValueType::Error;
@@ -1872,7 +3029,7 @@ static unique_ptr<ExprAST> ParseUnaryMinus() {
   auto Operand = ParseUnary();
   if (!Operand)
     return nullptr;
-  if (!IsNumericType(Operand->getType()))
+  if (!IsNumericType(ElementType(Operand->getType())))
     return LogError("Unary '-' requires a numeric operand");
   return make_unique<UnaryExprAST>('-', std::move(Operand), Operand->getType());
 }
@@ -1906,6 +3063,7 @@ static unique_ptr<ExprAST> ParsePrimary() {
   case tok_float32:
   case tok_float64:
   case tok_bool:
+  case tok_vec:
     return ParseCastExpr();
   case '(':
     return ParseParenExpr();
@@ -1948,6 +3106,8 @@ static unique_ptr<ExprAST> ParseUnary() {
       return LogError("Unknown unary operator");
     if (Proto->getNumArgs() != 1)
       return LogError("Unary operator must have exactly one argument");
+    if (!CheckPureCall(*Proto))
+      return nullptr;
     ValueType ParamType = Proto->getArgType(0);
     if (!IsAssignable(ParamType, Operand->getType())) {
       return LogError(
@@ -1979,8 +3139,16 @@ static unique_ptr<ExprAST> ParseBinOpRHS(int ExprPrec,
 
     // Parse the unary expression after the binary operator.  Using ParseUnary
     // here (rather than ParsePrimary directly) means unary operators bind
-    // tighter than any binary operator, matching normal convention.
-    auto RHS = ParseUnary();
+    // tighter than any binary operator, matching normal convention. A literal
+    // after a vector operand takes the lane type, so v * 2.0 works for any
+    // float vector.
+    unique_ptr<ExprAST> RHS;
+    {
+      ValueType LType = LHS->getType();
+      ExpectedLiteralTypeGuard Guard(IsVectorType(LType) ? ElementType(LType)
+                                                         : ExpectedLiteralType);
+      RHS = ParseUnary();
+    }
     if (!RHS)
       return nullptr;
 
@@ -2004,6 +3172,8 @@ static unique_ptr<ExprAST> ParseBinOpRHS(int ExprPrec,
         return LogError("Unknown binary operator");
       if (Proto->getNumArgs() != 2)
         return LogError("Binary operator must have exactly two arguments");
+      if (!CheckPureCall(*Proto))
+        return nullptr;
       ValueType LType = Proto->getArgType(0);
       ValueType RType = Proto->getArgType(1);
       if (!IsAssignable(LType, LHS->getType()))
@@ -2036,6 +3206,8 @@ static unique_ptr<ExprAST> ParseExpression() {
 /// returnstmt
 ///   = "return" [ expression ] ;
 static unique_ptr<ExprAST> ParseReturnStmt() {
+  if (CurParallelLoop)
+    return LogError("Cannot return from inside a @parallel loop");
   getNextToken(); // eat 'return'
   if (CurTok == tok_eol || CurTok == tok_dedent || CurTok == tok_eof) {
     if (CurrentFunctionReturnType != ValueType::None)
@@ -2058,14 +3230,52 @@ static unique_ptr<ExprAST> ParseReturnStmt() {
   return make_unique<ReturnExprAST>(std::move(Expr));
 }
 
-static unique_ptr<ExprAST> ParseAssignmentRHS(const string &Name) {
-  if (!IsDeclaredVar(Name))
+/// reductionupdate = identifier ( "+" | "-" ) unaryexpr binoprhs ;
+///
+/// The right-hand side of an assignment to reduction Name in its @parallel
+/// loop: Name, then terms added or subtracted, none of which reads Name.
+/// Only this form survives summing the threads' partial results afterwards.
+static unique_ptr<ExprAST> ParseReductionUpdate(const string &Name,
+                                                SymbolID Sym,
+                                                ValueType VarType) {
+  auto FormError = [&] {
+    return LogError(("Reduction variable '" + Name + "' must be updated as '" +
+                     Name + " = " + Name + " + expr'")
+                        .c_str());
+  };
+  if (CurTok != tok_identifier || IdentifierSym != Sym)
+    return FormError();
+  getNextToken(); // eat reduction variable
+  if (CurTok != '+' && CurTok != '-')
+    return FormError();
+
+  auto Self = make_unique<VariableExprAST>(Name, VarType);
+  const ExprAST *SelfNode = Self.get();
+  auto RHS = ParseBinOpRHS(GetTokPrecedence(), std::move(Self));
+  if (!RHS)
+    return nullptr;
+  // Every operator between the root and Name must be '+' or '-', and no
+  // lower-precedence operator may follow.
+  const ExprAST *Node = RHS.get();
+  while (Node && Node != SelfNode)
+    Node = Node->getAdditiveLHS();
+  if (!Node || GetTokPrecedence() > 0)
+    return FormError();
+  return RHS;
+}
+
+static unique_ptr<ExprAST> ParseAssignmentRHS(const string &Name,
+                                              SymbolID Sym) {
+  if (!IsDeclaredVar(Sym))
     return LogError("Assignment to undeclared variable");
-  ValueType VarType = LookupVarType(Name);
+  if (!CheckPureAssignment(Name, Sym) || !CheckParallelAssignment(Name, Sym))
+    return nullptr;
+  ValueType VarType = LookupVarType(Sym);
   getNextToken(); // eat '='
 
   ExpectedLiteralTypeGuard Guard(VarType);
-  auto RHS = ParseExpression();
+  auto RHS = IsParallelReduction(Sym) ? ParseReductionUpdate(Name, Sym, VarType)
+                                      : ParseExpression();
   if (!RHS)
     return nullptr;
   if (!IsAssignable(VarType, RHS->getType()))
@@ -2074,23 +3284,27 @@ static unique_ptr<ExprAST> ParseAssignmentRHS(const string &Name) {
 }
 
 /// simplestmt
-///   = returnstmt | varstmt | assignstmt | expression ;
+///   = returnstmt | breakstmt | continuestmt | varstmt | assignstmt
+///   | expression ;
 static unique_ptr<ExprAST> ParseSimpleStmt() {
   if (CurTok == tok_return)
     return ParseReturnStmt();
+  if (CurTok == tok_break || CurTok == tok_continue)
+    return ParseLoopExitStmt();
   if (CurTok == tok_var)
     return ParseVarStmt();
 
   unique_ptr<ExprAST> Expr;
   if (CurTok == tok_identifier) {
-    string Name = IdentifierStr;
+    string Name = IdentifierStr.str();
+    SymbolID Sym = IdentifierSym;
     getNextToken(); // eat identifier.
 
     if (CurTok == '=') {
-      return ParseAssignmentRHS(Name);
+      return ParseAssignmentRHS(Name, Sym);
     }
 
-    Expr = ParseIdentifierExprWithName(std::move(Name));
+    Expr = ParseIdentifierExprWithName(std::move(Name), Sym);
     if (!Expr)
       return nullptr;
     Expr = ParseBinOpRHS(0, std::move(Expr));
@@ -2104,7 +3318,7 @@ static unique_ptr<ExprAST> ParseSimpleStmt() {
     if (!AssignedName)
       return LogError("Destination of '=' must be a variable");
 
-    return ParseAssignmentRHS(*AssignedName);
+    return ParseAssignmentRHS(*AssignedName, InternName(*AssignedName));
   }
 
   Expr = ParseExpression();
@@ -2125,6 +3339,10 @@ static unique_ptr<ExprAST> ParseStatement() {
     return ParseIfStmt();
   if (CurTok == tok_for)
     return ParseForStmt();
+  if (CurTok == tok_while)
+    return ParseWhileStmt();
+  if (CurTok == '@')
+    return ParseParallelStmt();
   return ParseSimpleStmt();
 }
 
@@ -2208,7 +3426,7 @@ static unique_ptr<PrototypeAST> ParsePrototype() {
 
   if (CurTok != tok_identifier)
     return LogErrorP("Expected function name in prototype");
-  string FnName = IdentifierStr;
+  string FnName = IdentifierStr.str();
   getNextToken(); // eat function name
 
   if (CurTok != '(')
@@ -2221,7 +3439,7 @@ static unique_ptr<PrototypeAST> ParsePrototype() {
     while (true) {
       if (CurTok != tok_identifier)
         return LogErrorP("Expected parameter name in prototype");
-      string ArgName = IdentifierStr;
+      string ArgName = IdentifierStr.str();
       getNextToken(); // eat identifier
 
       if (CurTok != ':')
@@ -2275,11 +3493,15 @@ static unique_ptr<ExprAST> ParseFunctionBody(bool *BodyIsBlock) {
 
 /// definition
 ///   = "def" prototype [ "->" type ] ":" ( simplestmt | eols block ) ;
-static unique_ptr<FunctionAST> ParseDefinition() {
+///
+/// Decorators holds the FunctionDecorator bits of any '@name' lines already
+/// parsed by ParseDecoratedDef.
+static unique_ptr<FunctionAST> ParseDefinition(unsigned Decorators = FD_None) {
   getNextToken(); // eat 'def'
   auto Proto = ParsePrototype();
   if (!Proto)
     return nullptr;
+  Proto->addDecorators(Decorators);
   ValueType RetType = ParseOptionalReturnType(ValueType::None);
   if (RetType == ValueType::Error)
     return nullptr;
@@ -2287,6 +3509,7 @@ static unique_ptr<FunctionAST> ParseDefinition() {
   FunctionProtos[Proto->getName()] = Proto->clone();
   ReturnTypeGuard RetGuard(RetType);
   FunctionScopeGuard Scope(Proto->getArgs());
+  PureFunctionGuard PureGuard(*Proto);
 
   if (CurTok != ':')
     return LogErrorF("Expected ':' in function definition");
@@ -2361,6 +3584,30 @@ static void ParseUnaryDecorator() {
   getNextToken(); // eat 'unary'
 }
 
+/// funcdecorator
+///   = "@" ( "fastmath" | "inline" | "noinline" | "pure" | "cold" )
+/// Called after '@' has been consumed. CurTok is on the decorator name, which
+/// the lexer returns as an identifier. Returns its FunctionDecorator bit, or
+/// FD_None if the name is not a known decorator.
+static FunctionDecorator ParseFunctionDecorator() {
+  FunctionDecorator D = StringSwitch<FunctionDecorator>(IdentifierStr)
+                            .Case("fastmath", FD_FastMath)
+                            .Case("inline", FD_Inline)
+                            .Case("noinline", FD_NoInline)
+                            .Case("pure", FD_Pure)
+                            .Case("cold", FD_Cold)
+                            .Default(FD_None);
+  if (D == FD_None) {
+    if (IdentifierStr == "parallel")
+      LogError("@parallel applies to for loops inside a function");
+    else
+      LogError(("Unknown decorator '@" + IdentifierStr.str() + "'").c_str());
+    return FD_None;
+  }
+  getNextToken(); // eat decorator name
+  return D;
+}
+
 // IsCustomOpChar - Return true if Tok can be used as a user-defined operator
 // character in Pyxc operator prototypes.
 //
@@ -2442,7 +3689,7 @@ static unique_ptr<PrototypeAST> ParseBinaryOpPrototype(unsigned Precedence) {
     while (true) {
       if (CurTok != tok_identifier)
         return LogErrorP("Expected parameter name in operator prototype");
-      string ArgName = IdentifierStr;
+      string ArgName = IdentifierStr.str();
       getNextToken(); // eat identifier
       if (CurTok != ':')
         return LogErrorP("Operator parameters require a type annotation (e.g., "
@@ -2519,7 +3766,7 @@ static unique_ptr<PrototypeAST> ParseUnaryOpPrototype() {
     while (true) {
       if (CurTok != tok_identifier)
         return LogErrorP("Expected parameter name in operator prototype");
-      string ArgName = IdentifierStr;
+      string ArgName = IdentifierStr.str();
       getNextToken(); // eat identifier
       if (CurTok != ':')
         return LogErrorP("Operator parameters require a type annotation (e.g., "
@@ -2555,13 +3802,34 @@ static unique_ptr<PrototypeAST> ParseUnaryOpPrototype() {
 }
 
 /// decorateddef
-///   = binarydecorator eols "def" binaryopprototype ":" ( simplestmt | eols
-///   block ) | unarydecorator  eols "def" unaryopprototype  ":" ( simplestmt |
-///   eols block )
+///   = { funcdecorator eols } binarydecorator eols "def" binaryopprototype ":"
+///   ( simplestmt | eols block ) | { funcdecorator eols } unarydecorator eols
+///   "def" unaryopprototype ":" ( simplestmt | eols block ) | funcdecorator
+///   eols { funcdecorator eols } definition
 ///
-/// Called after '@' has been consumed. CurTok is on 'binary' or 'unary'.
-/// The two branches share the same body structure (':' / block).
+/// Called after '@' has been consumed. CurTok is on 'binary', 'unary', or a
+/// function decorator name. Function decorators may be stacked, one per
+/// line, and apply to the operator or plain function they precede. The two
+/// operator branches share the same body structure (':' / block).
 static unique_ptr<FunctionAST> ParseDecoratedDef() {
+  unsigned Decorators = FD_None;
+  while (CurTok == tok_identifier) {
+    FunctionDecorator D = ParseFunctionDecorator();
+    if (D == FD_None)
+      return nullptr;
+    Decorators |= D;
+    if ((Decorators & FD_Inline) && (Decorators & FD_NoInline))
+      return LogErrorF("@inline and @noinline cannot be combined");
+    if (CurTok != tok_eol)
+      return LogErrorF("Expected newline after decorator");
+    consumeNewlines();
+    if (CurTok == tok_def)
+      return ParseDefinition(Decorators);
+    if (CurTok != '@')
+      return LogErrorF("Expected 'def' after decorator");
+    getNextToken(); // eat '@'
+  }
+
   if (CurTok != tok_binary && CurTok != tok_unary)
     return LogErrorF("Expected 'binary' or 'unary' after '@'");
 
@@ -2593,6 +3861,7 @@ static unique_ptr<FunctionAST> ParseDecoratedDef() {
 
   if (!Proto)
     return nullptr;
+  Proto->addDecorators(Decorators);
   ValueType RetType = ParseOptionalReturnType();
   if (RetType == ValueType::Error)
     return nullptr;
@@ -2600,6 +3869,7 @@ static unique_ptr<FunctionAST> ParseDecoratedDef() {
   FunctionProtos[Proto->getName()] = Proto->clone();
   ReturnTypeGuard RetGuard(RetType);
   FunctionScopeGuard Scope(Proto->getArgs());
+  PureFunctionGuard PureGuard(*Proto);
 
   // Shared body: ":" ( simplestmt | eols block ) — identical to
   // ParseDefinition.
@@ -2644,6 +3914,9 @@ static unique_ptr<FunctionAST> ParseTopLevelExpr() {
     return nullptr;
 
   ValueType RetType = Stmt->getType();
+  // The REPL prints scalars only; a vector expression is just evaluated.
+  if (IsVectorType(RetType))
+    RetType = ValueType::None;
   if (!Stmt->isReturnExpr() && RetType != ValueType::None)
     Stmt = make_unique<ReturnExprAST>(std::move(Stmt));
 
@@ -2679,65 +3952,79 @@ static unique_ptr<PrototypeAST> ParseExtern() {
 // (See InitializeModuleAndManagers.)
 //
 // TheContext - Owns LLVM types/constants and uniquing tables.
-static std::unique_ptr<LLVMContext> TheContext;
+static thread_local std::unique_ptr<LLVMContext> TheContext;
 // TheModule - Current compilation unit handed to the JIT/emit path.
-static std::unique_ptr<Module> TheModule;
+static thread_local std::unique_ptr<Module> TheModule;
 // Builder - Cursor used to append instructions into the current block.
-static std::unique_ptr<IRBuilder<NoFolder>> Builder;
+static thread_local std::unique_ptr<IRBuilder<NoFolder>> Builder;
 // NamedValues - Maps variable names to allocas in the current function.
-static std::map<std::string, AllocaInst *> NamedValues;
+static thread_local StringMap<AllocaInst *> NamedValues;
 // InGlobalInit - True while emitting the synthetic global init function.
-static bool InGlobalInit = false;
+static thread_local bool InGlobalInit = false;
 // ModuleHasGlobals - Tracks whether this module defines any globals.
-static bool ModuleHasGlobals = false;
-// CurrentSourcePath - Path used in debug info and diagnostics.
-static std::string CurrentSourcePath = "<stdin>";
+static thread_local bool ModuleHasGlobals = false;
 // DIB - DIBuilder used to emit DWARF metadata into the module.
-static std::unique_ptr<DIBuilder> DIB;
+static thread_local std::unique_ptr<DIBuilder> DIB;
 // TheCU - Compile unit metadata node (one per module).
-static DICompileUnit *TheCU = nullptr;
+static thread_local DICompileUnit *TheCU = nullptr;
 // TheDIFile - Current source file metadata node.
-static DIFile *TheDIFile = nullptr;
+static thread_local DIFile *TheDIFile = nullptr;
+// SplitDwarfFile - The .dwo written for the current input under
+// -gsplit-dwarf (see SplitDwarfPath), or empty.
+static thread_local std::string SplitDwarfFile;
 // IntDIType - Debug info type for platform int.
-static DIType *IntDIType = nullptr;
+static thread_local DIType *IntDIType = nullptr;
 // Float64DIType - Debug info type for float64.
-static DIType *Float64DIType = nullptr;
+static thread_local DIType *Float64DIType = nullptr;
 // VoidDIType - Debug info type for None/void.
-static DIType *VoidDIType = nullptr;
+static thread_local DIType *VoidDIType = nullptr;
 // Int8DIType - Debug info type for int8.
-static DIType *Int8DIType = nullptr;
+static thread_local DIType *Int8DIType = nullptr;
 // Int16DIType - Debug info type for int16.
-static DIType *Int16DIType = nullptr;
+static thread_local DIType *Int16DIType = nullptr;
 // Int32DIType - Debug info type for int32.
-static DIType *Int32DIType = nullptr;
+static thread_local DIType *Int32DIType = nullptr;
 // Int64DIType - Debug info type for int64.
-static DIType *Int64DIType = nullptr;
+static thread_local DIType *Int64DIType = nullptr;
 // Float32DIType - Debug info type for float32.
-static DIType *Float32DIType = nullptr;
+static thread_local DIType *Float32DIType = nullptr;
 // BoolDIType - Debug info type for bool.
-static DIType *BoolDIType = nullptr;
+static thread_local DIType *BoolDIType = nullptr;
 // CurDIScope - Current debug scope (function or block).
-static DIScope *CurDIScope = nullptr;
+static thread_local DIScope *CurDIScope = nullptr;
 // CurFunctionLine - Line number for current function definition.
-static unsigned CurFunctionLine = 1;
+static thread_local unsigned CurFunctionLine = 1;
 // TheJIT - ORC JIT instance for REPL execution.
 static std::unique_ptr<PyxcJIT> TheJIT;
+// NumJITModules - Modules created so far while the JIT object cache is on.
+static unsigned NumJITModules = 0;
 // TheFPM - Per-function optimization pipeline (JIT).
-static std::unique_ptr<FunctionPassManager> TheFPM;
+static thread_local std::unique_ptr<FunctionPassManager> TheFPM;
 // TheMPM - Per-module optimization pipeline (emit mode).
-static std::unique_ptr<ModulePassManager> TheMPM;
+static thread_local std::unique_ptr<ModulePassManager> TheMPM;
 // TheLAM - Loop analysis manager (new PM).
-static std::unique_ptr<LoopAnalysisManager> TheLAM;
+static thread_local std::unique_ptr<LoopAnalysisManager> TheLAM;
 // TheFAM - Function analysis manager (new PM).
-static std::unique_ptr<FunctionAnalysisManager> TheFAM;
+static thread_local std::unique_ptr<FunctionAnalysisManager> TheFAM;
 // TheCGAM - CGSCC analysis manager (new PM).
-static std::unique_ptr<CGSCCAnalysisManager> TheCGAM;
+static thread_local std::unique_ptr<CGSCCAnalysisManager> TheCGAM;
 // TheMAM - Module analysis manager (new PM).
-static std::unique_ptr<ModuleAnalysisManager> TheMAM;
+static thread_local std::unique_ptr<ModuleAnalysisManager> TheMAM;
+// ThePIC - Pass instrumentation hooks (only set with --time-report).
+static thread_local std::unique_ptr<PassInstrumentationCallbacks> ThePIC;
 // ExitOnErr - Crash-on-error wrapper for LLVM Error results.
 static ExitOnError ExitOnErr;
 
 static const char *TypeName(ValueType Type) {
+  if (IsVectorType(Type)) {
+    // Spelled on first use and kept, so the returned pointer stays valid.
+    static thread_local map<ValueType, string> VectorNames;
+    string &Name = VectorNames[Type];
+    if (Name.empty())
+      Name = "vec[" + string(TypeName(ElementType(Type))) + ", " +
+             to_string(VectorLanes(Type)) + "]";
+    return Name.c_str();
+  }
   switch (Type) {
   case ValueType::None:
     return "None";
@@ -2760,6 +4047,7 @@ static const char *TypeName(ValueType Type) {
   case ValueType::Bool:
     return "bool";
   default:
+    assert(!IsVectorType(Type) && "vector types are spelled above");
     return "<error>";
   }
 }
@@ -2780,6 +4068,12 @@ static bool IsNumericType(ValueType Type) {
 }
 
 static Type *LLVMTypeFor(ValueType Type) {
+  if (IsVectorType(Type)) {
+    assert(ElementType(Type) != ValueType::None &&
+           ElementType(Type) < ValueType::Error && "vector of a non-value");
+    return FixedVectorType::get(LLVMTypeFor(ElementType(Type)),
+                                VectorLanes(Type));
+  }
   switch (Type) {
   case ValueType::Int: {
     unsigned bits = TheModule->getDataLayout().getPointerSizeInBits();
@@ -2804,11 +4098,21 @@ static Type *LLVMTypeFor(ValueType Type) {
   case ValueType::None:
     return Type::getVoidTy(*TheContext);
   default:
+    assert(!IsVectorType(Type) && "vector types are lowered above");
     return nullptr;
   }
 }
 
 static DIType *DITypeFor(ValueType Type) {
+  if (IsVectorType(Type)) {
+    const DataLayout &DL = TheModule->getDataLayout();
+    llvm::Type *Ty = LLVMTypeFor(Type);
+    Metadata *Range[] = {DIB->getOrCreateSubrange(0, VectorLanes(Type))};
+    return DIB->createVectorType(DL.getTypeAllocSizeInBits(Ty),
+                                 DL.getABITypeAlign(Ty).value() * 8,
+                                 DITypeFor(ElementType(Type)),
+                                 DIB->getOrCreateArray(Range));
+  }
   switch (Type) {
   case ValueType::Int:
     return IntDIType;
@@ -2831,6 +4135,7 @@ static DIType *DITypeFor(ValueType Type) {
   case ValueType::Bool:
     return BoolDIType;
   default:
+    assert(!IsVectorType(Type) && "vector types are described above");
     return nullptr;
   }
 }
@@ -2872,6 +4177,8 @@ static AllocaInst *CreateEntryBlockAlloca(Function *TheFunction,
 }
 
 static Constant *ZeroConstant(ValueType Type) {
+  if (IsVectorType(Type))
+    return Constant::getNullValue(LLVMTypeFor(Type));
   switch (Type) {
   case ValueType::Int8:
     return ConstantInt::get(Type::getInt8Ty(*TheContext), 0);
@@ -2892,6 +4199,7 @@ static Constant *ZeroConstant(ValueType Type) {
   case ValueType::Bool:
     return ConstantInt::get(Type::getInt1Ty(*TheContext), 0);
   default:
+    assert(!IsVectorType(Type) && "vector zeros are built above");
     return nullptr;
   }
 }
@@ -2901,32 +4209,52 @@ static Value *EmitCast(Value *V, ValueType From, ValueType To) {
     return nullptr;
   if (From == To)
     return V;
+  // A scalar cast to a vector type is converted once and splatted.
+  if (IsVectorType(To) && !IsVectorType(From)) {
+    Value *Lane = EmitCast(V, From, ElementType(To));
+    if (!Lane)
+      return nullptr;
+    return Builder->CreateVectorSplat(VectorLanes(To), Lane, "splat");
+  }
+  if (VectorLanes(From) != VectorLanes(To))
+    return nullptr;
+  // From here on the same instructions convert a scalar or, lane by lane, a
+  // vector; only the element types decide which one to use.
+  llvm::Type *DestTy = LLVMTypeFor(To);
+  ValueType FromElem = ElementType(From);
+  ValueType ToElem = ElementType(To);
+  if (FromElem == ToElem)
+    return V;
   // Integer ↔ float conversions.
-  if (IsIntType(From) && IsFloatType(To))
-    return Builder->CreateSIToFP(V, LLVMTypeFor(To), "sitofp");
-  if (IsFloatType(From) && IsIntType(To))
-    return Builder->CreateFPToSI(V, LLVMTypeFor(To), "fptosi");
+  if (IsIntType(FromElem) && IsFloatType(ToElem))
+    return Builder->CreateSIToFP(V, DestTy, "sitofp");
+  if (IsFloatType(FromElem) && IsIntType(ToElem))
+    return Builder->CreateFPToSI(V, DestTy, "fptosi");
   // Integer resize (trunc or sign-extend).
-  if (IsIntType(From) && IsIntType(To)) {
-    unsigned FromBits = LLVMTypeFor(From)->getIntegerBitWidth();
-    unsigned ToBits = LLVMTypeFor(To)->getIntegerBitWidth();
+  if (IsIntType(FromElem) && IsIntType(ToElem)) {
+    unsigned FromBits = V->getType()->getScalarSizeInBits();
+    unsigned ToBits = DestTy->getScalarSizeInBits();
+    if (ToBits == FromBits)
+      return V;
     if (ToBits < FromBits)
-      return Builder->CreateTrunc(V, LLVMTypeFor(To), "trunc");
-    return Builder->CreateSExt(V, LLVMTypeFor(To), "sext");
+      return Builder->CreateTrunc(V, DestTy, "trunc");
+    return Builder->CreateSExt(V, DestTy, "sext");
   }
   // Float resize.
-  if (IsFloatType(From) && IsFloatType(To)) {
-    if (From == ValueType::Float32 && To == ValueType::Float64)
-      return Builder->CreateFPExt(V, LLVMTypeFor(To), "fpext");
-    return Builder->CreateFPTrunc(V, LLVMTypeFor(To), "fptrunc");
+  if (IsFloatType(FromElem) && IsFloatType(ToElem)) {
+    if (FromElem == ValueType::Float32 && ToElem != ValueType::Float32)
+      return Builder->CreateFPExt(V, DestTy, "fpext");
+    if (FromElem != ValueType::Float32 && ToElem == ValueType::Float32)
+      return Builder->CreateFPTrunc(V, DestTy, "fptrunc");
+    return V; // float and float64 are both double
   }
   // Cast to bool: any nonzero value is true.
-  if (To == ValueType::Bool) {
-    if (IsIntType(From) || From == ValueType::Bool)
-      return Builder->CreateICmpNE(V, ConstantInt::get(LLVMTypeFor(From), 0),
+  if (ToElem == ValueType::Bool) {
+    if (IsIntType(FromElem))
+      return Builder->CreateICmpNE(V, ConstantInt::get(V->getType(), 0),
                                    "tobool");
-    if (IsFloatType(From))
-      return Builder->CreateFCmpONE(V, ConstantFP::get(LLVMTypeFor(From), 0.0),
+    if (IsFloatType(FromElem))
+      return Builder->CreateFCmpONE(V, ConstantFP::get(V->getType(), 0.0),
                                     "tobool");
   }
   return nullptr;
@@ -2935,6 +4263,13 @@ static Value *EmitCast(Value *V, ValueType From, ValueType To) {
 static Value *EmitImplicitCast(Value *V, ValueType From, ValueType To) {
   if (From == To)
     return V;
+  // A scalar operand of a vector operator is splatted to every lane.
+  if (IsVectorType(To) && !IsVectorType(From)) {
+    Value *Lane = EmitImplicitCast(V, From, ElementType(To));
+    if (!Lane)
+      return nullptr;
+    return Builder->CreateVectorSplat(VectorLanes(To), Lane, "splat");
+  }
   if (IsFloatType(From) && IsFloatType(To)) {
     unsigned FromBits = LLVMTypeFor(From)->getScalarSizeInBits();
     unsigned ToBits = LLVMTypeFor(To)->getScalarSizeInBits();
@@ -2951,7 +4286,7 @@ static Value *EmitImplicitCast(Value *V, ValueType From, ValueType To) {
       return V;
     return Builder->CreateSExt(V, LLVMTypeFor(To), "sext");
   }
-  if (IsIntType(From) && To == ValueType::Float64)
+  if (IsIntType(From) && IsFloatType(To))
     return Builder->CreateSIToFP(V, LLVMTypeFor(To), "sitofp");
   return nullptr;
 }
@@ -2977,6 +4312,94 @@ static OptimizationLevel GetOptLevel() {
   }
 }
 
+/// GetCodeGenOptLevel - Backend (instruction selection, scheduling, register
+/// allocation) optimisation level matching -O.
+static CodeGenOptLevel GetCodeGenOptLevel() {
+  switch (OptLevel) {
+  case 0:
+    return CodeGenOptLevel::None;
+  case 1:
+    return CodeGenOptLevel::Less;
+  case 2:
+    return CodeGenOptLevel::Default;
+  default:
+    return CodeGenOptLevel::Aggressive;
+  }
+}
+
+/// IsNativeCPU - True if code should be tuned for the machine pyxc runs on.
+static bool IsNativeCPU() {
+  return codegen::getMCPU() == "native" || codegen::getMArch() == "native";
+}
+
+/// GetTargetCPU - CPU name for the backend: --mcpu, with "native" (from
+/// --mcpu or -march) resolved to the host CPU. -march is LLVM's target
+/// architecture flag, so "native" is the only value accepted for it (see
+/// ProcessCommandLine). Defaults to "generic".
+static string GetTargetCPU() {
+  if (IsNativeCPU())
+    return sys::getHostCPUName().str();
+  if (!codegen::getMCPU().empty())
+    return codegen::getMCPU();
+  return "generic";
+}
+
+/// GetTargetFeatures - Subtarget features for the backend: the host's
+/// features for a native CPU, then each --mattr entry on top.
+static SubtargetFeatures GetTargetFeatures() {
+  SubtargetFeatures Features;
+  if (IsNativeCPU())
+    for (const auto &Feature : sys::getHostCPUFeatures())
+      Features.AddFeature(Feature.getKey(), Feature.getValue());
+  for (const auto &Attr : codegen::getMAttrs())
+    Features.AddFeature(Attr);
+  return Features;
+}
+
+/// AddTargetAttributes - Record the chosen CPU and features on F, as clang
+/// does. With --lto the code is generated inside lld, which knows nothing of
+/// -march=native and reads them from here. Every function pyxc defines gets
+/// them, since the inliner will not inline a callee whose features its
+/// caller lacks; declarations do not need them.
+///
+/// The host queries behind -march=native can be slow (on AArch64 Linux they
+/// read /proc/cpuinfo), so each thread builds the strings once.
+static void AddTargetAttributes(Function *F) {
+  static thread_local const string CPU = GetTargetCPU();
+  static thread_local const string Features = GetTargetFeatures().getString();
+  if (CPU != "generic")
+    F->addFnAttr("target-cpu", CPU);
+  if (!Features.empty())
+    F->addFnAttr("target-features", Features);
+}
+
+/// GetFPOpFusionMode - Backend FMA fusion rule for -ffp-contract: Strict
+/// never fuses, Standard fuses only llvm.fmuladd (emitted for "on"), and Fast
+/// fuses any multiply feeding an add.
+static FPOpFusion::FPOpFusionMode GetFPOpFusionMode() {
+  switch (FPContract) {
+  case FPContractKind::Off:
+    return FPOpFusion::Strict;
+  case FPContractKind::On:
+    return FPOpFusion::Standard;
+  case FPContractKind::Fast:
+    return FPOpFusion::Fast;
+  }
+  llvm_unreachable("unknown -ffp-contract mode");
+}
+
+/// GetFunctionFastMathFlags - Fast-math flags for the FP instructions of a
+/// function: all of them under -ffast-math or @fastmath, otherwise only
+/// 'contract' for -ffp-contract=fast.
+static FastMathFlags GetFunctionFastMathFlags(const PrototypeAST &P) {
+  FastMathFlags FMF;
+  if (FastMath || P.hasDecorator(FD_FastMath))
+    FMF.setFast();
+  else if (FPContract == FPContractKind::Fast)
+    FMF.setAllowContract();
+  return FMF;
+}
+
 static void InitializeDebugInfo() {
   if (!DebugInfo) {
     DIB.reset();
@@ -3004,8 +4427,12 @@ static void InitializeDebugInfo() {
 
   TheDIFile = DIB->createFile(FileName, Dir);
   bool IsOptimized = OptLevel != 0;
-  TheCU = DIB->createCompileUnit(dwarf::DW_LANG_C, TheDIFile, "pyxc",
-                                 IsOptimized, "", 0);
+  // Split units keep the DWO name in the skeleton linked into the binary.
+  TheCU = DIB->createCompileUnit(
+      dwarf::DW_LANG_C, TheDIFile, "pyxc", IsOptimized, "", 0, SplitDwarfFile,
+      LineTablesOnly ? DICompileUnit::LineTablesOnly
+                     : DICompileUnit::FullDebug,
+      /*DWOId=*/0, /*SplitDebugInlining=*/false);
   unsigned bits = TheModule->getDataLayout().getPointerSizeInBits();
   IntDIType = DIB->createBasicType("int", bits, dwarf::DW_ATE_signed);
   Float64DIType = DIB->createBasicType("float64", 64, dwarf::DW_ATE_float);
@@ -3038,7 +4465,7 @@ static void SetCurrentDebugLocation(unsigned Line) {
 static void EmitDebugDeclare(AllocaInst *Alloca, StringRef Name, unsigned Line,
                              bool IsParam, unsigned ArgNo = 0,
                              ValueType Type = ValueType::Float64) {
-  if (!DIB || !CurDIScope || !Alloca)
+  if (!DIB || !CurDIScope || !Alloca || LineTablesOnly)
     return;
 
   DIType *DIType = DITypeFor(Type);
@@ -3062,7 +4489,7 @@ static void EmitDebugDeclare(AllocaInst *Alloca, StringRef Name, unsigned Line,
 
 static void EmitDebugGlobal(GlobalVariable *GV, StringRef Name, unsigned Line,
                             ValueType Type) {
-  if (!DIB || !TheCU || !GV)
+  if (!DIB || !TheCU || !GV || LineTablesOnly)
     return;
   DIType *DIType = DITypeFor(Type);
   if (!DIType)
@@ -3083,9 +4510,10 @@ static GlobalVariable *GetGlobalVariable(const string &Name) {
   if (auto *GV = TheModule->getNamedGlobal(Name))
     return GV;
 
-  if (!GlobalVarTypes.count(Name))
+  auto It = GlobalVarTypes.find(InternName(Name));
+  if (It == GlobalVarTypes.end())
     return nullptr;
-  auto *Type = LLVMTypeFor(GlobalVarTypes[Name]);
+  auto *Type = LLVMTypeFor(It->second);
   return new GlobalVariable(*TheModule, Type, false,
                             GlobalValue::ExternalLinkage, nullptr, Name);
 }
@@ -3214,6 +4642,45 @@ Value *BlockExprAST::codegen() {
   return ConstantFP::get(*TheContext, APFloat(0.0));
 }
 
+/// EmitFPContractedAdd - For -ffp-contract=on, fuse a multiply feeding this
+/// add or subtract into llvm.fmuladd, which the backend turns into an FMA
+/// where the target has one.
+///
+/// Only a multiply emitted for one of the operands of this expression, and
+/// not used by anything else, is fused: contraction stays within a single
+/// expression, as in C. Returns null if neither operand is such a multiply.
+static Value *EmitFPContractedAdd(Value *L, Value *R, bool IsSub) {
+  auto FusableMul = [](Value *V) -> Instruction * {
+    auto *Mul = dyn_cast<BinaryOperator>(V);
+    if (Mul && Mul->getOpcode() == Instruction::FMul && Mul->use_empty())
+      return Mul;
+    return nullptr;
+  };
+
+  Instruction *Mul = FusableMul(L);
+  Value *A, *B, *C;
+  if (Mul) {
+    // a*b + c, a*b - c
+    A = Mul->getOperand(0);
+    B = Mul->getOperand(1);
+    C = IsSub ? Builder->CreateFNeg(R, "negtmp") : R;
+  } else if ((Mul = FusableMul(R))) {
+    // c + a*b, c - a*b
+    A = Mul->getOperand(0);
+    B = Mul->getOperand(1);
+    if (IsSub)
+      A = Builder->CreateFNeg(A, "negtmp");
+    C = L;
+  } else {
+    return nullptr;
+  }
+
+  Value *Fused = Builder->CreateIntrinsic(Intrinsic::fmuladd, {L->getType()},
+                                          {A, B, C}, nullptr, "fmatmp");
+  Mul->eraseFromParent();
+  return Fused;
+}
+
 /// BinaryExprAST::codegen - Recursively codegen both operands, then emit the
 /// operator-specific instruction.
 ///
@@ -3239,21 +4706,31 @@ Value *BinaryExprAST::codegen() {
   ValueType LType = LHS->getType();
   ValueType RType = RHS->getType();
 
+  // Vector operands use the same instructions as scalars, lane by lane, with
+  // any scalar operand splatted; only the element type matters below.
   switch (Op) {
   case '+':
   case '-':
-  case '*': {
+  case '*':
+  case '/': {
     L = EmitImplicitCast(L, LType, getType());
     R = EmitImplicitCast(R, RType, getType());
     if (!L || !R)
       return LogErrorV("Type mismatch in arithmetic");
-    if (IsFloatType(getType())) {
+    if (IsFloatType(ElementType(getType()))) {
+      if (Op == '/')
+        return Builder->CreateFDiv(L, R, "divtmp");
+      if (Op != '*' && FPContract == FPContractKind::On)
+        if (Value *Fused = EmitFPContractedAdd(L, R, Op == '-'))
+          return Fused;
       if (Op == '+')
         return Builder->CreateFAdd(L, R, "addtmp");
       if (Op == '-')
         return Builder->CreateFSub(L, R, "subtmp");
       return Builder->CreateFMul(L, R, "multmp");
     }
+    if (Op == '/')
+      return LogErrorV("'/' requires float operands");
     if (Op == '+')
       return Builder->CreateAdd(L, R, "addtmp");
     if (Op == '-')
@@ -3267,7 +4744,13 @@ Value *BinaryExprAST::codegen() {
   case tok_leq:
   case tok_geq: {
     ValueType CompareType = ValueType::Error;
-    if (LType == ValueType::Bool && RType == ValueType::Bool) {
+    if (IsVectorType(LType) || IsVectorType(RType)) {
+      // The parser checked the operands; compare at the vector type.
+      CompareType = IsVectorType(LType) ? LType : RType;
+      if (ElementType(CompareType) == ValueType::Bool && Op != tok_eq &&
+          Op != tok_neq)
+        return LogErrorV("Type mismatch in comparison");
+    } else if (LType == ValueType::Bool && RType == ValueType::Bool) {
       if (Op != tok_eq && Op != tok_neq)
         return LogErrorV("Type mismatch in comparison");
       CompareType = ValueType::Bool;
@@ -3293,18 +4776,18 @@ Value *BinaryExprAST::codegen() {
     if (CompareType == ValueType::Error)
       return LogErrorV("Type mismatch in comparison");
 
-    if (CompareType == ValueType::Bool) {
-      if (Op == tok_eq)
-        return Builder->CreateICmpEQ(L, R, "cmptmp");
-      return Builder->CreateICmpNE(L, R, "cmptmp");
-    }
-
     L = EmitImplicitCast(L, LType, CompareType);
     R = EmitImplicitCast(R, RType, CompareType);
     if (!L || !R)
       return LogErrorV("Type mismatch in comparison");
 
-    if (IsFloatType(CompareType)) {
+    if (ElementType(CompareType) == ValueType::Bool) {
+      if (Op == tok_eq)
+        return Builder->CreateICmpEQ(L, R, "cmptmp");
+      return Builder->CreateICmpNE(L, R, "cmptmp");
+    }
+
+    if (IsFloatType(ElementType(CompareType))) {
       switch (Op) {
       case '<':
         return Builder->CreateFCmpOLT(L, R, "cmptmp");
@@ -3365,9 +4848,9 @@ Value *UnaryExprAST::codegen() {
 
   // Built-in unary minus.
   if (Opcode == '-') {
-    if (IsIntType(getType()))
+    if (IsIntType(ElementType(getType())))
       return Builder->CreateNeg(Op, "negtmp");
-    if (IsFloatType(getType()))
+    if (IsFloatType(ElementType(getType())))
       return Builder->CreateFNeg(Op, "negtmp");
     return LogErrorV("Unary '-' not supported for this type");
   }
@@ -3391,6 +4874,77 @@ Value *CastExprAST::codegen() {
   return Cast;
 }
 
+/// VectorExprAST::codegen - Build the vector one lane at a time. Constant
+/// lanes fold into a vector constant.
+Value *VectorExprAST::codegen() {
+  ValueType Elem = ElementType(getType());
+  Value *Vec = PoisonValue::get(LLVMTypeFor(getType()));
+  for (unsigned I = 0; I < Lanes.size(); ++I) {
+    Value *Lane = EmitCast(Lanes[I]->codegen(), Lanes[I]->getType(), Elem);
+    if (!Lane)
+      return nullptr;
+    Vec = Builder->CreateInsertElement(Vec, Lane, Builder->getInt32(I),
+                                       "vecinit");
+  }
+  return Vec;
+}
+
+/// VectorBuiltinExprAST::codegen - Lane access maps to extractelement and
+/// insertelement, select to a vector select, and the reductions to the
+/// llvm.vector.reduce.* intrinsics. Floating-point add and multiply reduce
+/// in lane order unless the function allows reassociation (@fastmath), so
+/// the result matches the equivalent scalar loop.
+Value *VectorBuiltinExprAST::codegen() {
+  vector<Value *> Vals;
+  for (auto &Arg : Args) {
+    Value *V = Arg->codegen();
+    if (!V)
+      return nullptr;
+    Vals.push_back(V);
+  }
+  ValueType Elem = ElementType(Args[0]->getType());
+  bool IsFloat = IsFloatType(Elem);
+
+  switch (Kind) {
+  case VectorBuiltin::ExtractLane:
+    return Builder->CreateExtractElement(Vals[0], Builder->getInt32(Lane),
+                                         "lane");
+  case VectorBuiltin::InsertLane: {
+    Value *X = EmitImplicitCast(Vals[1], Args[1]->getType(), Elem);
+    if (!X)
+      return LogErrorV("Type mismatch in insert_lane");
+    return Builder->CreateInsertElement(Vals[0], X, Builder->getInt32(Lane),
+                                        "vecins");
+  }
+  case VectorBuiltin::Select:
+    return Builder->CreateSelect(Vals[0], Vals[1], Vals[2], "vecsel");
+  case VectorBuiltin::ReduceAdd:
+    if (IsFloat)
+      return Builder->CreateFAddReduce(ConstantFP::getNegativeZero(
+                                           LLVMTypeFor(Elem)),
+                                       Vals[0]);
+    return Builder->CreateAddReduce(Vals[0]);
+  case VectorBuiltin::ReduceMul:
+    if (IsFloat)
+      return Builder->CreateFMulReduce(ConstantFP::get(LLVMTypeFor(Elem), 1.0),
+                                       Vals[0]);
+    return Builder->CreateMulReduce(Vals[0]);
+  case VectorBuiltin::ReduceMin:
+    if (IsFloat)
+      return Builder->CreateFPMinReduce(Vals[0]);
+    return Builder->CreateIntMinReduce(Vals[0], /*IsSigned=*/true);
+  case VectorBuiltin::ReduceMax:
+    if (IsFloat)
+      return Builder->CreateFPMaxReduce(Vals[0]);
+    return Builder->CreateIntMaxReduce(Vals[0], /*IsSigned=*/true);
+  case VectorBuiltin::Any:
+    return Builder->CreateOrReduce(Vals[0]);
+  case VectorBuiltin::All:
+    return Builder->CreateAndReduce(Vals[0]);
+  }
+  return nullptr;
+}
+
 /// CallExprAST::codegen - Look up the callee by name in TheModule, verify the
 /// argument count, codegen each argument, then emit a call instruction.
 ///
@@ -3473,8 +5027,26 @@ Value *IfStmtAST::codegen() {
   return ConstantFP::get(*TheContext, APFloat(0.0));
 }
 
+/// LoopTarget - Where break and continue jump to in one enclosing loop.
+struct LoopTarget {
+  BasicBlock *Continue;
+  BasicBlock *Break; // Null in an outlined @parallel body.
+};
+static thread_local vector<LoopTarget> LoopTargets;
+
+struct LoopTargetGuard {
+  LoopTargetGuard(BasicBlock *Continue, BasicBlock *Break) {
+    LoopTargets.push_back({Continue, Break});
+  }
+  ~LoopTargetGuard() { LoopTargets.pop_back(); }
+};
+
 /// ForExprAST::codegen - Emit LLVM IR for a for-expression using a mutable
 /// stack slot for the loop variable.
+///
+///   loop_cond:  cond ? loop_body : after_loop
+///   loop_body:  body; br loop_step      (break: br after_loop)
+///   loop_step:  var += step; br loop_cond (continue: br loop_step)
 Value *ForExprAST::codegen() {
   Function *TheFunction = Builder->GetInsertBlock()->getParent();
 
@@ -3508,6 +5080,10 @@ Value *ForExprAST::codegen() {
       BasicBlock::Create(*TheContext, "loop_cond", TheFunction);
   BasicBlock *BodyBB =
       BasicBlock::Create(*TheContext, "loop_body", TheFunction);
+  // Created in the function up front, so they are freed with it if the body
+  // fails, and moved into execution order below.
+  BasicBlock *StepBB =
+      BasicBlock::Create(*TheContext, "loop_step", TheFunction);
   BasicBlock *AfterBB =
       BasicBlock::Create(*TheContext, "after_loop", TheFunction);
 
@@ -3530,9 +5106,17 @@ Value *ForExprAST::codegen() {
 
   Builder->SetInsertPoint(BodyBB);
 
-  if (!Body->codegen())
-    return nullptr;
+  {
+    LoopTargetGuard Targets(StepBB, AfterBB);
+    if (!Body->codegen())
+      return nullptr;
+  }
+  if (!Builder->GetInsertBlock()->getTerminator())
+    Builder->CreateBr(StepBB);
 
+  // Blocks are placed in execution order so the IR reads top to bottom.
+  StepBB->moveAfter(Builder->GetInsertBlock());
+  Builder->SetInsertPoint(StepBB);
   Value *CurVar = Builder->CreateLoad(LLVMTypeFor(VarType), VarPtr, VarName);
   Value *StepVal = Step->codegen();
   if (!StepVal)
@@ -3548,6 +5132,7 @@ Value *ForExprAST::codegen() {
   Builder->CreateStore(NextVar, VarPtr);
   Builder->CreateBr(CondBB);
 
+  AfterBB->moveAfter(Builder->GetInsertBlock());
   Builder->SetInsertPoint(AfterBB);
 
   if (IsVarDecl) {
@@ -3560,6 +5145,345 @@ Value *ForExprAST::codegen() {
   return ConstantFP::get(*TheContext, APFloat(0.0));
 }
 
+/// WhileExprAST::codegen - Emit a while loop:
+///
+///   while_cond:  cond ? while_body : after_while   (continue: br while_cond)
+///   while_body:  body; br while_cond               (break: br after_while)
+Value *WhileExprAST::codegen() {
+  Function *TheFunction = Builder->GetInsertBlock()->getParent();
+  BasicBlock *CondBB =
+      BasicBlock::Create(*TheContext, "while_cond", TheFunction);
+  BasicBlock *BodyBB =
+      BasicBlock::Create(*TheContext, "while_body", TheFunction);
+  // Created in the function up front, so it is freed with it if the body
+  // fails, and moved after the body below.
+  BasicBlock *AfterBB =
+      BasicBlock::Create(*TheContext, "after_while", TheFunction);
+
+  Builder->CreateBr(CondBB);
+  Builder->SetInsertPoint(CondBB);
+  Value *CondVal = Cond->codegen();
+  if (!CondVal)
+    return nullptr;
+  CondVal = ToBool(CondVal, Cond->getType());
+  if (!CondVal)
+    return LogErrorV("Invalid loop condition type");
+  // `while True:` only leaves through break or return, so the code after it
+  // is reachable only from a break and a function may end inside the loop.
+  if (auto *C = dyn_cast<ConstantInt>(CondVal); C && C->isOne())
+    Builder->CreateBr(BodyBB);
+  else
+    Builder->CreateCondBr(CondVal, BodyBB, AfterBB);
+
+  Builder->SetInsertPoint(BodyBB);
+  {
+    LoopTargetGuard Targets(CondBB, AfterBB);
+    if (!Body->codegen())
+      return nullptr;
+  }
+  if (!Builder->GetInsertBlock()->getTerminator())
+    Builder->CreateBr(CondBB);
+
+  AfterBB->moveAfter(Builder->GetInsertBlock());
+  Builder->SetInsertPoint(AfterBB);
+  return ConstantFP::get(*TheContext, APFloat(0.0));
+}
+
+/// LoopExitAST::codegen - Branch to the innermost loop's exit or next
+/// iteration. The current block ends here; BlockExprAST stops emitting the
+/// statements after it, as after a return.
+Value *LoopExitAST::codegen() {
+  if (LoopTargets.empty())
+    return LogErrorV(IsBreak ? "'break' outside a loop"
+                             : "'continue' outside a loop");
+  BasicBlock *Target =
+      IsBreak ? LoopTargets.back().Break : LoopTargets.back().Continue;
+  if (!Target)
+    return LogErrorV("Cannot break out of a @parallel loop");
+  Builder->CreateBr(Target);
+  return ConstantFP::get(*TheContext, APFloat(0.0));
+}
+
+static void RunFunctionPasses(Function &F);
+
+/// Layout of the environment a @parallel loop passes to its outlined body: an
+/// array of pointers to the loop's start and step, then one partial-result
+/// array per reduction, then the captured locals of the enclosing function.
+enum ParallelEnvSlot : unsigned {
+  PES_Start = 0,
+  PES_Step = 1,
+  PES_FirstReduction = 2,
+};
+
+/// ParallelForExprAST::outlineBody - Emit the loop body as
+///   void __pyxc.parallel.<fn>(ptr env, i64 chunk, i64 begin, i64 end)
+/// which runs iterations [begin, end) and stores each reduction's sum for the
+/// chunk in its partial-result array.
+///
+/// Captured locals are copied in on entry, so the body reads the values they
+/// had when the loop started; the parser rejects assignments to them.
+Function *ParallelForExprAST::outlineBody(
+    ArrayRef<pair<string, AllocaInst *>> Captures) {
+  Function *Parent = Builder->GetInsertBlock()->getParent();
+  llvm::Type *I64 = Builder->getInt64Ty();
+  llvm::Type *PtrTy = Builder->getPtrTy();
+  auto *FT = FunctionType::get(Builder->getVoidTy(), {PtrTy, I64, I64, I64},
+                               false);
+  Function *F = Function::Create(FT, Function::InternalLinkage,
+                                 "__pyxc.parallel." + Parent->getName(),
+                                 TheModule.get());
+  AddTargetAttributes(F);
+  Argument *Env = F->getArg(0), *Chunk = F->getArg(1);
+  Argument *Begin = F->getArg(2), *End = F->getArg(3);
+  Env->setName("env");
+  Chunk->setName("chunk");
+  Begin->setName("begin");
+  End->setName("end");
+
+  // The parent's insertion point, debug location, scope, and locals come
+  // back when this returns.
+  IRBuilderBase::InsertPointGuard IPGuard(*Builder);
+  DIScope *SavedScope = CurDIScope;
+  StringMap<AllocaInst *> SavedNamedValues = std::move(NamedValues);
+  auto Restore = make_scope_exit([&] {
+    CurDIScope = SavedScope;
+    NamedValues = std::move(SavedNamedValues);
+  });
+
+  if (DIB && TheDIFile && CurDIScope) {
+    auto *SubType = DIB->createSubroutineType(DIB->getOrCreateTypeArray({}));
+    DISubprogram *SP = DIB->createFunction(
+        TheDIFile, F->getName(), StringRef(), TheDIFile, CurFunctionLine,
+        SubType, CurFunctionLine, DINode::FlagArtificial,
+        DISubprogram::SPFlagDefinition | DISubprogram::SPFlagLocalToUnit);
+    F->setSubprogram(SP);
+    CurDIScope = SP;
+  } else {
+    CurDIScope = nullptr;
+  }
+
+  BasicBlock *Entry = BasicBlock::Create(*TheContext, "entry", F);
+  Builder->SetInsertPoint(Entry);
+  Builder->SetCurrentDebugLocation(DebugLoc());
+  SetCurrentDebugLocation(CurFunctionLine);
+
+  auto LoadSlot = [&](unsigned Slot) {
+    return Builder->CreateLoad(
+        PtrTy, Builder->CreateConstInBoundsGEP1_64(PtrTy, Env, Slot));
+  };
+  Value *StartVal = Builder->CreateLoad(I64, LoadSlot(PES_Start), "start");
+  Value *StepVal = Builder->CreateLoad(I64, LoadSlot(PES_Step), "step");
+
+  NamedValues.clear();
+  unsigned Slot = PES_FirstReduction + Reductions.size();
+  for (const auto &[Name, Outer] : Captures) {
+    IRBuilder<> TmpB(Entry, Entry->begin());
+    AllocaInst *Copy =
+        TmpB.CreateAlloca(Outer->getAllocatedType(), nullptr, Name);
+    Builder->CreateStore(
+        Builder->CreateLoad(Outer->getAllocatedType(), LoadSlot(Slot++)),
+        Copy);
+    NamedValues[Name] = Copy;
+  }
+
+  vector<AllocaInst *> Sums;
+  for (const auto &[Name, SumType] : Reductions) {
+    AllocaInst *Sum = CreateEntryBlockAlloca(F, Name, SumType);
+    Builder->CreateStore(ZeroConstant(SumType), Sum);
+    EmitDebugDeclare(Sum, Name, CurFunctionLine, false, 0, SumType);
+    NamedValues[Name] = Sum;
+    Sums.push_back(Sum);
+  }
+
+  AllocaInst *Var = CreateEntryBlockAlloca(F, VarName, VarType);
+  EmitDebugDeclare(Var, VarName, CurFunctionLine, false, 0, VarType);
+  NamedValues[VarName] = Var;
+  AllocaInst *Iter = Builder->CreateAlloca(I64, nullptr, "iter");
+  Builder->CreateStore(Begin, Iter);
+
+  BasicBlock *CondBB = BasicBlock::Create(*TheContext, "loop_cond", F);
+  BasicBlock *BodyBB = BasicBlock::Create(*TheContext, "loop_body", F);
+  BasicBlock *StepBB = BasicBlock::Create(*TheContext, "loop_step", F);
+  BasicBlock *AfterBB = BasicBlock::Create(*TheContext, "after_loop", F);
+  Builder->CreateBr(CondBB);
+
+  Builder->SetInsertPoint(CondBB);
+  Value *K = Builder->CreateLoad(I64, Iter, "k");
+  Builder->CreateCondBr(Builder->CreateICmpSLT(K, End), BodyBB, AfterBB);
+
+  Builder->SetInsertPoint(BodyBB);
+  Value *I = Builder->CreateAdd(StartVal, Builder->CreateMul(K, StepVal));
+  Builder->CreateStore(Builder->CreateTrunc(I, LLVMTypeFor(VarType)), Var);
+  {
+    // continue moves to the next iteration; the parser rejects break.
+    LoopTargetGuard Targets(StepBB, nullptr);
+    if (!Body->codegen()) {
+      F->eraseFromParent();
+      return nullptr;
+    }
+  }
+  if (!Builder->GetInsertBlock()->getTerminator())
+    Builder->CreateBr(StepBB);
+
+  StepBB->moveAfter(Builder->GetInsertBlock());
+  Builder->SetInsertPoint(StepBB);
+  Builder->CreateStore(Builder->CreateAdd(K, Builder->getInt64(1)), Iter);
+  Builder->CreateBr(CondBB);
+
+  AfterBB->moveAfter(StepBB);
+  Builder->SetInsertPoint(AfterBB);
+  for (size_t R = 0; R < Reductions.size(); ++R) {
+    llvm::Type *SumTy = LLVMTypeFor(Reductions[R].second);
+    Value *Partials = LoadSlot(PES_FirstReduction + R);
+    Builder->CreateStore(Builder->CreateLoad(SumTy, Sums[R]),
+                         Builder->CreateInBoundsGEP(SumTy, Partials, Chunk));
+  }
+  Builder->CreateRetVoid();
+
+  verifyFunction(*F);
+  RunFunctionPasses(*F);
+  return F;
+}
+
+/// ParallelForExprAST::codegen - Run the loop through the runtime's worker
+/// pool:
+///
+///   n = number of iterations (none unless start < bound and step > 0)
+///   __pyxc_parallel_for(@__pyxc.parallel.<fn>, env, n)
+///   for each reduction r: r = r + partial[0] + ... + partial[chunks - 1]
+///
+/// Chunk boundaries depend only on n (see runtime.h) and the partial sums
+/// are added in chunk order, so a floating-point reduction gives the same
+/// result on every run, whatever the number of threads.
+Value *ParallelForExprAST::codegen() {
+  Function *TheFunction = Builder->GetInsertBlock()->getParent();
+  llvm::Type *I64 = Builder->getInt64Ty();
+  llvm::Type *PtrTy = Builder->getPtrTy();
+
+  auto EvalOnce = [&](ExprAST *E, const char *Error) -> Value * {
+    Value *V = E->codegen();
+    if (!V)
+      return nullptr;
+    V = EmitImplicitCast(V, E->getType(), VarType);
+    if (!V)
+      return LogErrorV(Error);
+    return Builder->CreateSExtOrTrunc(V, I64);
+  };
+  Value *StartVal = EvalOnce(Start.get(), "Type mismatch in for loop start");
+  if (!StartVal)
+    return nullptr;
+  Value *BoundVal = EvalOnce(Bound.get(), "Type mismatch in for loop bound");
+  if (!BoundVal)
+    return nullptr;
+  Value *StepVal = EvalOnce(Step.get(), "Type mismatch in for loop step");
+  if (!StepVal)
+    return nullptr;
+
+  if (InclusiveBound)
+    BoundVal = Builder->CreateAdd(BoundVal, Builder->getInt64(1));
+  Value *Span = Builder->CreateSub(BoundVal, StartVal, "par.span");
+  Value *Zero = Builder->getInt64(0), *One = Builder->getInt64(1);
+  Value *StepPositive = Builder->CreateICmpSGT(StepVal, Zero);
+  Value *SafeStep = Builder->CreateSelect(StepPositive, StepVal, One);
+  Value *Count = Builder->CreateUDiv(
+      Builder->CreateAdd(Span, Builder->CreateSub(SafeStep, One)), SafeStep);
+  Count = Builder->CreateSelect(
+      Builder->CreateAnd(StepPositive, Builder->CreateICmpSGT(Span, Zero)),
+      Count, Zero, "par.count");
+
+  // Every local in scope is captured; the optimizer drops unused copies.
+  // Sorting keeps the environment layout independent of hash order.
+  vector<pair<string, AllocaInst *>> Captures;
+  for (const auto &Entry : NamedValues)
+    if (Entry.second &&
+        none_of(Reductions, [&](const pair<string, ValueType> &R) {
+          return R.first == Entry.first();
+        }))
+      Captures.emplace_back(Entry.first().str(), Entry.second);
+  llvm::sort(Captures);
+
+  IRBuilder<> TmpB(&TheFunction->getEntryBlock(),
+                   TheFunction->getEntryBlock().begin());
+  unsigned NumSlots = PES_FirstReduction + Reductions.size() + Captures.size();
+  AllocaInst *Env =
+      TmpB.CreateAlloca(ArrayType::get(PtrTy, NumSlots), nullptr, "par.env");
+  auto SetSlot = [&](unsigned Slot, Value *Ptr) {
+    Builder->CreateStore(Ptr,
+                         Builder->CreateConstInBoundsGEP1_64(PtrTy, Env, Slot));
+  };
+
+  AllocaInst *StartSlot = TmpB.CreateAlloca(I64, nullptr, "par.start");
+  AllocaInst *StepSlot = TmpB.CreateAlloca(I64, nullptr, "par.step");
+  Builder->CreateStore(StartVal, StartSlot);
+  Builder->CreateStore(StepVal, StepSlot);
+  SetSlot(PES_Start, StartSlot);
+  SetSlot(PES_Step, StepSlot);
+
+  vector<AllocaInst *> Partials;
+  for (size_t R = 0; R < Reductions.size(); ++R) {
+    llvm::Type *SumTy = LLVMTypeFor(Reductions[R].second);
+    Partials.push_back(TmpB.CreateAlloca(
+        ArrayType::get(SumTy, PYXC_PARALLEL_MAX_CHUNKS), nullptr,
+        Reductions[R].first + ".partials"));
+    SetSlot(PES_FirstReduction + R, Partials.back());
+  }
+  for (size_t C = 0; C < Captures.size(); ++C)
+    SetSlot(PES_FirstReduction + Reductions.size() + C, Captures[C].second);
+
+  Function *Outlined = outlineBody(Captures);
+  if (!Outlined)
+    return nullptr;
+
+  FunctionCallee ParallelFor = TheModule->getOrInsertFunction(
+      "__pyxc_parallel_for",
+      FunctionType::get(Builder->getVoidTy(), {PtrTy, PtrTy, I64}, false));
+  Builder->CreateCall(ParallelFor, {Outlined, Env, Count});
+
+  if (Reductions.empty())
+    return ConstantFP::get(*TheContext, APFloat(0.0));
+
+  // Add the partial sums into the reduction variables, in chunk order.
+  Value *MaxChunks = Builder->getInt64(PYXC_PARALLEL_MAX_CHUNKS);
+  Value *NumChunks =
+      Builder->CreateSelect(Builder->CreateICmpULT(Count, MaxChunks), Count,
+                            MaxChunks, "par.chunks");
+  AllocaInst *ChunkSlot = TmpB.CreateAlloca(I64, nullptr, "par.chunk");
+  Builder->CreateStore(Zero, ChunkSlot);
+  BasicBlock *CondBB =
+      BasicBlock::Create(*TheContext, "par.combine.cond", TheFunction);
+  BasicBlock *BodyBB =
+      BasicBlock::Create(*TheContext, "par.combine.body", TheFunction);
+  BasicBlock *AfterBB =
+      BasicBlock::Create(*TheContext, "par.combine.done", TheFunction);
+  Builder->CreateBr(CondBB);
+
+  Builder->SetInsertPoint(CondBB);
+  Value *C = Builder->CreateLoad(I64, ChunkSlot, "c");
+  Builder->CreateCondBr(Builder->CreateICmpULT(C, NumChunks), BodyBB,
+                        AfterBB);
+
+  Builder->SetInsertPoint(BodyBB);
+  for (size_t R = 0; R < Reductions.size(); ++R) {
+    const auto &[Name, SumType] = Reductions[R];
+    AllocaInst *Target = NamedValues.lookup(Name);
+    if (!Target)
+      return LogErrorV("Unknown reduction variable");
+    llvm::Type *SumTy = LLVMTypeFor(SumType);
+    Value *Part = Builder->CreateLoad(
+        SumTy, Builder->CreateInBoundsGEP(Partials[R]->getAllocatedType(),
+                                          Partials[R], {Zero, C}));
+    Value *Old = Builder->CreateLoad(SumTy, Target, Name);
+    Value *New = IsFloatType(SumType) ? Builder->CreateFAdd(Old, Part)
+                                      : Builder->CreateAdd(Old, Part);
+    Builder->CreateStore(New, Target);
+  }
+  Builder->CreateStore(Builder->CreateAdd(C, One), ChunkSlot);
+  Builder->CreateBr(CondBB);
+
+  Builder->SetInsertPoint(AfterBB);
+  return ConstantFP::get(*TheContext, APFloat(0.0));
+}
+
 /// VarStmtAST::codegen - Allocate mutable local variables and initialize them.
 Value *VarStmtAST::codegen() {
   if (InGlobalInit) {
@@ -3650,6 +5574,28 @@ Function *PrototypeAST::codegen() {
   for (auto &Arg : F->args())
     Arg.setName(Args[Idx++].first);
 
+  // Decorator attributes go on every declaration as well as the definition,
+  // so callers in other modules can rely on them too.
+  if (hasDecorator(FD_Inline))
+    F->addFnAttr(Attribute::AlwaysInline);
+  if (hasDecorator(FD_NoInline))
+    F->addFnAttr(Attribute::NoInline);
+  if (hasDecorator(FD_Cold))
+    F->addFnAttr(Attribute::Cold);
+  if (hasDecorator(FD_Pure)) {
+    // The parser has checked the body writes no globals and calls only
+    // @pure functions; locals live on the function's own stack. The
+    // --instrument=calls and --jit-tiered hooks do write memory on every
+    // call, though, and the optimizer would drop or merge the calls they
+    // must count, so with either hook only nounwind still holds.
+    if (!IsInstrumentCalls() && (!JITTiered || IsEmitMode())) {
+      F->setMemoryEffects(ReadsGlobals ? MemoryEffects::readOnly()
+                                       : MemoryEffects::none());
+      F->addFnAttr(Attribute::WillReturn);
+    }
+    F->addFnAttr(Attribute::NoUnwind);
+  }
+
   // For user-defined binary operators, register the precedence in the global
   // table so the parser knows how tightly the new operator binds.  This happens
   // at JIT time (inside codegen), meaning the operator is immediately usable in
@@ -3665,18 +5611,305 @@ Function *PrototypeAST::codegen() {
   return F;
 }
 
-/// FunctionAST::codegen - Generate IR for a complete function definition.
-///
-/// Four steps:
-///
-/// 1. Register the prototype. The PrototypeAST is moved into FunctionProtos
-///    so that future modules can re-emit a declaration for this function via
-///    getFunction(). A reference is kept for the getFunction() call below.
-///    getFunction() either finds an existing declaration in the current module
-///    (e.g. from a prior 'extern def') or calls Proto->codegen() to create one.
+//===----------------------------------------===//
+// Time report (--time-report)
+//===----------------------------------------===//
+
+/// PhaseTimers - Wall/CPU timers for the phases of one input file.
 ///
-/// 2. Create the entry BasicBlock and point the Builder at it. A basic block
-///    is a straight-line sequence of instructions with one entry and one exit.
+/// The lexer is pulled token by token by the parser, so the two are timed
+/// together as the front end; --lex-only times the lexer on its own. Each
+/// definition is lowered to IR as soon as it is parsed, and its function
+/// passes run right after, but both are charged to their own timers (see
+/// NestedPhase). CPU times come from the process rusage, so they are only
+/// per-file exact with -j 1.
+struct PhaseTimers {
+  TimerGroup Group;
+  Timer Lex, Frontend, Codegen, FunctionPasses, ModulePasses, Emit, JIT, Run,
+      Link;
+
+  PhaseTimers(StringRef Name, StringRef Description)
+      : Group(Name, Description), Lex("lex", "Lexing (--lex-only)", Group),
+        Frontend("frontend", "Lex and parse", Group),
+        Codegen("codegen", "IR codegen", Group),
+        FunctionPasses("function-passes", "Function passes", Group),
+        ModulePasses("module-passes", "Module passes", Group),
+        Emit("emit", "Code emission", Group),
+        JIT("jit", "JIT compilation", Group), Run("run", "Execution", Group),
+        Link("link", "Link (lld)", Group) {}
+};
+
+// TimeReportMutex - Guards AllPhaseTimers and AllPassTimers.
+static std::mutex TimeReportMutex;
+// AllPhaseTimers / AllPassTimers - Every timer group created in this run,
+// kept alive until EmitTimeReport() prints them. Per-thread pass timers live
+// here rather than in thread_locals so -j worker threads can exit first.
+static vector<unique_ptr<PhaseTimers>> AllPhaseTimers;
+static vector<unique_ptr<TimePassesHandler>> AllPassTimers;
+// CurPhaseTimers - Timers of the file this thread is compiling, if any.
+static thread_local PhaseTimers *CurPhaseTimers = nullptr;
+
+static bool TimeReportEnabled() {
+  return TimeReport || !TimeReportJSON.empty();
+}
+
+/// BeginPhaseTimers - Start a new group of phase timers for Name (an input
+/// file, or "link") on the calling thread.
+static void BeginPhaseTimers(StringRef Name) {
+  if (!TimeReportEnabled())
+    return;
+  // The group name becomes part of each JSON key, so keep it plain.
+  string Key = "pyxc.";
+  for (char C : Name)
+    Key += (isalnum(static_cast<unsigned char>(C)) || C == '.' || C == '_' ||
+            C == '-')
+               ? C
+               : '_';
+  auto Timers =
+      std::make_unique<PhaseTimers>(Key, ("pyxc phase times: " + Name).str());
+  CurPhaseTimers = Timers.get();
+  std::lock_guard<std::mutex> Lock(TimeReportMutex);
+  AllPhaseTimers.push_back(std::move(Timers));
+}
+
+/// PhaseTimer - Return the given phase timer of the current file, or nullptr
+/// (which TimeRegion ignores) when nothing is being timed.
+static Timer *PhaseTimer(Timer PhaseTimers::*Phase) {
+  return CurPhaseTimers ? &(CurPhaseTimers->*Phase) : nullptr;
+}
+
+/// CreatePassTimingCallbacks - With --time-report, return instrumentation
+/// callbacks that feed a TimePassesHandler for this thread's pipeline.
+static PassInstrumentationCallbacks *CreatePassTimingCallbacks() {
+  if (!TimeReportEnabled())
+    return nullptr;
+  ThePIC = std::make_unique<PassInstrumentationCallbacks>();
+  auto Handler = std::make_unique<TimePassesHandler>(/*Enabled=*/true);
+  Handler->registerCallbacks(*ThePIC);
+  std::lock_guard<std::mutex> Lock(TimeReportMutex);
+  AllPassTimers.push_back(std::move(Handler));
+  return ThePIC.get();
+}
+
+/// NestedPhase - Charge the time until it is destroyed to one phase, pausing
+/// the front-end or codegen timer if it is running meanwhile. Codegen runs
+/// in the middle of parsing, and function passes in the middle of codegen,
+/// so otherwise their time would be counted twice.
+class NestedPhase {
+  Timer *Running = nullptr;
+  Timer *Paused = nullptr;
+
+public:
+  explicit NestedPhase(Timer PhaseTimers::*Phase) {
+    Timer *T = PhaseTimer(Phase);
+    if (!T || T->isRunning())
+      return;
+    for (Timer *Outer : {PhaseTimer(&PhaseTimers::Frontend),
+                         PhaseTimer(&PhaseTimers::Codegen)})
+      if (Outer->isRunning()) {
+        Outer->stopTimer();
+        Paused = Outer;
+      }
+    Running = T;
+    Running->startTimer();
+  }
+  ~NestedPhase() {
+    if (Running)
+      Running->stopTimer();
+    if (Paused)
+      Paused->startTimer();
+  }
+  NestedPhase(const NestedPhase &) = delete;
+  NestedPhase &operator=(const NestedPhase &) = delete;
+};
+
+/// RunFunctionPasses - Run TheFPM on F, charged to the function-passes phase.
+static void RunFunctionPasses(Function &F) {
+  NestedPhase Phase(&PhaseTimers::FunctionPasses);
+  TheFPM->run(F, *TheFAM);
+}
+
+/// TimedCodegen - AST.codegen(), charged to the codegen phase.
+template <typename ASTT> static Function *TimedCodegen(ASTT &AST) {
+  NestedPhase Phase(&PhaseTimers::Codegen);
+  return AST.codegen();
+}
+
+/// EmitTimeReport - Print the --time-report tables to stderr and/or write
+/// them to --time-report-json. Called once, on the way out of main().
+static void EmitTimeReport() {
+  if (!TimeReportEnabled())
+    return;
+
+  if (!TimeReportJSON.empty()) {
+    std::error_code EC;
+    raw_fd_ostream OS(TimeReportJSON, EC, sys::fs::OF_Text);
+    if (EC) {
+      fprintf(stderr, "Error: could not open time report file '%s': %s\n",
+              TimeReportJSON.c_str(), EC.message().c_str());
+    } else {
+      OS << "{\n";
+      TimerGroup::printAllJSONValues(OS, "");
+      OS << "\n}\n";
+    }
+  }
+
+  if (!TimeReport) {
+    // Timer groups print whatever is left in them when destroyed.
+    TimerGroup::clearAll();
+    return;
+  }
+  for (auto &Timers : AllPhaseTimers)
+    Timers->Group.print(errs(), /*ResetAfterPrint=*/true);
+  for (auto &Handler : AllPassTimers)
+    Handler->print();
+}
+
+//===----------------------------------------===//
+// Tiered compilation (--jit-tiered)
+//===----------------------------------------===//
+
+// TierMutex - Guards TierBaselineIR, which is read by tier-up threads.
+static std::mutex TierMutex;
+// TierBaselineIR - Bitcode of each tiered function's module, captured before
+// the call counter is added. The hot tier is rebuilt from this.
+static std::map<std::string, std::string> TierBaselineIR;
+
+/// IsTieredFunction - True if Name should get a call counter and be installed
+/// behind a redirectable stub. Internal helpers and top-level expressions run
+/// once, so they are never worth recompiling.
+static bool IsTieredFunction(const string &Name) {
+  return JITTiered && !IsEmitMode() && !InGlobalInit &&
+         Name.rfind("__", 0) != 0;
+}
+
+/// EmitTierUpCounter - Prefix a finished function with a call counter that
+/// calls __pyxc_tier_up(name) once the count reaches --jit-tier-threshold.
+///
+/// The function's module is first snapshotted into TierBaselineIR so the hot
+/// tier is compiled from counter-free IR. The entry block is split after its
+/// allocas so they stay in the entry block:
+///
+///   entry:      allocas; old = counter++; br (old == N-1), tier.up, tier.body
+///   tier.up:    call __pyxc_tier_up(name); br tier.body
+///   tier.body:  original function body
+static void EmitTierUpCounter(Function *F) {
+  {
+    string Bitcode;
+    raw_string_ostream OS(Bitcode);
+    WriteBitcodeToFile(*F->getParent(), OS);
+    OS.flush();
+    std::lock_guard<std::mutex> Lock(TierMutex);
+    TierBaselineIR[F->getName().str()] = std::move(Bitcode);
+  }
+
+  BasicBlock &Entry = F->getEntryBlock();
+  auto FirstNonAlloca = Entry.begin();
+  while (isa<AllocaInst>(&*FirstNonAlloca))
+    ++FirstNonAlloca;
+  BasicBlock *Body = Entry.splitBasicBlock(FirstNonAlloca, "tier.body");
+  Entry.getTerminator()->eraseFromParent();
+
+  LLVMContext &Ctx = F->getContext();
+  Module &M = *F->getParent();
+  IRBuilder<> B(&Entry);
+  if (DISubprogram *SP = F->getSubprogram())
+    B.SetCurrentDebugLocation(DILocation::get(Ctx, SP->getLine(), 0, SP));
+
+  Type *I64 = B.getInt64Ty();
+  auto *Counter = new GlobalVariable(
+      M, I64, false, GlobalValue::InternalLinkage, ConstantInt::get(I64, 0),
+      "__pyxc.calls." + F->getName());
+  // Calls may come from several threads at once, so the increment is atomic
+  // and exactly one caller sees the old value reach threshold - 1.
+  Value *Prev = B.CreateAtomicRMW(AtomicRMWInst::Add, Counter, B.getInt64(1),
+                                  MaybeAlign(8), AtomicOrdering::Monotonic);
+  BasicBlock *TierUp = BasicBlock::Create(Ctx, "tier.up", F, Body);
+  B.CreateCondBr(B.CreateICmpEQ(Prev, B.getInt64(JITTierThreshold - 1)),
+                 TierUp, Body);
+
+  B.SetInsertPoint(TierUp);
+  FunctionCallee Hook = M.getOrInsertFunction(
+      "__pyxc_tier_up", B.getVoidTy(), PointerType::get(Ctx, 0));
+  B.CreateCall(Hook, {B.CreateGlobalString(F->getName(), "__pyxc.tier.name")});
+  B.CreateBr(Body);
+}
+
+/// EmitCallProfile - Make F report its call to the --instrument=calls table.
+///
+/// A tick counter is read after the entry block's allocas, and every return
+/// becomes:
+///
+///   %prof.ticks = sub (readcyclecounter), %prof.start
+///   call __pyxc_profile_call(@__pyxc.profile.<name>, name, %prof.ticks)
+///   ret
+///
+/// The counter is llvm.readcyclecounter (rdtsc on x86), except on AArch64,
+/// where that reads PMCCNTR_EL0, which user code may not read on macOS or
+/// stock Linux; there it is llvm.readsteadycounter (CNTVCT_EL0) instead.
+/// The choice reads the module's triple, which InitializeModuleAndManagers
+/// sets from the JIT or the emitting TargetMachine.
+///
+/// This runs before EmitTierUpCounter, so a tiered function's hot version
+/// keeps reporting, and calls inlined at -O report as calls of their own.
+/// The hook writes memory, so F must not claim otherwise; @pure functions
+/// lose memory(none)/memory(read) under --instrument=calls for this reason
+/// (see PrototypeAST::codegen).
+static void EmitCallProfile(Function *F, StringRef Name) {
+  assert(!F->onlyReadsMemory() &&
+         "profiled function would let its calls be merged or dropped");
+  LLVMContext &Ctx = F->getContext();
+  Module &M = *F->getParent();
+  IRBuilder<> B(Ctx);
+  if (DISubprogram *SP = F->getSubprogram())
+    B.SetCurrentDebugLocation(DILocation::get(Ctx, SP->getLine(), 0, SP));
+
+  BasicBlock &Entry = F->getEntryBlock();
+  auto FirstNonAlloca = Entry.begin();
+  while (isa<AllocaInst>(&*FirstNonAlloca))
+    ++FirstNonAlloca;
+  B.SetInsertPoint(&Entry, FirstNonAlloca);
+  assert(!M.getTargetTriple().empty() &&
+         "the counter depends on the target; set the triple first");
+  Intrinsic::ID Counter = Triple(M.getTargetTriple()).isAArch64()
+                              ? Intrinsic::readsteadycounter
+                              : Intrinsic::readcyclecounter;
+  Value *Start = B.CreateIntrinsic(Counter, {}, {});
+  Start->setName("prof.start");
+
+  Type *I64 = B.getInt64Ty();
+  auto *Slot = new GlobalVariable(M, I64, false, GlobalValue::InternalLinkage,
+                                  ConstantInt::get(I64, 0),
+                                  "__pyxc.profile." + Name);
+  FunctionCallee Hook = M.getOrInsertFunction(
+      "__pyxc_profile_call", B.getVoidTy(), PointerType::get(Ctx, 0),
+      PointerType::get(Ctx, 0), I64);
+  Value *NameStr = nullptr;
+  SmallVector<ReturnInst *, 4> Returns;
+  for (BasicBlock &BB : *F)
+    if (auto *Ret = dyn_cast<ReturnInst>(BB.getTerminator()))
+      Returns.push_back(Ret);
+  for (ReturnInst *Ret : Returns) {
+    B.SetInsertPoint(Ret);
+    if (!NameStr)
+      NameStr = B.CreateGlobalString(Name, "__pyxc.profile.name");
+    Value *End = B.CreateIntrinsic(Counter, {}, {});
+    B.CreateCall(Hook, {Slot, NameStr, B.CreateSub(End, Start, "prof.ticks")});
+  }
+}
+
+/// FunctionAST::codegen - Generate IR for a complete function definition.
+///
+/// Four steps:
+///
+/// 1. Register the prototype. The PrototypeAST is moved into FunctionProtos
+///    so that future modules can re-emit a declaration for this function via
+///    getFunction(). A reference is kept for the getFunction() call below.
+///    getFunction() either finds an existing declaration in the current module
+///    (e.g. from a prior 'extern def') or calls Proto->codegen() to create one.
+///
+/// 2. Create the entry BasicBlock and point the Builder at it. A basic block
+///    is a straight-line sequence of instructions with one entry and one exit.
 ///    Every function starts with exactly one entry block.
 ///
 /// 3. Populate NamedValues. Clear the table, create an entry-block alloca for
@@ -3705,10 +5938,13 @@ Function *FunctionAST::codegen() {
     bool IsInternal = P.getName().rfind("__pyxc.", 0) == 0;
     if (!IsInternal) {
       unsigned Line = P.getLocation().Line ? P.getLocation().Line : 1;
+      // -gline-tables-only describes functions by name and lines alone.
       SmallVector<Metadata *, 8> EltTys;
-      EltTys.push_back(DITypeFor(P.getReturnType()));
-      for (size_t i = 0; i < P.getArgs().size(); ++i)
-        EltTys.push_back(DITypeFor(P.getArgType(i)));
+      if (!LineTablesOnly) {
+        EltTys.push_back(DITypeFor(P.getReturnType()));
+        for (size_t i = 0; i < P.getArgs().size(); ++i)
+          EltTys.push_back(DITypeFor(P.getArgType(i)));
+      }
       auto *SubType =
           DIB->createSubroutineType(DIB->getOrCreateTypeArray(EltTys));
       SP = DIB->createFunction(TheDIFile, P.getName(), StringRef(), TheDIFile,
@@ -3720,10 +5956,14 @@ Function *FunctionAST::codegen() {
     }
   }
 
-  // Step 2: create the entry block and point the builder at it.
+  // Step 2: create the entry block and point the builder at it. Every FP
+  // instruction in the body picks up this function's fast-math flags.
+  AddTargetAttributes(TheFunction);
   BasicBlock *BB = BasicBlock::Create(*TheContext, "entry", TheFunction);
   Builder->SetInsertPoint(BB);
   SetCurrentDebugLocation(CurFunctionLine);
+  IRBuilderBase::FastMathFlagGuard FMFGuard(*Builder);
+  Builder->setFastMathFlags(GetFunctionFastMathFlags(P));
 
   // Step 3: populate NamedValues with entry-block allocas for each argument.
   NamedValues.clear();
@@ -3765,7 +6005,11 @@ Function *FunctionAST::codegen() {
 
     // Run the optimisation pipeline: InstCombine, Reassociate, GVN,
     // SimplifyCFG.
-    TheFPM->run(*TheFunction, *TheFAM);
+    RunFunctionPasses(*TheFunction);
+    if (IsInstrumentCalls() && P.getName().rfind("__", 0) != 0)
+      EmitCallProfile(TheFunction, P.getName());
+    if (IsTieredFunction(P.getName()))
+      EmitTierUpCounter(TheFunction);
     CurDIScope = nullptr;
     CurrentFunctionReturnType = SavedRetType;
     return TheFunction;
@@ -3779,11 +6023,230 @@ Function *FunctionAST::codegen() {
   return nullptr;
 }
 
+//===----------------------------------------===//
+// Module interfaces (--emit interface, --interface)
+//===----------------------------------------===//
+
+// A .pyxi file lists the functions a module defines, so other modules can
+// call them without 'extern def' lines of their own. All integers are 32-bit
+// little-endian; a string is its length followed by its bytes.
+//
+//   "PYXI" version source-path function-count
+//   function = name return-type decorators flags precedence arg-count
+//              { arg-name arg-type }
+//
+// Types are ValueType encodings, so the version must change with them.
+static constexpr StringLiteral InterfaceMagic = "PYXI";
+static constexpr uint32_t InterfaceVersion = 1;
+static constexpr uint32_t InterfaceIsOperator = 1u << 0;
+static constexpr uint32_t InterfaceReadsGlobals = 1u << 1;
+
+/// LoadedInterface - The declarations of one --interface file, decoded once
+/// by LoadInterfaces() and shared read-only by every compile thread.
+struct LoadedInterface {
+  string SourcePath; // real path of the module it was written from
+  vector<unique_ptr<PrototypeAST>> Protos;
+};
+static vector<LoadedInterface> LoadedInterfaces;
+
+/// InterfaceReader - Bounds-checked cursor over a memory-mapped .pyxi.
+struct InterfaceReader {
+  StringRef Data;
+  bool Failed = false;
+
+  uint32_t readU32() {
+    if (Data.size() < 4) {
+      Failed = true;
+      return 0;
+    }
+    uint32_t V = support::endian::read32le(Data.data());
+    Data = Data.drop_front(4);
+    return V;
+  }
+
+  StringRef readString() {
+    uint32_t Len = readU32();
+    if (Len > Data.size()) {
+      Failed = true;
+      return StringRef();
+    }
+    StringRef S = Data.take_front(Len);
+    Data = Data.drop_front(Len);
+    return S;
+  }
+
+  /// readType - A return type: None, or a scalar or vector type whose lanes
+  /// are values.
+  ValueType readType() {
+    auto Type = static_cast<ValueType>(readU32());
+    unsigned Lanes = VectorLanes(Type);
+    if (ElementType(Type) >= ValueType::Error ||
+        (Lanes && (Lanes < 2 || Lanes > MaxVectorLanes ||
+                   ElementType(Type) == ValueType::None)))
+      Failed = true;
+    return Type;
+  }
+
+  /// readArgType - An argument type, which unlike a return type cannot be
+  /// None.
+  ValueType readArgType() {
+    ValueType Type = readType();
+    if (Type == ValueType::None)
+      Failed = true;
+    return Type;
+  }
+};
+
+/// LoadInterfaces - Map and decode every --interface file, and hash them for
+/// the object cache keys. Returns false after reporting an error.
+static bool LoadInterfaces() {
+  SHA256 Hasher;
+  for (const string &Path : Interfaces) {
+    auto BufOrErr = MemoryBuffer::getFile(Path, /*IsText=*/false,
+                                          /*RequiresNullTerminator=*/false);
+    if (!BufOrErr) {
+      fprintf(stderr, "Error: could not read interface '%s': %s\n",
+              Path.c_str(), BufOrErr.getError().message().c_str());
+      return false;
+    }
+    StringRef Data = (*BufOrErr)->getBuffer();
+    Hasher.update(Data);
+
+    InterfaceReader R{Data};
+    LoadedInterface Interface;
+    if (!R.Data.consume_front(InterfaceMagic) ||
+        R.readU32() != InterfaceVersion) {
+      fprintf(stderr,
+              "Error: '%s' is not an interface written by this pyxc\n",
+              Path.c_str());
+      return false;
+    }
+    Interface.SourcePath = R.readString().str();
+    uint32_t NumProtos = R.readU32();
+    for (uint32_t I = 0; I < NumProtos && !R.Failed; ++I) {
+      string Name = R.readString().str();
+      ValueType RetType = R.readType();
+      uint32_t Decorators = R.readU32();
+      uint32_t Flags = R.readU32();
+      uint32_t Precedence = R.readU32();
+      uint32_t NumArgs = R.readU32();
+      vector<pair<string, ValueType>> Args;
+      for (uint32_t A = 0; A < NumArgs && !R.Failed; ++A) {
+        string ArgName = R.readString().str();
+        Args.emplace_back(std::move(ArgName), R.readArgType());
+      }
+      bool IsOperator = Flags & InterfaceIsOperator;
+      if (IsOperator && (Name.empty() || NumArgs < 1 || NumArgs > 2))
+        R.Failed = true;
+      if ((Decorators & ~FD_All) ||
+          (Flags & ~(InterfaceIsOperator | InterfaceReadsGlobals)))
+        R.Failed = true;
+      auto Proto = make_unique<PrototypeAST>(Name, std::move(Args),
+                                             SourceLocation{0, 0}, RetType,
+                                             IsOperator, Precedence);
+      Proto->addDecorators(Decorators);
+      if (Flags & InterfaceReadsGlobals)
+        Proto->setReadsGlobals();
+      Interface.Protos.push_back(std::move(Proto));
+    }
+    if (R.Failed || !R.Data.empty()) {
+      fprintf(stderr, "Error: interface '%s' is corrupt\n", Path.c_str());
+      return false;
+    }
+    LoadedInterfaces.push_back(std::move(Interface));
+  }
+  if (!Interfaces.empty())
+    InterfaceHash = toHex(Hasher.final(), /*LowerCase=*/true);
+  return true;
+}
+
+/// DeclareInterfaces - Declare the --interface functions and operators for
+/// the file about to be parsed, as if it began with their 'extern def' lines.
+///
+/// An interface is skipped for the source it was written from, so one
+/// --interface list can be given to every input of a build.
+static void DeclareInterfaces() {
+  if (LoadedInterfaces.empty())
+    return;
+  SmallString<256> RealSource;
+  if (sys::fs::real_path(CurrentSourcePath, RealSource))
+    RealSource = CurrentSourcePath;
+  for (const LoadedInterface &Interface : LoadedInterfaces) {
+    if (Interface.SourcePath == RealSource)
+      continue;
+    for (const auto &Proto : Interface.Protos) {
+      if (Proto->isBinaryOp())
+        BinopPrecedence[Proto->getOperatorName()] =
+            Proto->getBinaryPrecedence();
+      if (Proto->isUnaryOp())
+        KnownUnaryOperators.insert(Proto->getOperatorName());
+      FunctionProtos[Proto->getName()] = Proto->clone();
+    }
+  }
+}
+
+/// EmitInterface - Write the interface of the file just parsed to Path: every
+/// function it defines except main() and pyxc's internal helpers, sorted by
+/// name so the file only changes when the declarations do.
+static bool EmitInterface(const string &Path) {
+  vector<const PrototypeAST *> Exported;
+  for (const auto &Entry : FunctionProtos) {
+    StringRef Name = Entry.getKey();
+    Function *F = TheModule->getFunction(Name);
+    if (F && !F->isDeclaration() && Name != "main" && !Name.starts_with("__"))
+      Exported.push_back(Entry.getValue().get());
+  }
+  sort(Exported, [](const PrototypeAST *A, const PrototypeAST *B) {
+    return A->getName() < B->getName();
+  });
+
+  SmallString<256> RealSource;
+  if (sys::fs::real_path(CurrentSourcePath, RealSource))
+    RealSource = CurrentSourcePath;
+
+  string Contents;
+  raw_string_ostream OS(Contents);
+  support::endian::Writer W(OS, llvm::endianness::little);
+  auto WriteString = [&](StringRef S) {
+    W.write<uint32_t>(S.size());
+    OS << S;
+  };
+  OS << InterfaceMagic;
+  W.write<uint32_t>(InterfaceVersion);
+  WriteString(RealSource);
+  W.write<uint32_t>(Exported.size());
+  for (const PrototypeAST *Proto : Exported) {
+    bool IsOperator = Proto->isUnaryOp() || Proto->isBinaryOp();
+    WriteString(Proto->getName());
+    W.write<uint32_t>(static_cast<uint32_t>(Proto->getReturnType()));
+    W.write<uint32_t>(Proto->getDecorators());
+    W.write<uint32_t>((IsOperator ? InterfaceIsOperator : 0) |
+                      (Proto->readsGlobals() ? InterfaceReadsGlobals : 0));
+    W.write<uint32_t>(Proto->isBinaryOp() ? Proto->getBinaryPrecedence() : 0);
+    W.write<uint32_t>(Proto->getNumArgs());
+    for (const auto &[ArgName, ArgType] : Proto->getArgs()) {
+      WriteString(ArgName);
+      W.write<uint32_t>(static_cast<uint32_t>(ArgType));
+    }
+  }
+  OS.flush();
+
+  std::error_code EC;
+  raw_fd_ostream Dest(Path, EC, sys::fs::OF_None);
+  if (EC) {
+    fprintf(stderr, "Error: could not open output file '%s'\n",
+            Path.c_str());
+    return false;
+  }
+  Dest << Contents;
+  return true;
+}
+
 //===----------------------------------------===//
 // Top-Level parsing and JIT Driver
 //===----------------------------------------===//
 
-static vector<unique_ptr<ExprAST>> FileTopLevelStmts;
+static thread_local vector<unique_ptr<ExprAST>> FileTopLevelStmts;
 
 /// ResetParserStateForFile - Clear parser/compiler state between input files.
 ///
@@ -3802,18 +6265,32 @@ static void ResetParserStateForFile() {
   HadError = false;
   ResetBinopPrecedence();
   ResetKnownUnaryOperators();
+  ResetASTArena();
+  DeclareInterfaces();
 }
 
-/// InitializeModuleAndManagers - Create a fresh module, IR builder, and
-/// optimisation pipeline.
-///
-/// Called once at startup and again after every top-level input that hands
-/// its module to the JIT. Because the JIT takes ownership of TheModule via
-/// ThreadSafeModule, we cannot keep emitting into the old module — a new one
-/// must be created for every subsequent definition or expression.
+/// GetPGOOptions - IR-level PGO settings for the PassBuilder, if any.
+static std::optional<PGOOptions> GetPGOOptions() {
+  if (IsProfileGenerate())
+    return PGOOptions(ProfileGenerate, "", "", /*MemoryProfile=*/"",
+                      vfs::getRealFileSystem(), PGOOptions::IRInstr);
+  if (!ProfileUse.empty())
+    return PGOOptions(ProfileUse, "", "", /*MemoryProfile=*/"",
+                      vfs::getRealFileSystem(), PGOOptions::IRUse);
+  return std::nullopt;
+}
+
+static TargetMachine *GetTargetMachine();
+
+/// InitializePassManagers - Build the optimisation pipeline and analysis
+/// managers on first use, and drop stale analysis results on later calls.
 ///
-/// The optimisation pipeline is also recreated each time because
-/// FunctionPassManager is tied to a specific LLVMContext.
+/// New-PM passes and analysis registrations hold no IR, so one pipeline
+/// serves every module in the session. Cached analysis results do point at
+/// IR, and they are keyed by address, so they must be cleared once their
+/// module has been handed to the JIT or a new Function allocated at the same
+/// address could pick up an old result. Clearing drops only the results; the
+/// registered analyses and the built pipelines are kept.
 ///
 /// Pipeline:
 ///   PromotePass     - Mem2Reg: promote stack slots to SSA registers.
@@ -3825,19 +6302,29 @@ static void ResetParserStateForFile() {
 ///
 /// The analysis managers are cross-registered so that a function pass that
 /// needs loop information can reach TheLAM, and so on.
-static void InitializeModuleAndManagers(bool FreshContext = true) {
-  // Fresh context and module for this compilation unit.
-  if (FreshContext || !TheContext)
-    TheContext = std::make_unique<LLVMContext>();
-  TheModule = std::make_unique<Module>("PyxcJIT", *TheContext);
-  // Inform the module of the JIT's target data layout so codegen emits
-  // correctly-sized types for the host machine.
-  TheModule->setDataLayout(TheJIT->getDataLayout());
-
-  Builder = std::make_unique<IRBuilder<NoFolder>>(*TheContext);
-  ModuleHasGlobals = false;
-  CurDIScope = nullptr;
-  CurFunctionLine = 1;
+///
+/// The PassBuilder gets this thread's TargetMachine, so the vectorizers, the
+/// inliner and the unroller use the cost model of the --mcpu/--mattr target
+/// rather than a generic one.
+///
+/// --profile-generate and --profile-use hand PGOOptions to the PassBuilder,
+/// so the module pipeline instruments the code or annotates it with branch
+/// weights and entry counts from the profile.
+///
+/// With --lto the module pipeline is the matching pre-link pipeline instead:
+/// it simplifies each file but leaves inlining across files, and the final
+/// optimisation, to the link step.
+///
+/// The managers are thread_local like the rest of the codegen state, so each
+/// -j compile thread builds its own pipeline once.
+static void InitializePassManagers() {
+  if (TheFAM) {
+    TheLAM->clear();
+    TheFAM->clear();
+    TheCGAM->clear();
+    TheMAM->clear();
+    return;
+  }
 
   // Pass and analysis managers.
   TheFPM = std::make_unique<FunctionPassManager>();
@@ -3848,7 +6335,8 @@ static void InitializeModuleAndManagers(bool FreshContext = true) {
   TheMAM = std::make_unique<ModuleAnalysisManager>();
 
   // Cross-register so passes can access any analysis tier they need.
-  PassBuilder PB;
+  PassBuilder PB(GetTargetMachine(), PipelineTuningOptions(), GetPGOOptions(),
+                 CreatePassTimingCallbacks());
   PB.registerModuleAnalyses(*TheMAM);
   PB.registerCGSCCAnalyses(*TheCGAM);
   PB.registerFunctionAnalyses(*TheFAM);
@@ -3862,16 +6350,65 @@ static void InitializeModuleAndManagers(bool FreshContext = true) {
     auto FPM = PB.buildFunctionSimplificationPipeline(GetOptLevel(),
                                                       ThinOrFullLTOPhase::None);
     TheFPM = std::make_unique<FunctionPassManager>(std::move(FPM));
-    auto MPM = PB.buildPerModuleDefaultPipeline(GetOptLevel());
+    ModulePassManager MPM;
+    switch (LTOMode) {
+    case LTOKind::None:
+      MPM = PB.buildPerModuleDefaultPipeline(GetOptLevel());
+      break;
+    case LTOKind::Full:
+      MPM = PB.buildLTOPreLinkDefaultPipeline(GetOptLevel());
+      break;
+    case LTOKind::Thin:
+      MPM = PB.buildThinLTOPreLinkDefaultPipeline(GetOptLevel());
+      break;
+    }
     TheMPM = std::make_unique<ModulePassManager>(std::move(MPM));
   }
+}
+
+/// InitializeModuleAndManagers - Create a fresh module and IR builder, and
+/// ready the optimisation pipeline for it.
+///
+/// Called once at startup and again after every top-level input that hands
+/// its module to the JIT. Because the JIT takes ownership of TheModule via
+/// ThreadSafeModule, we cannot keep emitting into the old module — a new one
+/// must be created for every subsequent definition or expression. The pass
+/// pipeline itself is reused (see InitializePassManagers).
+static void InitializeModuleAndManagers(bool FreshContext = true) {
+  // Fresh context and module for this compilation unit.
+  if (FreshContext || !TheContext)
+    TheContext = std::make_unique<LLVMContext>();
+  // A JIT object cache finds a module's object by the module's name, so
+  // number the modules: the same script then names them the same way on
+  // every run.
+  string ModuleName = "PyxcJIT";
+  if (TheJIT && TheJIT->getObjectCache())
+    ModuleName += "." + utostr(NumJITModules++);
+  TheModule = std::make_unique<Module>(ModuleName, *TheContext);
+  // Inform the module of the target triple and data layout, the JIT's or (in
+  // --emit mode, which has no JIT) the emitting TargetMachine's, so codegen
+  // emits correctly-sized types and target queries see the host machine.
+  if (TheJIT) {
+    TheModule->setTargetTriple(TheJIT->getTargetTriple());
+    TheModule->setDataLayout(TheJIT->getDataLayout());
+  } else if (TargetMachine *TM = GetTargetMachine()) {
+    TheModule->setTargetTriple(TM->getTargetTriple());
+    TheModule->setDataLayout(TM->createDataLayout());
+  }
 
+  Builder = std::make_unique<IRBuilder<NoFolder>>(*TheContext);
+  ModuleHasGlobals = false;
+  CurDIScope = nullptr;
+  CurFunctionLine = 1;
+
+  InitializePassManagers();
   InitializeDebugInfo();
 }
 
 static void RunModuleOptimizations(Module *M) {
   if (!TheMPM || OptLevel == 0)
     return;
+  TimeRegion Region(PhaseTimer(&PhaseTimers::ModulePasses));
   TheMPM->run(*M, *TheMAM);
 }
 
@@ -3886,6 +6423,120 @@ static void SynchronizeToLineBoundary() {
     getNextToken();
 }
 
+/// RenameToTierBody - Rename the definition of Name in M to Name + Suffix and
+/// route its remaining uses (recursive calls) through a declaration of Name,
+/// which resolves to the function's redirectable stub.
+static void RenameToTierBody(Module &M, StringRef Name, StringRef Suffix) {
+  Function *Body = M.getFunction(Name);
+  string FnName = Name.str();
+  Body->setName(FnName + Suffix.str());
+  Function *Decl = Function::Create(Body->getFunctionType(),
+                                    Function::ExternalLinkage, FnName, M);
+  Body->replaceAllUsesWith(Decl);
+}
+
+/// TierUpFunction - Recompile Name at -O3 from its baseline bitcode and point
+/// its stub at the new body. Runs on a TierUpPool thread.
+///
+/// Only Name's body is kept: every other definition in the module is already
+/// in the JIT, so it is turned into a declaration to avoid duplicate symbols.
+/// Internal functions, such as the outlined body of a @parallel loop, are the
+/// exception: the JIT exports no symbol for them, so the new module keeps its
+/// own copy, as it does for internal globals.
+static void TierUpFunction(const string &Name) {
+  string Bitcode;
+  {
+    std::lock_guard<std::mutex> Lock(TierMutex);
+    // Taking the baseline out makes this the only tier-up of Name, even if
+    // its counter fires again before the stub is redirected.
+    auto It = TierBaselineIR.find(Name);
+    if (It == TierBaselineIR.end())
+      return;
+    Bitcode = std::move(It->second);
+    TierBaselineIR.erase(It);
+  }
+
+  auto Ctx = std::make_unique<LLVMContext>();
+  auto ModOrErr = parseBitcodeFile(MemoryBufferRef(Bitcode, Name), *Ctx);
+  if (!ModOrErr) {
+    fprintf(stderr, "Error: tier-up of '%s' failed: %s\n", Name.c_str(),
+            toString(ModOrErr.takeError()).c_str());
+    return;
+  }
+  std::unique_ptr<Module> M = std::move(*ModOrErr);
+
+  for (Function &F : *M)
+    if (F.getName() != Name && !F.isDeclaration() && !F.hasLocalLinkage())
+      F.deleteBody();
+  for (GlobalVariable &GV : M->globals()) {
+    if (GV.isDeclaration() || GV.hasLocalLinkage())
+      continue;
+    GV.setInitializer(nullptr);
+    GV.setLinkage(GlobalValue::ExternalLinkage);
+  }
+  RenameToTierBody(*M, Name, ".tier1");
+
+  LoopAnalysisManager LAM;
+  FunctionAnalysisManager FAM;
+  CGSCCAnalysisManager CGAM;
+  ModuleAnalysisManager MAM;
+  // Tune the hot tier for the target the JIT compiles for, as the baseline
+  // tier's pipeline is.
+  PassBuilder PB(GetTargetMachine());
+  PB.registerModuleAnalyses(MAM);
+  PB.registerCGSCCAnalyses(CGAM);
+  PB.registerFunctionAnalyses(FAM);
+  PB.registerLoopAnalyses(LAM);
+  PB.crossRegisterProxies(LAM, FAM, CGAM, MAM);
+  PB.buildPerModuleDefaultPipeline(OptimizationLevel::O3).run(*M, MAM);
+
+  auto TSM = ThreadSafeModule(std::move(M), std::move(Ctx));
+  if (auto Err = TheJIT->addModule(std::move(TSM))) {
+    fprintf(stderr, "Error: tier-up of '%s' failed: %s\n", Name.c_str(),
+            toString(std::move(Err)).c_str());
+    return;
+  }
+  if (auto Err = TheJIT->redirectFunction(Name, Name + ".tier1")) {
+    fprintf(stderr, "Error: tier-up of '%s' failed: %s\n", Name.c_str(),
+            toString(std::move(Err)).c_str());
+    return;
+  }
+  if (JITTierLog)
+    fprintf(stderr, "pyxc: tier-up: recompiled '%s' at -O3\n", Name.c_str());
+}
+
+// TierUpPool - Background thread for hot-tier recompiles. Declared after
+// TheJIT so it is destroyed (and drained) before the JIT at exit.
+static std::unique_ptr<DefaultThreadPool> TierUpPool;
+
+/// ScheduleTierUp - Queue Name for recompilation without blocking the caller.
+static void ScheduleTierUp(const char *Name) {
+  static std::once_flag PoolOnce;
+  std::call_once(PoolOnce, [] {
+    TierUpPool =
+        std::make_unique<DefaultThreadPool>(hardware_concurrency(1));
+  });
+  TierUpPool->async([N = string(Name)] { TierUpFunction(N); });
+}
+
+/// AddFunctionModuleToJIT - Hand TheModule, which defines FnIR, to the JIT and
+/// start a fresh module. Tiered functions are installed behind a redirectable
+/// stub so TierUpFunction can swap in the hot tier later.
+static void AddFunctionModuleToJIT(Function *FnIR) {
+  string Name = FnIR->getName().str();
+  bool Tiered = IsTieredFunction(Name);
+  if (Tiered)
+    RenameToTierBody(*TheModule, Name, ".tier0");
+
+  auto TSM = ThreadSafeModule(std::move(TheModule), std::move(TheContext));
+  if (Tiered)
+    ExitOnErr(
+        TheJIT->addRedirectableFunction(std::move(TSM), Name, Name + ".tier0"));
+  else
+    ExitOnErr(TheJIT->addModule(std::move(TSM)));
+  InitializeModuleAndManagers();
+}
+
 /// HandleDecorator - Parse a decorator line and the 'def' that follows it.
 ///
 /// Decorator syntax (note: decorator and 'def' must be on separate lines):
@@ -3895,8 +6546,12 @@ static void SynchronizeToLineBoundary() {
 ///   @unary
 ///   def opchar(x): ...
 ///
+///   @fastmath
+///   def name(args): ...
+///
 /// The '@' has already been consumed by MainLoop before calling here.
-/// CurTok is on 'binary' or 'unary'. Delegates to ParseDecoratedDef.
+/// CurTok is on 'binary', 'unary', or a function decorator name. Delegates to
+/// ParseDecoratedDef.
 static void HandleDecorator() {
   auto FnAST = ParseDecoratedDef();
   bool HasTrailing = (CurTok != tok_eol && CurTok != tok_eof);
@@ -3906,15 +6561,14 @@ static void HandleDecorator() {
     SynchronizeToLineBoundary();
     return;
   }
-  if (auto *FnIR = FnAST->codegen()) {
-    Log("Parsed a user-defined operator.\n");
+  bool IsOperator = FnAST->isOperator();
+  if (auto *FnIR = TimedCodegen(*FnAST)) {
+    Log(IsOperator ? "Parsed a user-defined operator.\n"
+                   : "Parsed a function definition.\n");
     if (ShouldDumpIR())
       FnIR->print(errs());
-    if (!IsEmitMode()) {
-      ExitOnErr(TheJIT->addModule(
-          ThreadSafeModule(std::move(TheModule), std::move(TheContext))));
-      InitializeModuleAndManagers();
-    }
+    if (!IsEmitMode())
+      AddFunctionModuleToJIT(FnIR);
   }
 }
 
@@ -3936,15 +6590,13 @@ static void HandleDefinition() {
     SynchronizeToLineBoundary();
     return;
   }
-  if (auto *FnIR = FnAST->codegen()) {
+  if (auto *FnIR = TimedCodegen(*FnAST)) {
     Log("Parsed a function definition.\n");
     if (ShouldDumpIR())
       FnIR->print(errs());
     if (!IsEmitMode()) {
       // Transfer the module to the JIT. TheModule is now invalid; reinitialise.
-      ExitOnErr(TheJIT->addModule(
-          ThreadSafeModule(std::move(TheModule), std::move(TheContext))));
-      InitializeModuleAndManagers();
+      AddFunctionModuleToJIT(FnIR);
     }
   }
 }
@@ -3982,7 +6634,7 @@ static void HandleExtern() {
     return;
   }
 
-  if (auto *FnIR = ProtoAST->codegen()) {
+  if (auto *FnIR = TimedCodegen(*ProtoAST)) {
     Log("Parsed an extern.\n");
     if (ShouldDumpIR())
       FnIR->print(errs());
@@ -3991,6 +6643,22 @@ static void HandleExtern() {
   }
 }
 
+/// RunJITFunction - Call a nullary JIT'd function, then flush the runtime's
+/// output buffer so the program's output precedes whatever pyxc prints next
+/// (the REPL result, an error, a prompt).
+template <typename RetT>
+static RetT RunJITFunction(const ExecutorSymbolDef &Symbol) {
+  auto *Fn = Symbol.toPtr<RetT (*)()>();
+  if constexpr (std::is_void_v<RetT>) {
+    Fn();
+    flushd();
+  } else {
+    RetT Result = Fn();
+    flushd();
+    return Result;
+  }
+}
+
 /// HandleTopLevelExpression - Compile, execute, and discard a bare expression.
 ///
 /// The expression is wrapped in '__anon_expr' (a zero-argument function that
@@ -4022,7 +6690,7 @@ static void HandleTopLevelExpression() {
   ValueType RetType = FnAST->getReturnType();
   bool SavedInGlobalInit = InGlobalInit;
   InGlobalInit = true;
-  if (auto *FnIR = FnAST->codegen()) {
+  if (auto *FnIR = TimedCodegen(*FnAST)) {
     InGlobalInit = SavedInGlobalInit;
     Log("Parsed a top-level expression.\n");
     if (ShouldDumpIR())
@@ -4048,63 +6716,62 @@ static void HandleTopLevelExpression() {
       // Locate the compiled function in the JIT's symbol table.
       auto ExprSymbol = ExitOnErr(TheJIT->lookup(FnName));
 
+      // ParseTopLevelExpr gives vector expressions a None result.
+      assert(!IsVectorType(RetType) && "no printer for vector results");
       if (RetType == ValueType::None) {
-        void (*FP)() = ExprSymbol.toPtr<void (*)()>();
-        FP();
+        RunJITFunction<void>(ExprSymbol);
       } else {
         switch (RetType) {
         case ValueType::Float64: {
-          double (*FP)() = ExprSymbol.toPtr<double (*)()>();
-          double result = FP();
+          double result = RunJITFunction<double>(ExprSymbol);
           if (IsRepl && LastTopLevelShouldPrint)
             fprintf(stderr, "%f\n", result);
           break;
         }
         case ValueType::Float32: {
-          float (*FP)() = ExprSymbol.toPtr<float (*)()>();
-          double result = static_cast<double>(FP());
+          double result =
+              static_cast<double>(RunJITFunction<float>(ExprSymbol));
           if (IsRepl && LastTopLevelShouldPrint)
             fprintf(stderr, "%f\n", result);
           break;
         }
         case ValueType::Int: {
-          intptr_t (*FP)() = ExprSymbol.toPtr<intptr_t (*)()>();
-          long long result = static_cast<long long>(FP());
+          long long result =
+              static_cast<long long>(RunJITFunction<intptr_t>(ExprSymbol));
           if (IsRepl && LastTopLevelShouldPrint)
             fprintf(stderr, "%lld\n", result);
           break;
         }
         case ValueType::Int8: {
-          int8_t (*FP)() = ExprSymbol.toPtr<int8_t (*)()>();
-          long long result = static_cast<long long>(FP());
+          long long result =
+              static_cast<long long>(RunJITFunction<int8_t>(ExprSymbol));
           if (IsRepl && LastTopLevelShouldPrint)
             fprintf(stderr, "%lld\n", result);
           break;
         }
         case ValueType::Int16: {
-          int16_t (*FP)() = ExprSymbol.toPtr<int16_t (*)()>();
-          long long result = static_cast<long long>(FP());
+          long long result =
+              static_cast<long long>(RunJITFunction<int16_t>(ExprSymbol));
           if (IsRepl && LastTopLevelShouldPrint)
             fprintf(stderr, "%lld\n", result);
           break;
         }
         case ValueType::Int32: {
-          int32_t (*FP)() = ExprSymbol.toPtr<int32_t (*)()>();
-          long long result = static_cast<long long>(FP());
+          long long result =
+              static_cast<long long>(RunJITFunction<int32_t>(ExprSymbol));
           if (IsRepl && LastTopLevelShouldPrint)
             fprintf(stderr, "%lld\n", result);
           break;
         }
         case ValueType::Int64: {
-          int64_t (*FP)() = ExprSymbol.toPtr<int64_t (*)()>();
-          long long result = static_cast<long long>(FP());
+          long long result =
+              static_cast<long long>(RunJITFunction<int64_t>(ExprSymbol));
           if (IsRepl && LastTopLevelShouldPrint)
             fprintf(stderr, "%lld\n", result);
           break;
         }
         case ValueType::Bool: {
-          bool (*FP)() = ExprSymbol.toPtr<bool (*)()>();
-          bool result = FP();
+          bool result = RunJITFunction<bool>(ExprSymbol);
           if (IsRepl && LastTopLevelShouldPrint)
             fprintf(stderr, "%s\n", result ? "True" : "False");
           break;
@@ -4121,63 +6788,60 @@ static void HandleTopLevelExpression() {
 
     // Keep-module path: call the compiled function after adding the module.
     auto ExprSymbol = ExitOnErr(TheJIT->lookup(FnName));
+    assert(!IsVectorType(RetType) && "no printer for vector results");
     if (RetType == ValueType::None) {
-      void (*FP)() = ExprSymbol.toPtr<void (*)()>();
-      FP();
+      RunJITFunction<void>(ExprSymbol);
     } else {
       switch (RetType) {
       case ValueType::Float64: {
-        double (*FP)() = ExprSymbol.toPtr<double (*)()>();
-        double result = FP();
+        double result = RunJITFunction<double>(ExprSymbol);
         if (IsRepl && LastTopLevelShouldPrint)
           fprintf(stderr, "%f\n", result);
         break;
       }
       case ValueType::Float32: {
-        float (*FP)() = ExprSymbol.toPtr<float (*)()>();
-        double result = static_cast<double>(FP());
+        double result = static_cast<double>(RunJITFunction<float>(ExprSymbol));
         if (IsRepl && LastTopLevelShouldPrint)
           fprintf(stderr, "%f\n", result);
         break;
       }
       case ValueType::Int: {
-        intptr_t (*FP)() = ExprSymbol.toPtr<intptr_t (*)()>();
-        long long result = static_cast<long long>(FP());
+        long long result =
+            static_cast<long long>(RunJITFunction<intptr_t>(ExprSymbol));
         if (IsRepl && LastTopLevelShouldPrint)
           fprintf(stderr, "%lld\n", result);
         break;
       }
       case ValueType::Int8: {
-        int8_t (*FP)() = ExprSymbol.toPtr<int8_t (*)()>();
-        long long result = static_cast<long long>(FP());
+        long long result =
+            static_cast<long long>(RunJITFunction<int8_t>(ExprSymbol));
         if (IsRepl && LastTopLevelShouldPrint)
           fprintf(stderr, "%lld\n", result);
         break;
       }
       case ValueType::Int16: {
-        int16_t (*FP)() = ExprSymbol.toPtr<int16_t (*)()>();
-        long long result = static_cast<long long>(FP());
+        long long result =
+            static_cast<long long>(RunJITFunction<int16_t>(ExprSymbol));
         if (IsRepl && LastTopLevelShouldPrint)
           fprintf(stderr, "%lld\n", result);
         break;
       }
       case ValueType::Int32: {
-        int32_t (*FP)() = ExprSymbol.toPtr<int32_t (*)()>();
-        long long result = static_cast<long long>(FP());
+        long long result =
+            static_cast<long long>(RunJITFunction<int32_t>(ExprSymbol));
         if (IsRepl && LastTopLevelShouldPrint)
           fprintf(stderr, "%lld\n", result);
         break;
       }
       case ValueType::Int64: {
-        int64_t (*FP)() = ExprSymbol.toPtr<int64_t (*)()>();
-        long long result = static_cast<long long>(FP());
+        long long result =
+            static_cast<long long>(RunJITFunction<int64_t>(ExprSymbol));
         if (IsRepl && LastTopLevelShouldPrint)
           fprintf(stderr, "%lld\n", result);
         break;
       }
       case ValueType::Bool: {
-        bool (*FP)() = ExprSymbol.toPtr<bool (*)()>();
-        bool result = FP();
+        bool result = RunJITFunction<bool>(ExprSymbol);
         if (IsRepl && LastTopLevelShouldPrint)
           fprintf(stderr, "%s\n", result ? "True" : "False");
         break;
@@ -4212,9 +6876,12 @@ static void HandleTopLevelStatementFileMode() {
 // Runtime library — callable via 'extern def'
 //===----------------------------------------===//
 
-// These functions are compiled into the pyxc binary itself and exported with
-// C linkage so the JIT can resolve 'extern def putchard(x)' and
-// 'extern def printd(x)' against them at runtime.
+// putchard, printd, and flushd live in code/runtime/runtime.c, which is
+// linked into the pyxc binary and exported with C linkage so the JIT can
+// resolve 'extern def printd(x)' and friends against them at runtime. The
+// same file is the runtime object of --emit exe executables (see
+// GetRuntimeObject). In the JIT its buffered output goes to stderr and is
+// flushed after every call into JIT'd code (RunJITFunction).
 //
 // DLLEXPORT is required on Windows where symbols are not exported by default.
 // On macOS/Linux it is a no-op — all extern "C" symbols are visible.
@@ -4225,17 +6892,10 @@ static void HandleTopLevelStatementFileMode() {
 #define DLLEXPORT
 #endif
 
-/// putchard - Write a single ASCII character to stderr. The double argument
-/// is truncated to char. Returns 0.0 so it can be used as an expression.
-extern "C" DLLEXPORT double putchard(double X) {
-  fputc((char)X, stderr);
-  return 0;
-}
-
-/// printd - Print a double to stderr as "%f\n". Returns 0.0.
-extern "C" DLLEXPORT double printd(double X) {
-  fprintf(stderr, "%f\n", X);
-  return 0;
+/// __pyxc_tier_up - Called by a --jit-tiered function's counter when it turns
+/// hot. Returns immediately; the recompile happens in the background.
+extern "C" DLLEXPORT void __pyxc_tier_up(const char *Name) {
+  ScheduleTierUp(Name);
 }
 
 /// MainLoop - Dispatch loop for the REPL.
@@ -4256,6 +6916,11 @@ extern "C" DLLEXPORT double printd(double X) {
 /// next CurTok.
 static void MainLoop() {
   while (true) {
+    // Every Handle* call below destroys its AST before returning. Release
+    // the arena between items so a long session's memory stays bounded;
+    // ResetASTArena asserts that no node survived.
+    ResetASTArena();
+
     if (CurTok == tok_eof)
       return;
 
@@ -4307,6 +6972,7 @@ static void MainLoop() {
 /// In file mode we do not execute top-level statements immediately. They are
 /// collected into FileTopLevelStmts and later emitted into __pyxc.global_init.
 static void FileModeLoop() {
+  TimeRegion Region(PhaseTimer(&PhaseTimers::Frontend));
   while (true) {
     if (CurTok == tok_eof)
       return;
@@ -4361,7 +7027,7 @@ static void RunFileMode() {
 
     bool SavedInGlobalInit = InGlobalInit;
     InGlobalInit = true;
-    if (auto *FnIR = FnAST->codegen()) {
+    if (auto *FnIR = TimedCodegen(*FnAST)) {
       InGlobalInit = SavedInGlobalInit;
       if (ShouldDumpIR())
         FnIR->print(errs());
@@ -4370,9 +7036,13 @@ static void RunFileMode() {
       ExitOnErr(TheJIT->addModule(std::move(TSM)));
       InitializeModuleAndManagers();
 
-      auto InitSymbol = ExitOnErr(TheJIT->lookup("__pyxc.global_init"));
-      void (*InitFn)() = InitSymbol.toPtr<void (*)()>();
-      InitFn();
+      ExecutorSymbolDef InitSymbol;
+      {
+        TimeRegion Region(PhaseTimer(&PhaseTimers::JIT));
+        InitSymbol = ExitOnErr(TheJIT->lookup("__pyxc.global_init"));
+      }
+      TimeRegion Region(PhaseTimer(&PhaseTimers::Run));
+      RunJITFunction<void>(InitSymbol);
     } else {
       InGlobalInit = SavedInGlobalInit;
       return;
@@ -4395,14 +7065,16 @@ static void RunFileMode() {
     return;
   }
 
-  auto MainSymbol = ExitOnErr(TheJIT->lookup("main"));
-  if (IsIntType(MainIt->second->getReturnType())) {
-    int (*MainFn)() = MainSymbol.toPtr<int (*)()>();
-    MainFn();
-  } else {
-    void (*MainFn)() = MainSymbol.toPtr<void (*)()>();
-    MainFn();
+  ExecutorSymbolDef MainSymbol;
+  {
+    TimeRegion Region(PhaseTimer(&PhaseTimers::JIT));
+    MainSymbol = ExitOnErr(TheJIT->lookup("main"));
   }
+  TimeRegion Region(PhaseTimer(&PhaseTimers::Run));
+  if (IsIntType(MainIt->second->getReturnType()))
+    RunJITFunction<int>(MainSymbol);
+  else
+    RunJITFunction<void>(MainSymbol);
 }
 
 /// AddGlobalCtor - Register a function to run before main() via
@@ -4426,7 +7098,8 @@ static void AddGlobalCtor(Function *Fn, int Priority = 65535) {
                      "llvm.global_ctors");
 }
 
-/// CreateTargetMachine - Build a TargetMachine for the host triple.
+/// CreateTargetMachine - Build a TargetMachine for the host triple, using the
+/// --mcpu/--mattr settings and the backend opt level for -O.
 static std::unique_ptr<TargetMachine> CreateTargetMachine() {
   string TargetTriple = sys::getDefaultTargetTriple();
   Triple TT(TargetTriple);
@@ -4439,15 +7112,42 @@ static std::unique_ptr<TargetMachine> CreateTargetMachine() {
   }
 
   TargetOptions Options;
+  Options.AllowFPOpFusion = GetFPOpFusionMode();
   auto RM = std::optional<Reloc::Model>();
-  return std::unique_ptr<TargetMachine>(
-      Target->createTargetMachine(TT, "generic", "", Options, RM));
+  return std::unique_ptr<TargetMachine>(Target->createTargetMachine(
+      TT, GetTargetCPU(), GetTargetFeatures().getString(), Options, RM,
+      std::nullopt, GetCodeGenOptLevel()));
+}
+
+/// GetTargetMachine - This thread's TargetMachine, created on first use. In
+/// --emit mode it is the one that emits code; when running under the JIT it
+/// is a copy of the JIT's, used only to tune the optimisation pipeline. A
+/// TargetMachine may not be used by two threads at once, but one thread can
+/// handle any number of modules with it, so each -j, --codegen-threads and
+/// tier-up worker builds one and reuses it. Null if the host target is
+/// unavailable (the error has been reported).
+static TargetMachine *GetTargetMachine() {
+  static thread_local std::unique_ptr<TargetMachine> TM;
+  if (TM)
+    return TM.get();
+  if (TheJIT) {
+    auto TMOrErr = TheJIT->createTargetMachine();
+    if (!TMOrErr) {
+      fprintf(stderr, "Error: %s\n", toString(TMOrErr.takeError()).c_str());
+      return nullptr;
+    }
+    TM = std::move(*TMOrErr);
+  } else {
+    TM = CreateTargetMachine();
+  }
+  return TM.get();
 }
 
 /// EmitModuleToFile - Write the module to the requested path in the given
 /// format.
 static bool EmitModuleToFile(Module *M, EmitKind Kind,
                              const string &OutputPath) {
+  TimeRegion Region(PhaseTimer(&PhaseTimers::Emit));
   FinalizeDebugInfo();
   std::error_code EC;
   raw_fd_ostream Dest(OutputPath, EC, sys::fs::OF_None);
@@ -4462,19 +7162,34 @@ static bool EmitModuleToFile(Module *M, EmitKind Kind,
     return true;
   }
 
-  auto TM = CreateTargetMachine();
+  TargetMachine *TM = GetTargetMachine();
   if (!TM)
     return false;
 
   M->setTargetTriple(TM->getTargetTriple());
   M->setDataLayout(TM->createDataLayout());
 
+  // -gsplit-dwarf: the backend writes the .dwo sections to their own file.
+  // The TargetMachine is reused, so the option is set for every module.
+  std::unique_ptr<raw_fd_ostream> DwoDest;
+  TM->Options.MCOptions.SplitDwarfFile.clear();
+  if (!SplitDwarfFile.empty() && Kind == EmitKind::OBJ) {
+    TM->Options.MCOptions.SplitDwarfFile = SplitDwarfFile;
+    DwoDest = std::make_unique<raw_fd_ostream>(SplitDwarfFile, EC,
+                                               sys::fs::OF_None);
+    if (EC) {
+      fprintf(stderr, "Error: could not open output file '%s'\n",
+              SplitDwarfFile.c_str());
+      return false;
+    }
+  }
+
   legacy::PassManager PM;
   CodeGenFileType FileType = (Kind == EmitKind::ASM)
                                  ? CodeGenFileType::AssemblyFile
                                  : CodeGenFileType::ObjectFile;
 
-  if (TM->addPassesToEmitFile(PM, Dest, nullptr, FileType)) {
+  if (TM->addPassesToEmitFile(PM, Dest, DwoDest.get(), FileType)) {
     fprintf(stderr, "Error: target does not support file emission\n");
     return false;
   }
@@ -4483,23 +7198,154 @@ static bool EmitModuleToFile(Module *M, EmitKind Kind,
   return true;
 }
 
+/// EmitModuleBitcode - Write the module as a link-time optimization input.
+///
+/// The file keeps the .o name of a normal object; lld recognises bitcode by
+/// its magic, runs the LTO pipeline over all bitcode inputs together, and
+/// generates code once at the end. Full LTO writes plain bitcode, which lld
+/// merges into a single module. Thin LTO adds the per-module summary lld uses
+/// to import functions from other modules before code-generating each module
+/// in parallel. lld's code generator takes the CPU and features from each
+/// function's target-cpu and target-features attributes (see
+/// PrototypeAST::codegen).
+static bool EmitModuleBitcode(Module *M, const string &OutputPath) {
+  TimeRegion Region(PhaseTimer(&PhaseTimers::Emit));
+  FinalizeDebugInfo();
+  std::error_code EC;
+  raw_fd_ostream Dest(OutputPath, EC, sys::fs::OF_None);
+  if (EC) {
+    fprintf(stderr, "Error: could not open output file '%s'\n",
+            OutputPath.c_str());
+    return false;
+  }
+
+  TargetMachine *TM = GetTargetMachine();
+  if (!TM)
+    return false;
+
+  M->setTargetTriple(TM->getTargetTriple());
+  M->setDataLayout(TM->createDataLayout());
+
+  if (LTOMode == LTOKind::Thin) {
+    ModulePassManager MPM;
+    MPM.addPass(ThinLTOBitcodeWriterPass(Dest, nullptr));
+    MPM.run(*M, *TheMAM);
+  } else {
+    WriteBitcodeToFile(*M, Dest);
+  }
+  return true;
+}
+
+/// CodegenPartitions - How many objects each --emit exe input is compiled
+/// to: --codegen-threads, except under --lto, where lld generates the code
+/// (and partitions it itself; see LinkExecutable).
+static unsigned CodegenPartitions() {
+  return LTOMode == LTOKind::None ? static_cast<unsigned>(CodegenThreads) : 1;
+}
+
+/// EmitPartitionObject - Generate native code for one SplitModule partition,
+/// given as bitcode, into OutputPath. Runs on a codegen pool thread.
+static bool EmitPartitionObject(StringRef Bitcode, const string &OutputPath) {
+  LLVMContext Context;
+  auto PartOrErr =
+      parseBitcodeFile(MemoryBufferRef(Bitcode, OutputPath), Context);
+  if (!PartOrErr) {
+    fprintf(stderr, "Error: %s\n", toString(PartOrErr.takeError()).c_str());
+    return false;
+  }
+
+  std::error_code EC;
+  raw_fd_ostream Dest(OutputPath, EC, sys::fs::OF_None);
+  if (EC) {
+    fprintf(stderr, "Error: could not open output file '%s'\n",
+            OutputPath.c_str());
+    return false;
+  }
+
+  TargetMachine *TM = GetTargetMachine();
+  if (!TM)
+    return false;
+
+  legacy::PassManager PM;
+  if (TM->addPassesToEmitFile(PM, Dest, nullptr,
+                              CodeGenFileType::ObjectFile)) {
+    fprintf(stderr, "Error: target does not support file emission\n");
+    return false;
+  }
+  PM.run(**PartOrErr);
+  return true;
+}
+
+/// EmitModulePartitions - Write the optimized module as one object per
+/// OutputPaths entry, generating code for the pieces in parallel.
+///
+/// This is the scheme lld uses for parallel LTO code generation: SplitModule
+/// partitions the functions and globals, each partition is written out as
+/// bitcode, and each is read back into its own LLVMContext on a pool thread,
+/// because an LLVMContext (which every partition would otherwise share with
+/// M) must not be used by two threads at once. Local symbols are kept in the
+/// partition of their users rather than promoted to globals, so internal
+/// symbols such as each input's __pyxc.global_init never clash. Partitions
+/// depend only on the module and the count, so the objects are reproducible
+/// and can be cached.
+static bool EmitModulePartitions(Module *M, const vector<string> &OutputPaths) {
+  TimeRegion Region(PhaseTimer(&PhaseTimers::Emit));
+  FinalizeDebugInfo();
+  TargetMachine *TM = GetTargetMachine();
+  if (!TM)
+    return false;
+
+  M->setTargetTriple(TM->getTargetTriple());
+  M->setDataLayout(TM->createDataLayout());
+
+  vector<SmallString<0>> Partitions;
+  SplitModule(
+      *M, OutputPaths.size(),
+      [&](std::unique_ptr<Module> Part) {
+        Partitions.emplace_back();
+        raw_svector_ostream OS(Partitions.back());
+        WriteBitcodeToFile(*Part, OS);
+      },
+      /*PreserveLocals=*/true);
+
+  vector<char> Succeeded(OutputPaths.size(), false);
+  DefaultThreadPool Pool(hardware_concurrency(OutputPaths.size()));
+  for (size_t I = 0; I < OutputPaths.size(); ++I)
+    Pool.async([&, I] {
+      Succeeded[I] = EmitPartitionObject(Partitions[I], OutputPaths[I]);
+    });
+  Pool.wait();
+
+  return all_of(Succeeded, [](char Ok) { return Ok; });
+}
+
 static bool PrepareFileModeModule();
 
+/// OpenInputFile - Load Path into InputBuffer for the lexer.
+///
+/// MemoryBuffer maps the file when it is large enough to be worth it, so big
+/// generated sources are lexed in place with no per-character stdio calls
+/// and no copy of each line (see SourceManager).
 static bool OpenInputFile(const string &Path) {
-  Input = fopen(Path.c_str(), "r");
-  if (!Input) {
-    perror(Path.c_str());
+  auto BufOrErr = MemoryBuffer::getFile(Path, /*IsText=*/false,
+                                        /*RequiresNullTerminator=*/false);
+  if (!BufOrErr) {
+    fprintf(stderr, "%s: %s\n", Path.c_str(),
+            BufOrErr.getError().message().c_str());
     return false;
   }
+  InputBuffer = std::move(*BufOrErr);
+  InputCur = InputBuffer->getBufferStart();
+  InputEnd = InputBuffer->getBufferEnd();
   CurrentSourcePath = Path;
+  BeginPhaseTimers(Path);
   return true;
 }
 
 static void CloseInputFile() {
-  if (Input && Input != stdin) {
-    fclose(Input);
-    Input = stdin;
-  }
+  PyxcSourceMgr.reset();
+  InputBuffer.reset();
+  InputCur = InputEnd = nullptr;
 }
 
 static bool EndsWithInsensitive(StringRef Path, StringRef Suffix) {
@@ -4526,54 +7372,77 @@ static string DefaultExeOutputPath(StringRef InputPath) {
   return OutStr;
 }
 
-static bool EmitRuntimeObject(const string &ObjPath) {
-  LLVMContext Ctx;
-  auto M = std::make_unique<Module>("pyxc.runtime", Ctx);
-
-  auto *DoubleType = Type::getDoubleTy(Ctx);
-  auto *Int32Type = Type::getInt32Ty(Ctx);
-  auto *CharPtrType = PointerType::get(Ctx, 0);
+/// SplitDwarfPath - The .dwo that -gsplit-dwarf writes for SourcePath: the
+/// object's name with a .dwo extension for --emit obj, and
+/// "<exe>-<source stem>.dwo" for --emit exe, as clang names them. Inputs that
+/// share a stem (a/x.pyxc and b/x.pyxc) would overwrite each other's .dwo, so
+/// those get their position on the command line as well:
+/// "<exe>-<stem>.<index>.dwo". The path is made absolute because debuggers
+/// find it through the skeleton unit in the linked binary, whose compile
+/// directory is the source's.
+static string SplitDwarfPath(StringRef SourcePath) {
+  SmallString<256> Path;
+  if (EmitMode == EmitKind::OBJ) {
+    Path = EmitOutputPath;
+    sys::path::replace_extension(Path, "dwo");
+  } else {
+    Path = EmitOutputPath.empty() ? DefaultExeOutputPath(InputFiles.front())
+                                  : EmitOutputPath;
+    StringRef Stem = sys::path::stem(SourcePath);
+    Path += "-";
+    Path += Stem;
+    unsigned SameStem = 0;
+    int Index = -1;
+    for (unsigned I = 0, E = InputFiles.size(); I != E; ++I) {
+      if (sys::path::stem(InputFiles[I]) != Stem)
+        continue;
+      ++SameStem;
+      if (Index < 0 && InputFiles[I] == SourcePath)
+        Index = I;
+    }
+    if (SameStem > 1)
+      Path += "." + itostr(Index);
+    Path += ".dwo";
+  }
+  sys::fs::make_absolute(Path);
+  return Path.str().str();
+}
 
-  FunctionType *PrintfType = FunctionType::get(Int32Type, {CharPtrType}, true);
-  Function *Printf = Function::Create(PrintfType, Function::ExternalLinkage,
-                                      "printf", M.get());
+// PyxcRuntimeObject - The compiled code/runtime/runtime.c object for the host
+// target, embedded at build time (see CMakeLists.txt).
+#include "PyxcRuntimeObject.inc"
 
-  FunctionType *PutcharType = FunctionType::get(Int32Type, {Int32Type}, false);
-  Function *Putchar = Function::Create(PutcharType, Function::ExternalLinkage,
-                                       "putchar", M.get());
+// PYXC_BUILD_ID - A hash of pyxc's sources, generated at build time (see
+// BuildId.cmake).
+#include "PyxcBuildId.inc"
 
-  FunctionType *PrintdType = FunctionType::get(DoubleType, {DoubleType}, false);
-  Function *Printd = Function::Create(PrintdType, Function::ExternalLinkage,
-                                      "printd", M.get());
-  {
-    BasicBlock *BB = BasicBlock::Create(Ctx, "entry", Printd);
-    IRBuilder<> B(BB);
-    auto *FmtGV = B.CreateGlobalString("%f\n", "fmt");
-    Value *Zero = ConstantInt::get(Int32Type, 0);
-    Value *Fmt = B.CreateInBoundsGEP(FmtGV->getValueType(), FmtGV, {Zero, Zero},
-                                     "fmt_ptr");
-    Value *Arg = Printd->getArg(0);
-    B.CreateCall(Printf, {Fmt, Arg});
-    B.CreateRet(ConstantFP::get(Ctx, APFloat(0.0)));
-  }
-
-  FunctionType *PutchardType =
-      FunctionType::get(DoubleType, {DoubleType}, false);
-  Function *Putchard = Function::Create(PutchardType, Function::ExternalLinkage,
-                                        "putchard", M.get());
-  {
-    BasicBlock *BB = BasicBlock::Create(Ctx, "entry", Putchard);
-    IRBuilder<> B(BB);
-    Value *Arg = Putchard->getArg(0);
-    Value *Ch = B.CreateFPToUI(Arg, Int32Type, "ch");
-    B.CreateCall(Putchar, {Ch});
-    B.CreateRet(ConstantFP::get(Ctx, APFloat(0.0)));
+/// EmitRuntimeObject - Write the runtime object (putchard/printd/flushd) that
+/// --emit exe links into every executable. It is the same code the JIT calls.
+static bool EmitRuntimeObject(const string &ObjPath) {
+  std::error_code EC;
+  raw_fd_ostream Dest(ObjPath, EC, sys::fs::OF_None);
+  if (EC) {
+    fprintf(stderr, "Error: could not open output file '%s'\n",
+            ObjPath.c_str());
+    return false;
   }
-
-  return EmitModuleToFile(M.get(), EmitKind::OBJ, ObjPath);
+  Dest.write(reinterpret_cast<const char *>(PyxcRuntimeObject),
+             sizeof(PyxcRuntimeObject));
+  Dest.close();
+  if (Dest.has_error()) {
+    fprintf(stderr, "Error: could not write runtime object '%s': %s\n",
+            ObjPath.c_str(), Dest.error().message().c_str());
+    Dest.clear_error();
+    sys::fs::remove(ObjPath);
+    return false;
+  }
+  return true;
 }
 
-static bool CompileFileToObject(const string &Path, const string &ObjPath,
+/// CompileFileToObject - Compile one .pyxc file to ObjPaths.size() objects
+/// (one per --codegen-threads partition; normally just one).
+static bool CompileFileToObject(const string &Path,
+                                const vector<string> &ObjPaths,
                                 bool *HasMain) {
   if (!OpenInputFile(Path))
     return false;
@@ -4582,7 +7451,6 @@ static bool CompileFileToObject(const string &Path, const string &ObjPath,
   ResetParserStateForFile();
   InitializeModuleAndManagers(false);
 
-  IsRepl = false;
   PrintReplPrompt();
   getNextToken();
 
@@ -4598,7 +7466,280 @@ static bool CompileFileToObject(const string &Path, const string &ObjPath,
     return false;
 
   RunModuleOptimizations(TheModule.get());
-  return EmitModuleToFile(TheModule.get(), EmitKind::OBJ, ObjPath);
+  if (LTOMode != LTOKind::None)
+    return EmitModuleBitcode(TheModule.get(), ObjPaths.front());
+  if (ObjPaths.size() > 1)
+    return EmitModulePartitions(TheModule.get(), ObjPaths);
+  return EmitModuleToFile(TheModule.get(), EmitKind::OBJ, ObjPaths.front());
+}
+
+//===----------------------------------------===//
+// Object cache (--cache-dir)
+//===----------------------------------------===//
+
+// Hit/miss counters for --cache-stats. Atomic because -j compiles files on
+// several threads at once.
+static std::atomic<unsigned> ObjectCacheHits{0};
+static std::atomic<unsigned> ObjectCacheMisses{0};
+
+/// CacheKeyHasher - SHA-256 over a sequence of fields, used to build cache
+/// keys. Fields are NUL-separated so adjacent fields cannot run together.
+struct CacheKeyHasher {
+  SHA256 Hasher;
+
+  void add(StringRef Field) {
+    Hasher.update(Field);
+    Hasher.update(StringRef("\0", 1));
+  }
+
+  /// addCodegenIdentity - Add the compiler build, target, and backend flags
+  /// that every cached object depends on.
+  void addCodegenIdentity() {
+    add(LLVM_VERSION_STRING);
+    // A changed pyxc may generate different code; never reuse its objects.
+    add(PYXC_BUILD_ID);
+    add(sys::getDefaultTargetTriple());
+    add(GetTargetCPU());
+    add(GetTargetFeatures().getString());
+    add("O" + utostr(OptLevel));
+    add(FastMath ? "ffast-math" : "");
+    add("ffp-contract=" + utostr(static_cast<unsigned>(FPContract)));
+  }
+
+  string finish() { return toHex(Hasher.final(), /*LowerCase=*/true); }
+};
+
+/// ComputeObjectCacheKey - Hash everything that affects the object emitted for
+/// one source file and return it as a hex SHA-256 digest.
+///
+/// Each .pyxc file is compiled in isolation (ResetParserStateForFile), so the
+/// key only needs the file's own bytes plus the codegen flags, the target
+/// triple, and the compiler build. Debug info embeds the source path, so the
+/// path is part of the key only with -g. --lto stores bitcode rather than
+/// native code, so the LTO mode is part of the key too, as are the
+/// --codegen-threads partition count, the PGO mode, the contents of the
+/// --profile-use profile and of the --interface files, and --instrument.
+static string ComputeObjectCacheKey(StringRef Source, StringRef SourcePath) {
+  CacheKeyHasher Key;
+  Key.add("pyxc-object-cache-v1");
+  Key.addCodegenIdentity();
+  Key.add("lto=" + LTOModeOpt);
+  Key.add("codegen-threads=" + utostr(CodegenPartitions()));
+  Key.add(IsProfileGenerate() ? "profile-generate=" + ProfileGenerate : "");
+  Key.add(ProfileUseHash);
+  Key.add(InterfaceHash);
+  Key.add(IsInstrumentCalls() ? "instrument=calls" : "");
+  Key.add(DebugInfo ? "g" : "");
+  Key.add(DebugInfo ? SourcePath : "");
+  Key.add(LineTablesOnly ? "gline-tables-only" : "");
+  // The skeleton unit names the .dwo.
+  Key.add(SplitDwarf ? "gsplit-dwarf=" + SplitDwarfPath(SourcePath) : "");
+  Key.add(Source);
+  return Key.finish();
+}
+
+/// ComputeJITCacheKey - Hash everything that affects the objects the JIT
+/// builds when running one script: the codegen flags, the JIT modes that
+/// change the IR it is given, and the script itself. The key is combined
+/// with each module's name by PyxcObjectCache.
+static string ComputeJITCacheKey(StringRef Source, StringRef SourcePath) {
+  CacheKeyHasher Key;
+  Key.add("pyxc-jit-cache-v1");
+  Key.addCodegenIdentity();
+  Key.add(ProfileUseHash);
+  Key.add(IsInstrumentCalls() ? "instrument=calls" : "");
+  Key.add(JITLazy ? "jit-lazy" : "");
+  Key.add(JITTiered ? "jit-tier-threshold=" + utostr(JITTierThreshold) : "");
+  Key.add(DebugInfo ? "g" : "");
+  Key.add(DebugInfo ? SourcePath : "");
+  Key.add(LineTablesOnly ? "gline-tables-only" : "");
+  Key.add(Source);
+  return Key.finish();
+}
+
+/// WriteFileAtomically - Write Contents to Path through a unique temporary in
+/// the same directory followed by a rename, so concurrent pyxc processes that
+/// share a cache never observe a partially written file.
+static bool WriteFileAtomically(const Twine &Path, StringRef Contents) {
+  int FD = -1;
+  SmallString<256> TmpPath;
+  if (sys::fs::createUniqueFile(Path + ".tmp-%%%%%%", FD, TmpPath))
+    return false;
+
+  raw_fd_ostream OS(FD, /*shouldClose=*/true);
+  OS << Contents;
+  OS.close();
+  if (OS.has_error()) {
+    OS.clear_error();
+    sys::fs::remove(TmpPath);
+    return false;
+  }
+
+  if (sys::fs::rename(TmpPath, Path)) {
+    sys::fs::remove(TmpPath);
+    return false;
+  }
+  return true;
+}
+
+/// CachedObjectPath - The cache file for partition Part of the entry Key.
+static SmallString<256> CachedObjectPath(StringRef Key, size_t Part) {
+  SmallString<256> Path(CacheDir.getValue());
+  sys::path::append(Path, Part == 0 ? Key + ".o"
+                                    : Key + "." + utostr(Part) + ".o");
+  return Path;
+}
+
+/// CachedDwoPath - The cache file for the -gsplit-dwarf .dwo of entry Key.
+static SmallString<256> CachedDwoPath(StringRef Key) {
+  SmallString<256> Path(CacheDir.getValue());
+  sys::path::append(Path, Key + ".dwo");
+  return Path;
+}
+
+/// StoreInObjectCache - Copy freshly compiled objects, and the current
+/// input's .dwo under -gsplit-dwarf, into the cache.
+///
+/// The objects are stored first and the .meta file last; a present .meta file
+/// marks a complete entry. Failures are silent — the cache is best-effort and
+/// the build already has its objects.
+static void StoreInObjectCache(const vector<string> &ObjPaths, StringRef Key,
+                               StringRef CachedMeta, bool HasMain) {
+  if (sys::fs::create_directories(CacheDir))
+    return;
+  for (size_t Part = 0; Part < ObjPaths.size(); ++Part) {
+    auto ObjOrErr = MemoryBuffer::getFile(ObjPaths[Part]);
+    if (!ObjOrErr)
+      return;
+    if (!WriteFileAtomically(CachedObjectPath(Key, Part),
+                             (*ObjOrErr)->getBuffer()))
+      return;
+  }
+  if (!SplitDwarfFile.empty()) {
+    auto DwoOrErr = MemoryBuffer::getFile(SplitDwarfFile);
+    if (!DwoOrErr ||
+        !WriteFileAtomically(CachedDwoPath(Key), (*DwoOrErr)->getBuffer()))
+      return;
+  }
+  WriteFileAtomically(CachedMeta, HasMain ? "main=1\n" : "main=0\n");
+}
+
+/// CompileFileToObjectCached - CompileFileToObject behind the --cache-dir
+/// object cache.
+///
+/// A cache entry is <key>.o plus <key>.meta, with <key>.1.o, <key>.2.o, ...
+/// holding the other --codegen-threads partitions (the partition count is
+/// part of the key). The .meta file records whether the source defines
+/// main(), which EmitExecutable needs even when nothing is re-parsed.
+/// --dump-ir bypasses the cache because a hit would print nothing.
+static bool CompileFileToObjectCached(const string &Path,
+                                      const vector<string> &ObjPaths,
+                                      bool *HasMain) {
+  SplitDwarfFile = SplitDwarf ? SplitDwarfPath(Path) : "";
+  if (CacheDir.empty() || ShouldDumpIR())
+    return CompileFileToObject(Path, ObjPaths, HasMain);
+
+  // An unreadable source is reported by the normal compile path.
+  auto SourceOrErr = MemoryBuffer::getFile(Path);
+  if (!SourceOrErr)
+    return CompileFileToObject(Path, ObjPaths, HasMain);
+
+  string Key = ComputeObjectCacheKey((*SourceOrErr)->getBuffer(), Path);
+  SmallString<256> CachedMeta(CacheDir.getValue());
+  sys::path::append(CachedMeta, Key + ".meta");
+
+  if (auto MetaOrErr = MemoryBuffer::getFile(CachedMeta)) {
+    bool CopiedAll = true;
+    for (size_t Part = 0; CopiedAll && Part < ObjPaths.size(); ++Part)
+      CopiedAll = !sys::fs::copy_file(CachedObjectPath(Key, Part),
+                                      ObjPaths[Part]);
+    if (CopiedAll && !SplitDwarfFile.empty())
+      CopiedAll = !sys::fs::copy_file(CachedDwoPath(Key), SplitDwarfFile);
+    if (CopiedAll) {
+      ++ObjectCacheHits;
+      if (HasMain)
+        *HasMain = (*MetaOrErr)->getBuffer().trim() == "main=1";
+      return true;
+    }
+  }
+
+  ++ObjectCacheMisses;
+  bool FileHasMain = false;
+  if (!CompileFileToObject(Path, ObjPaths, &FileHasMain))
+    return false;
+  if (HasMain)
+    *HasMain = FileHasMain;
+  StoreInObjectCache(ObjPaths, Key, CachedMeta, FileHasMain);
+  return true;
+}
+
+/// GetRuntimeObject - Return the path of the prebuilt runtime object
+/// (printd/putchard/flushd) for the current target.
+///
+/// Without --cache-dir the object is written to a fresh private temporary,
+/// which is added to TempFiles and removed after linking. With --cache-dir
+/// one copy, keyed by a hash of the embedded object itself, is kept there and
+/// reused by every later link, after checking it is complete. It is written
+/// to a unique temporary and renamed into place, so parallel builds racing to
+/// create it are harmless.
+static bool GetRuntimeObject(string &RuntimePath, vector<string> &TempFiles) {
+  const char *Bytes = reinterpret_cast<const char *>(PyxcRuntimeObject);
+  const uint64_t Size = sizeof(PyxcRuntimeObject);
+
+  if (CacheDir.empty()) {
+    int FD = -1;
+    SmallString<128> TmpPath;
+    if (auto EC =
+            sys::fs::createTemporaryFile("pyxc-runtime", "o", FD, TmpPath)) {
+      fprintf(stderr, "Error: could not create temporary file: %s\n",
+              EC.message().c_str());
+      return false;
+    }
+    close(FD);
+    RuntimePath = TmpPath.str().str();
+    TempFiles.push_back(RuntimePath);
+    return EmitRuntimeObject(RuntimePath);
+  }
+
+  CacheKeyHasher Key;
+  Key.add("pyxc-runtime-v3");
+  Key.add(StringRef(Bytes, Size));
+
+  SmallString<256> Path(CacheDir.getValue());
+  if (std::error_code EC = sys::fs::create_directories(Path)) {
+    fprintf(stderr, "Error: could not create cache directory '%s': %s\n",
+            CacheDir.c_str(), EC.message().c_str());
+    return false;
+  }
+  sys::path::append(Path, "pyxc-runtime-" + Key.finish() + ".o");
+  RuntimePath = Path.str().str();
+
+  // A cached copy cut short (a full disk, say) is replaced below.
+  uint64_t CachedSize = 0;
+  if (!sys::fs::file_size(RuntimePath, CachedSize) && CachedSize == Size)
+    return true;
+
+  int FD = -1;
+  SmallString<256> TmpPath;
+  if (auto EC = sys::fs::createUniqueFile(RuntimePath + ".tmp-%%%%%%", FD,
+                                          TmpPath)) {
+    fprintf(stderr, "Error: could not create runtime object: %s\n",
+            EC.message().c_str());
+    return false;
+  }
+  close(FD);
+
+  if (!EmitRuntimeObject(TmpPath.str().str())) {
+    sys::fs::remove(TmpPath);
+    return false;
+  }
+  if (auto EC = sys::fs::rename(TmpPath, RuntimePath)) {
+    sys::fs::remove(TmpPath);
+    fprintf(stderr, "Error: could not create runtime object: %s\n",
+            EC.message().c_str());
+    return false;
+  }
+  return true;
 }
 
 static string FindMacOSSDKRoot() {
@@ -4653,8 +7794,25 @@ static void MaybeEmitDsymBundle(const string &ExePath) {
   }
 }
 
+/// LTOJobsArg - Value for lld's thin-LTO backend thread count, following -j.
+static string LTOJobsArg() {
+  return JobCount == 0 ? string("all") : utostr(JobCount);
+}
+
+/// GetProfileRuntimePath - The compiler-rt profile runtime that writes the
+/// .profraw file for --profile-generate executables, located at configure
+/// time (see CMakeLists.txt). Empty if it was not found.
+static string GetProfileRuntimePath() {
+#ifdef PYXC_PROFILE_RUNTIME
+  return PYXC_PROFILE_RUNTIME;
+#else
+  return "";
+#endif
+}
+
 static bool LinkExecutable(const vector<string> &Inputs,
                            const string &OutputPath) {
+  TimeRegion Region(PhaseTimer(&PhaseTimers::Link));
   Triple TT(sys::getDefaultTargetTriple());
   vector<string> ArgStorage;
   auto PushArg = [&](const string &Arg) { ArgStorage.push_back(Arg); };
@@ -4665,6 +7823,10 @@ static bool LinkExecutable(const vector<string> &Inputs,
     PushArg(TT.getArchName().str());
     PushArg("-o");
     PushArg(OutputPath);
+    if (LTOMode != LTOKind::None) {
+      PushArg("--lto-O" + utostr(OptLevel));
+      PushArg("--thinlto-jobs=" + LTOJobsArg());
+    }
 
     string SDKRoot = FindMacOSSDKRoot();
     if (!SDKRoot.empty()) {
@@ -4687,6 +7849,8 @@ static bool LinkExecutable(const vector<string> &Inputs,
         PushArg(Crti);
       for (const auto &Input : Inputs)
         PushArg(Input);
+      if (IsProfileGenerate())
+        PushArg(GetProfileRuntimePath());
       if (sys::fs::exists(Crtn)) {
         PushArg("-lSystem");
         PushArg(Crtn);
@@ -4696,6 +7860,8 @@ static bool LinkExecutable(const vector<string> &Inputs,
     } else {
       for (const auto &Input : Inputs)
         PushArg(Input);
+      if (IsProfileGenerate())
+        PushArg(GetProfileRuntimePath());
       PushArg("-lSystem");
     }
 
@@ -4710,8 +7876,23 @@ static bool LinkExecutable(const vector<string> &Inputs,
     PushArg("ld.lld");
     PushArg("-o");
     PushArg(OutputPath);
+    if (LTOMode != LTOKind::None) {
+      PushArg("--lto-O" + utostr(OptLevel));
+      PushArg("--lto-CGO" + utostr(OptLevel));
+      PushArg("--thinlto-jobs=" + LTOJobsArg());
+      PushArg("--lto-partitions=" + utostr(CodegenThreads));
+    }
     for (const auto &Input : Inputs)
       PushArg(Input);
+    if (IsProfileGenerate()) {
+      // The runtime registers its atexit writer from __llvm_profile_runtime;
+      // force it in, as the instrumented objects do not reference it on ELF.
+      PushArg("-u");
+      PushArg("__llvm_profile_runtime");
+      PushArg(GetProfileRuntimePath());
+    }
+    // The runtime's @parallel worker pool uses POSIX threads.
+    PushArg("-lpthread");
     PushArg("-lc");
     PushArg("-lm");
     vector<const char *> Args;
@@ -4724,8 +7905,17 @@ static bool LinkExecutable(const vector<string> &Inputs,
   if (TT.isOSWindows()) {
     PushArg("lld-link");
     PushArg("/OUT:" + OutputPath);
+    if (LTOMode != LTOKind::None) {
+      PushArg("/opt:lldlto=" + utostr(OptLevel));
+      PushArg("/opt:lldltojobs=" + LTOJobsArg());
+      PushArg("/opt:lldltopartitions=" + utostr(CodegenThreads));
+    }
     for (const auto &Input : Inputs)
       PushArg(Input);
+    if (IsProfileGenerate()) {
+      PushArg("/INCLUDE:__llvm_profile_runtime");
+      PushArg(GetProfileRuntimePath());
+    }
     vector<const char *> Args;
     Args.reserve(ArgStorage.size());
     for (auto &Arg : ArgStorage)
@@ -4737,28 +7927,150 @@ static bool LinkExecutable(const vector<string> &Inputs,
   return false;
 }
 
+/// CollectReachedGlobals - Add to Globals every global F reads or writes,
+/// directly or through the functions it calls that are defined here.
+///
+/// Functions defined elsewhere cannot name this file's globals, but they can
+/// call back into its exported functions, so they are not followed; instead
+/// CallsExternal is set if F reaches one.
+static void CollectReachedGlobals(Function &F,
+                                  SmallPtrSetImpl<GlobalVariable *> &Globals,
+                                  SmallPtrSetImpl<Function *> &Visited,
+                                  bool &CallsExternal) {
+  if (!Visited.insert(&F).second)
+    return;
+  if (F.isDeclaration()) {
+    if (!F.isIntrinsic())
+      CallsExternal = true;
+    return;
+  }
+  for (BasicBlock &BB : F)
+    for (Instruction &I : BB)
+      for (Value *Op : I.operands()) {
+        if (auto *GV = dyn_cast<GlobalVariable>(Op))
+          Globals.insert(GV);
+        else if (auto *Callee = dyn_cast<Function>(Op))
+          CollectReachedGlobals(*Callee, Globals, Visited, CallsExternal);
+      }
+}
+
+/// EmitGlobalInit - Lower the file's top-level statements, evaluating at
+/// compile time the ones that can be, and register the rest to run before
+/// main() as __pyxc.global_init.
+///
+/// Each statement is emitted as its own internal function and, in source
+/// order, run through LLVM's static-constructor Evaluator: a statement with no
+/// external calls, loops or other effects it cannot model becomes the
+/// initializers of the globals it stores to, and is dropped. Evaluating a
+/// statement moves it ahead of those left to run at startup, so it is only
+/// tried when none of them can reach a global it reaches; a forward reference
+/// from a startup statement therefore still reads zero. A startup statement
+/// that calls a function defined elsewhere may, through it, run any function
+/// this file exports, so from then on every global those reach counts as
+/// reached at startup too. When nothing is left, no constructor is emitted.
+///
+/// Afterwards, a global that nothing in the module stores to is marked
+/// constant so later loads of it fold. Globals are only visible to the pyxc
+/// code of their own file, so the module is the whole program for them.
+static bool EmitGlobalInit() {
+  vector<Function *> Stmts;
+  bool SavedInGlobalInit = InGlobalInit;
+  InGlobalInit = true;
+  for (size_t I = 0; I < FileTopLevelStmts.size(); ++I) {
+    auto Proto = make_unique<PrototypeAST>(
+        "__pyxc.global_init." + to_string(I),
+        vector<pair<string, ValueType>>(), SourceLocation{1, 1},
+        ValueType::None);
+    auto FnAST = make_unique<FunctionAST>(std::move(Proto),
+                                          std::move(FileTopLevelStmts[I]));
+    Function *F = FnAST->codegen();
+    FunctionProtos.erase("__pyxc.global_init." + to_string(I));
+    if (!F) {
+      InGlobalInit = SavedInGlobalInit;
+      return false;
+    }
+    F->setLinkage(GlobalValue::InternalLinkage);
+    Stmts.push_back(F);
+  }
+  InGlobalInit = SavedInGlobalInit;
+  FileTopLevelStmts.clear();
+
+  // The module's triple is the target's (see InitializeModuleAndManagers),
+  // so the Evaluator knows which library calls the target provides.
+  TargetLibraryInfoImpl TLII(Triple(TheModule->getTargetTriple()));
+  TargetLibraryInfo TLI(TLII);
+  SmallPtrSet<GlobalVariable *, 16> Deferred; // reached at startup
+  bool DeferredExported = false;
+  vector<Function *> Kept;
+  for (Function *F : Stmts) {
+    SmallPtrSet<GlobalVariable *, 8> Reached;
+    SmallPtrSet<Function *, 8> Visited;
+    bool CallsExternal = false;
+    CollectReachedGlobals(*F, Reached, Visited, CallsExternal);
+    bool ReachesDeferred =
+        any_of(Reached, [&](GlobalVariable *GV) { return Deferred.count(GV); });
+    if (!ReachesDeferred) {
+      Evaluator Eval(TheModule->getDataLayout(), &TLI);
+      Constant *RetVal = nullptr;
+      SmallVector<Constant *, 0> NoArgs;
+      if (Eval.EvaluateFunction(F, RetVal, NoArgs)) {
+        for (auto &[GV, Init] : Eval.getMutatedInitializers())
+          GV->setInitializer(Init);
+        F->eraseFromParent();
+        continue;
+      }
+    }
+    Deferred.insert(Reached.begin(), Reached.end());
+    Kept.push_back(F);
+    if (CallsExternal && !DeferredExported) {
+      DeferredExported = true;
+      bool Ignored = false;
+      for (Function &Exported : *TheModule)
+        if (!Exported.hasLocalLinkage())
+          CollectReachedGlobals(Exported, Deferred, Visited, Ignored);
+    }
+  }
+
+  for (GlobalVariable &GV : TheModule->globals()) {
+    if (GV.isDeclaration() || GV.hasAppendingLinkage())
+      continue;
+    bool Written = any_of(GV.users(), [&](User *U) {
+      auto *Load = dyn_cast<LoadInst>(U);
+      return !Load || Load->getPointerOperand() != &GV;
+    });
+    if (!Written)
+      GV.setConstant(true);
+  }
+
+  if (Kept.empty())
+    return true;
+  FunctionType *FT = FunctionType::get(Type::getVoidTy(*TheContext), false);
+  // Internal: llvm.global_ctors is its only user, and every input of an
+  // --emit exe build has one of its own.
+  Function *Init = Function::Create(FT, Function::InternalLinkage,
+                                    "__pyxc.global_init", TheModule.get());
+  AddTargetAttributes(Init);
+  IRBuilder<> TmpB(BasicBlock::Create(*TheContext, "entry", Init));
+  for (Function *F : Kept)
+    TmpB.CreateCall(F);
+  TmpB.CreateRetVoid();
+  if (ShouldDumpIR()) {
+    for (Function *F : Kept)
+      F->print(errs());
+    Init->print(errs());
+  }
+  AddGlobalCtor(Init);
+  return true;
+}
+
 /// PrepareFileModeModule - Build __pyxc.global_init and main wrapper.
 ///
 /// Returns false on error (e.g., invalid main signature).
 static bool PrepareFileModeModule() {
   if (!FileTopLevelStmts.empty()) {
-    auto Block = make_unique<BlockExprAST>(std::move(FileTopLevelStmts));
-    auto Proto = make_unique<PrototypeAST>(
-        "__pyxc.global_init", vector<pair<string, ValueType>>(),
-        SourceLocation{1, 1}, ValueType::None);
-    auto FnAST = make_unique<FunctionAST>(std::move(Proto), std::move(Block));
-
-    bool SavedInGlobalInit = InGlobalInit;
-    InGlobalInit = true;
-    if (auto *FnIR = FnAST->codegen()) {
-      InGlobalInit = SavedInGlobalInit;
-      if (ShouldDumpIR())
-        FnIR->print(errs());
-      AddGlobalCtor(FnIR);
-    } else {
-      InGlobalInit = SavedInGlobalInit;
+    NestedPhase Phase(&PhaseTimers::Codegen);
+    if (!EmitGlobalInit())
       return false;
-    }
   }
 
   auto MainIt = FunctionProtos.find("main");
@@ -4784,6 +8096,7 @@ static bool PrepareFileModeModule() {
     FunctionType *FT = FunctionType::get(Type::getInt32Ty(*TheContext), false);
     Function *Wrapper = Function::Create(FT, Function::ExternalLinkage, "main",
                                          TheModule.get());
+    AddTargetAttributes(Wrapper);
     BasicBlock *BB = BasicBlock::Create(*TheContext, "entry", Wrapper);
     IRBuilder<> TmpB(BB);
     if (UserMain->getReturnType()->isIntegerTy(32)) {
@@ -4802,16 +8115,66 @@ static bool PrepareFileModeModule() {
 static void EmitFileMode() {
   if (HadError)
     return;
+  if (EmitMode == EmitKind::Interface) {
+    if (!EmitInterface(EmitOutputPath))
+      HadError = true;
+    return;
+  }
   if (!PrepareFileModeModule())
     return;
   RunModuleOptimizations(TheModule.get());
   EmitModuleToFile(TheModule.get(), EmitMode, EmitOutputPath);
 }
 
+/// CompileJob - One .pyxc input of an --emit exe build and its object files
+/// (one per --codegen-threads partition).
+struct CompileJob {
+  string SourcePath;
+  vector<string> ObjPaths;
+  bool HasMain = false;
+  bool Succeeded = false;
+};
+
+/// RunCompileJobs - Compile every job to its object file.
+///
+/// With -j 1 (the default) jobs run in order on the calling thread and stop at
+/// the first failure. Otherwise each job runs on a pool thread; because all
+/// lexer, parser, and codegen state is thread_local, every file gets its own
+/// LLVMContext, Module, and parser tables. Results are written back into the
+/// job slots, so the caller sees them in command-line order regardless of
+/// which thread finishes first.
+static bool RunCompileJobs(vector<CompileJob> &Jobs) {
+  if (JobCount == 1 || Jobs.size() < 2) {
+    for (auto &Job : Jobs) {
+      Job.Succeeded = CompileFileToObjectCached(Job.SourcePath, Job.ObjPaths,
+                                                &Job.HasMain);
+      if (!Job.Succeeded)
+        return false;
+    }
+    return true;
+  }
+
+  DefaultThreadPool Pool(hardware_concurrency(JobCount));
+  for (auto &Job : Jobs)
+    Pool.async([&Job] {
+      Job.Succeeded = CompileFileToObjectCached(Job.SourcePath, Job.ObjPaths,
+                                                &Job.HasMain);
+    });
+  Pool.wait();
+
+  return all_of(Jobs, [](const CompileJob &Job) { return Job.Succeeded; });
+}
+
 /// EmitExecutable - Compile inputs to objects and link them into an executable.
+///
+/// Object paths are assigned up front in command-line order, so the link line
+/// is deterministic even when the .pyxc inputs are compiled in parallel. With
+/// --codegen-threads each .pyxc input contributes one object per partition,
+/// which lld links together like any other objects.
 static bool EmitExecutable() {
   vector<string> ObjectFiles;
   vector<string> TempFiles;
+  vector<CompileJob> Jobs;
   bool SawMain = false;
   bool SawObjectInput = false;
 
@@ -4822,27 +8185,27 @@ static bool EmitExecutable() {
 
   for (const auto &InputPath : InputFiles) {
     if (IsPyxcInput(InputPath)) {
-      int FD = -1;
-      SmallString<128> TmpPath;
-      if (auto EC = sys::fs::createTemporaryFile("pyxc", "o", FD, TmpPath)) {
-        fprintf(stderr, "Error: could not create temporary file: %s\n",
-                EC.message().c_str());
-        CleanupTemps();
-        return false;
-      }
-      if (FD != -1)
-        close(FD);
-
-      string ObjPath = TmpPath.str().str();
-      TempFiles.push_back(ObjPath);
+      CompileJob Job;
+      Job.SourcePath = InputPath;
+      for (unsigned Part = 0; Part < CodegenPartitions(); ++Part) {
+        int FD = -1;
+        SmallString<128> TmpPath;
+        if (auto EC =
+                sys::fs::createTemporaryFile("pyxc", "o", FD, TmpPath)) {
+          fprintf(stderr, "Error: could not create temporary file: %s\n",
+                  EC.message().c_str());
+          CleanupTemps();
+          return false;
+        }
+        if (FD != -1)
+          close(FD);
 
-      bool FileHasMain = false;
-      if (!CompileFileToObject(InputPath, ObjPath, &FileHasMain)) {
-        CleanupTemps();
-        return false;
+        string ObjPath = TmpPath.str().str();
+        TempFiles.push_back(ObjPath);
+        Job.ObjPaths.push_back(ObjPath);
+        ObjectFiles.push_back(ObjPath);
       }
-      SawMain = SawMain || FileHasMain;
-      ObjectFiles.push_back(ObjPath);
+      Jobs.push_back(std::move(Job));
       continue;
     }
 
@@ -4857,27 +8220,31 @@ static bool EmitExecutable() {
     return false;
   }
 
-  if (!SawMain && !SawObjectInput) {
-    fprintf(stderr, "Error: main() not found\n");
+  bool CompiledAll = RunCompileJobs(Jobs);
+  if (CacheStats && !CacheDir.empty())
+    fprintf(stderr, "pyxc: object cache: %u hit(s), %u miss(es)\n",
+            ObjectCacheHits.load(), ObjectCacheMisses.load());
+  if (!CompiledAll) {
     CleanupTemps();
     return false;
   }
+  for (const auto &Job : Jobs)
+    SawMain = SawMain || Job.HasMain;
 
-  int RuntimeFD = -1;
-  SmallString<128> RuntimeObj;
-  if (auto EC = sys::fs::createTemporaryFile("pyxc_runtime", "o", RuntimeFD,
-                                             RuntimeObj)) {
-    fprintf(stderr, "Error: could not create runtime object: %s\n",
-            EC.message().c_str());
+  if (!SawMain && !SawObjectInput) {
+    fprintf(stderr, "Error: main() not found\n");
     CleanupTemps();
     return false;
   }
-  if (RuntimeFD != -1)
-    close(RuntimeFD);
 
-  string RuntimePath = RuntimeObj.str().str();
-  TempFiles.push_back(RuntimePath);
-  if (!EmitRuntimeObject(RuntimePath)) {
+  // Emitting the runtime object (on a cache miss) and linking are timed as
+  // their own group rather than under the last input file.
+  BeginPhaseTimers("link");
+
+  // GetRuntimeObject adds the runtime object to TempFiles unless it comes
+  // from --cache-dir.
+  string RuntimePath;
+  if (!GetRuntimeObject(RuntimePath, TempFiles)) {
     CleanupTemps();
     return false;
   }
@@ -4907,11 +8274,38 @@ static bool EmitExecutable() {
 /// Returns 0 on success, -1 on error (e.g. the file could not be opened). When
 /// no file is given, Input stays as stdin and IsRepl is set to true.
 int ProcessCommandLine(int argc, const char **argv) {
+  // Show the shared target flags in --help next to pyxc's own options.
+  auto &Registered = cl::getRegisteredOptions();
+  for (const char *Name : {"mcpu", "mattr", "march"})
+    if (auto *Opt = Registered.lookup(Name))
+      Opt->addCategory(PyxcCategory);
   cl::HideUnrelatedOptions(PyxcCategory);
   cl::ParseCommandLineOptions(argc, argv, "pyxc\n");
 
-  if (DebugInfo && OptLevel.getNumOccurrences() == 0)
-    OptLevel = 0;
+  // Every server request carries its own flags (see ServeRequest), so the
+  // server itself accepts none that would leak into them.
+  if (!ServerSocket.empty()) {
+#ifdef _WIN32
+    fprintf(stderr, "Error: --server is not supported on Windows\n");
+    return -1;
+#endif
+    bool HasOtherOptions = !InputFiles.empty();
+    for (auto &Entry : Registered)
+      if (Entry.second != &ServerSocket &&
+          Entry.second != &ServerIdleTimeout &&
+          Entry.second->getNumOccurrences())
+        HasOtherOptions = true;
+    if (HasOtherOptions) {
+      fprintf(stderr, "Error: --server takes no inputs or compile options; "
+                      "each request carries its own\n");
+      return -1;
+    }
+    return 0;
+  }
+
+  // None of the -g flags changes the -O level, which defaults to -O0.
+  if (LineTablesOnly || SplitDwarf)
+    DebugInfo = true;
 
   if (OptLevel > 3) {
     fprintf(stderr, "Error: -O level must be 0, 1, 2, or 3\n");
@@ -4920,6 +8314,11 @@ int ProcessCommandLine(int argc, const char **argv) {
 
   IsRepl = InputFiles.empty();
 
+  if (LexOnly && (IsRepl || !EmitKindOpt.empty())) {
+    fprintf(stderr, "Error: --lex-only requires file inputs and no --emit\n");
+    return -1;
+  }
+
   if (!EmitKindOpt.empty()) {
     if (IsRepl) {
       fprintf(stderr, "Error: --emit requires a file input\n");
@@ -4947,6 +8346,13 @@ int ProcessCommandLine(int argc, const char **argv) {
         return -1;
       }
       EmitOutputPath = OutputFile.empty() ? "out.o" : OutputFile.getValue();
+    } else if (EmitKindOpt == "interface") {
+      EmitMode = EmitKind::Interface;
+      if (InputFiles.size() != 1) {
+        fprintf(stderr, "Error: --emit requires a single input file\n");
+        return -1;
+      }
+      EmitOutputPath = OutputFile.empty() ? "out.pyxi" : OutputFile.getValue();
     } else if (EmitKindOpt == "exe") {
       EmitMode = EmitKind::EXE;
       if (OutputFile.empty() && InputFiles.size() > 1) {
@@ -4968,6 +8374,130 @@ int ProcessCommandLine(int argc, const char **argv) {
     return -1;
   }
 
+  if (FPContractOpt == "off") {
+    FPContract = FPContractKind::Off;
+  } else if (FPContractOpt == "on") {
+    FPContract = FPContractKind::On;
+  } else if (FPContractOpt == "fast" ||
+             (FPContractOpt.empty() && FastMath)) {
+    FPContract = FPContractKind::Fast;
+  } else if (!FPContractOpt.empty()) {
+    fprintf(stderr, "Error: invalid -ffp-contract value '%s'\n",
+            FPContractOpt.c_str());
+    return -1;
+  }
+
+  if (IsProfileGenerate() || !ProfileUse.empty()) {
+    if (IsProfileGenerate() && !ProfileUse.empty()) {
+      fprintf(stderr,
+              "Error: --profile-generate and --profile-use are exclusive\n");
+      return -1;
+    }
+    if (OptLevel == 0) {
+      fprintf(stderr, "Error: profile-guided optimization requires -O1 or "
+                      "higher\n");
+      return -1;
+    }
+  }
+  if (IsProfileGenerate()) {
+    if (!IsEmitMode()) {
+      fprintf(stderr, "Error: --profile-generate requires --emit\n");
+      return -1;
+    }
+    if (EmitMode == EmitKind::EXE && GetProfileRuntimePath().empty()) {
+      fprintf(stderr, "Error: --profile-generate needs the LLVM profile "
+                      "runtime (libclang_rt.profile); reconfigure pyxc with "
+                      "-DPYXC_PROFILE_RUNTIME=<path>\n");
+      return -1;
+    }
+  }
+  if (!ProfileUse.empty()) {
+    auto ProfileOrErr = MemoryBuffer::getFile(ProfileUse);
+    if (!ProfileOrErr) {
+      fprintf(stderr, "Error: could not read profile '%s': %s\n",
+              ProfileUse.c_str(), ProfileOrErr.getError().message().c_str());
+      return -1;
+    }
+    ProfileUseHash = toHex(SHA256::hash(arrayRefFromStringRef(
+                               (*ProfileOrErr)->getBuffer())),
+                           /*LowerCase=*/true);
+  }
+
+  if (!Instrument.empty() && !IsInstrumentCalls()) {
+    fprintf(stderr, "Error: invalid --instrument value '%s'\n",
+            Instrument.c_str());
+    return -1;
+  }
+
+  if (JITTierThreshold == 0) {
+    fprintf(stderr, "Error: --jit-tier-threshold must be at least 1\n");
+    return -1;
+  }
+  if (JITLinker != "jitlink" && JITLinker != "rtdyld") {
+    fprintf(stderr, "Error: invalid --jit-linker value '%s'\n",
+            JITLinker.c_str());
+    return -1;
+  }
+
+  if (!codegen::getMArch().empty() && codegen::getMArch() != "native") {
+    fprintf(stderr,
+            "Error: -march only accepts 'native'; use --mcpu=<cpu> to choose "
+            "a CPU\n");
+    return -1;
+  }
+
+  if (!LTOModeOpt.empty()) {
+    if (LTOModeOpt == "full") {
+      LTOMode = LTOKind::Full;
+    } else if (LTOModeOpt == "thin") {
+      LTOMode = LTOKind::Thin;
+    } else {
+      fprintf(stderr, "Error: invalid --lto value '%s'\n",
+              LTOModeOpt.c_str());
+      return -1;
+    }
+    if (EmitMode != EmitKind::EXE) {
+      fprintf(stderr, "Error: --lto requires --emit exe\n");
+      return -1;
+    }
+  }
+
+  if (CodegenThreads == 0) {
+    fprintf(stderr, "Error: --codegen-threads must be at least 1\n");
+    return -1;
+  }
+  if (CodegenThreads > 1 && EmitMode != EmitKind::EXE) {
+    fprintf(stderr, "Error: --codegen-threads requires --emit exe\n");
+    return -1;
+  }
+
+  if (SplitDwarf) {
+    if (EmitMode != EmitKind::OBJ && EmitMode != EmitKind::EXE) {
+      fprintf(stderr, "Error: -gsplit-dwarf requires --emit obj or exe\n");
+      return -1;
+    }
+    if (!Triple(sys::getDefaultTargetTriple()).isOSBinFormatELF()) {
+      fprintf(stderr, "Error: -gsplit-dwarf requires an ELF target\n");
+      return -1;
+    }
+    // Both would write one .dwo per object rather than per input.
+    if (LTOMode != LTOKind::None || CodegenThreads > 1) {
+      fprintf(stderr, "Error: -gsplit-dwarf cannot be combined with --lto or "
+                      "--codegen-threads\n");
+      return -1;
+    }
+    if (EmitMode == EmitKind::OBJ)
+      SplitDwarfFile = SplitDwarfPath(InputFiles.front());
+  }
+
+  // The JIT cannot resolve functions that only an interface declares.
+  if (!Interfaces.empty() && !IsEmitMode()) {
+    fprintf(stderr, "Error: --interface requires --emit\n");
+    return -1;
+  }
+  if (!LoadInterfaces())
+    return -1;
+
   return 0;
 }
 
@@ -4975,35 +8505,74 @@ int ProcessCommandLine(int argc, const char **argv) {
 // Main driver code.
 //===----------------------------------------===//
 
-/// main - Entry point for the Pyxc compiler/REPL.
-///
-/// Initialises the LLVM native backend, creates the ORC JIT and an initial
-/// module, then hands control to MainLoop(). On exit, any open script file is
-/// closed.
-int main(int argc, const char **argv) {
-
-  int commandLineResult = ProcessCommandLine(argc, argv);
-  if (commandLineResult != 0) {
-    return commandLineResult;
+/// LexInputFiles - --lex-only: run every input file through the lexer and
+/// discard the tokens. Lexer errors are still reported.
+static int LexInputFiles() {
+  for (const string &Path : InputFiles) {
+    if (!OpenInputFile(Path))
+      return 1;
+    ResetLexerState();
+    {
+      TimeRegion Region(PhaseTimer(&PhaseTimers::Lex));
+      while (getNextToken() != tok_eof)
+        if (CurTok == tok_error)
+          HadError = true;
+    }
+    CloseInputFile();
   }
+  return HadError ? 1 : 0;
+}
 
-  // Initialise LLVM's backend for the host machine. These three calls
-  // register the native target's instruction set, assembler, and disassembler
-  // so both the JIT and the file-emission paths can generate code.
-  InitializeNativeTarget();
-  InitializeNativeTargetAsmPrinter();
-  InitializeNativeTargetAsmParser();
+/// RunCompiler - Run the REPL, a script, or an --emit job as configured by
+/// ProcessCommandLine.
+///
+/// Creates the ORC JIT (unless this is an --emit job, which never runs code)
+/// and an initial module, then hands control to MainLoop() or the file-mode
+/// driver. On exit, any open script file is closed. Skipping the JIT matters
+/// most for --server jobs, which are all --emit jobs.
+static int RunCompiler() {
+  // Print --time-report on every return path from here on.
+  auto ReportTimes = make_scope_exit(EmitTimeReport);
+
+  if (LexOnly)
+    return LexInputFiles();
 
   if (IsRepl || InputFiles.empty())
     CurrentSourcePath = "<stdin>";
   else
     CurrentSourcePath = InputFiles.front();
 
-  // Create the JIT first — InitializeModuleAndManagers() needs TheJIT in
-  // order to set the data layout on the new module.
-  TheJIT = ExitOnErr(PyxcJIT::Create());
+  // Create the JIT first — InitializeModuleAndManagers() takes the new
+  // module's triple and data layout from TheJIT when there is one.
+  if (!IsEmitMode()) {
+    PyxcJITOptions JITOpts;
+    JITOpts.Lazy = JITLazy;
+    JITOpts.NumCompileThreads = JITThreads;
+    JITOpts.RedirectableFunctions = JITTiered;
+    JITOpts.CPU = GetTargetCPU();
+    JITOpts.Features = GetTargetFeatures().getFeatures();
+    JITOpts.CodeGenLevel = GetCodeGenOptLevel();
+    JITOpts.FPOpFusion = GetFPOpFusionMode();
+    JITOpts.UseJITLink = JITLinker == "jitlink";
+    JITOpts.GDBRegistration = JITDebugger;
+    JITOpts.PerfSupport = JITPerf;
+    // Running a script with --cache-dir: keep the JIT's objects so the next
+    // run of the same script skips the backend. An unreadable script is
+    // reported by OpenInputFile below.
+    if (!IsRepl && !CacheDir.empty()) {
+      if (auto SourceOrErr = MemoryBuffer::getFile(InputFiles.front())) {
+        JITOpts.ObjectCacheDir = CacheDir;
+        JITOpts.ObjectCacheKey = ComputeJITCacheKey(
+            (*SourceOrErr)->getBuffer(), InputFiles.front());
+      }
+    }
+    TheJIT = ExitOnErr(PyxcJIT::Create(JITOpts));
+  }
   InitializeModuleAndManagers();
 
+  // JIT'd programs print to stderr, as in the earlier chapters.
+  __pyxc_set_output_fd(2);
+
   if (IsRepl) {
     PrintReplPrompt();
     getNextToken();
@@ -5032,6 +8601,11 @@ int main(int argc, const char **argv) {
       else
         RunFileMode();
 
+      if (CacheStats && TheJIT)
+        if (auto *Cache = TheJIT->getObjectCache())
+          fprintf(stderr, "pyxc: object cache: %u hit(s), %u miss(es)\n",
+                  Cache->getHits(), Cache->getMisses());
+
       CloseInputFile();
     }
   }
@@ -5040,3 +8614,329 @@ int main(int argc, const char **argv) {
     return 0;
   return HadError ? 1 : 0;
 }
+
+//===----------------------------------------===//
+// Compile server (--server)
+//===----------------------------------------===//
+
+#ifndef _WIN32
+
+/// ReadFully - Read exactly Len bytes from FD. False on EOF or error.
+static bool ReadFully(int FD, char *Buf, size_t Len) {
+  while (Len > 0) {
+    ssize_t N = read(FD, Buf, Len);
+    if (N < 0 && errno == EINTR)
+      continue;
+    if (N <= 0)
+      return false;
+    Buf += N;
+    Len -= static_cast<size_t>(N);
+  }
+  return true;
+}
+
+/// PeerUID - The user id of the process on the other end of Conn.
+static bool PeerUID(int Conn, uid_t &UID) {
+#ifdef SO_PEERCRED
+  ucred Cred;
+  socklen_t Len = sizeof(Cred);
+  if (getsockopt(Conn, SOL_SOCKET, SO_PEERCRED, &Cred, &Len) != 0)
+    return false;
+  UID = Cred.uid;
+  return true;
+#else
+  gid_t GID;
+  return getpeereid(Conn, &UID, &GID) == 0;
+#endif
+}
+
+/// ServeRequest - Run the request on connection Conn. Called in a forked
+/// child of the server; never returns.
+///
+/// The child takes over the client's stdin, stdout and stderr, so the job's
+/// diagnostics stream straight to the client's terminal or pipe, moves to
+/// the client's working directory, then parses the request's arguments as
+/// if they had been given on the command line and runs the normal driver.
+/// The server reports the exit status once the child is gone, so exit(),
+/// including cl::ParseCommandLineOptions' own, needs no special handling.
+///
+/// A job can write any file the server's user can, so connections from any
+/// other user are refused before the request is read.
+[[noreturn]] static void ServeRequest(int Conn) {
+  uid_t Client;
+  if (!PeerUID(Conn, Client) || Client != geteuid())
+    _exit(1);
+
+  uint32_t Len = 0;
+  int FDs[PYXC_SERVER_NUM_FDS];
+  alignas(cmsghdr) char Control[CMSG_SPACE(sizeof(FDs))];
+  iovec IOV = {&Len, sizeof(Len)};
+  msghdr Msg = {};
+  Msg.msg_iov = &IOV;
+  Msg.msg_iovlen = 1;
+  Msg.msg_control = Control;
+  Msg.msg_controllen = sizeof(Control);
+
+  ssize_t N;
+  do
+    N = recvmsg(Conn, &Msg, 0);
+  while (N < 0 && errno == EINTR);
+  cmsghdr *Header = N > 0 ? CMSG_FIRSTHDR(&Msg) : nullptr;
+  if (!Header || Header->cmsg_level != SOL_SOCKET ||
+      Header->cmsg_type != SCM_RIGHTS ||
+      Header->cmsg_len != CMSG_LEN(sizeof(FDs)))
+    _exit(1);
+  memcpy(FDs, CMSG_DATA(Header), sizeof(FDs));
+  for (int I = 0; I < PYXC_SERVER_NUM_FDS; ++I) {
+    if (FDs[I] == I)
+      continue;
+    dup2(FDs[I], I);
+    close(FDs[I]);
+  }
+
+  if (N < static_cast<ssize_t>(sizeof(Len)) &&
+      !ReadFully(Conn, reinterpret_cast<char *>(&Len) + N, sizeof(Len) - N))
+    exit(1);
+  if (Len > PYXC_SERVER_MAX_REQUEST) {
+    fprintf(stderr, "Error: pyxc server request is too large\n");
+    exit(1);
+  }
+  string Payload(Len, '\0');
+  if (!ReadFully(Conn, &Payload[0], Len))
+    exit(1);
+  close(Conn);
+
+  SmallVector<StringRef, 16> Fields;
+  StringRef(Payload).split(Fields, '\0');
+  if (!Fields.empty() && Fields.back().empty())
+    Fields.pop_back();
+  if (Fields.size() < 2 || Fields[0] != PYXC_SERVER_PROTOCOL) {
+    fprintf(stderr, "Error: pyxc-client and the pyxc server speak different "
+                    "protocols; rebuild them together\n");
+    exit(1);
+  }
+  if (chdir(Fields[1].str().c_str()) != 0) {
+    fprintf(stderr, "Error: could not enter '%s': %s\n",
+            Fields[1].str().c_str(), strerror(errno));
+    exit(1);
+  }
+
+  vector<string> Args = {"pyxc"};
+  for (StringRef Arg : ArrayRef<StringRef>(Fields).drop_front(2))
+    Args.push_back(Arg.str());
+  vector<const char *> Argv;
+  for (const string &Arg : Args)
+    Argv.push_back(Arg.c_str());
+
+  // The server's own --server flag must not carry over into the request.
+  cl::ResetAllOptionOccurrences();
+  int Result = ProcessCommandLine(static_cast<int>(Argv.size()), Argv.data());
+  if (Result == 0 && (!IsEmitMode() || !ServerSocket.empty())) {
+    fprintf(stderr, "Error: the pyxc server only runs --emit jobs\n");
+    Result = 1;
+  }
+  if (Result == 0)
+    Result = RunCompiler();
+  exit(Result);
+}
+
+// ServerSocketPath - The bound socket, for HandleServerStop. LLVM's
+// sys::fs::remove and RemoveFileOnSignal only delete regular files.
+static char ServerSocketPath[sizeof(sockaddr_un::sun_path)];
+
+/// HandleServerStop - Remove the socket when the server is interrupted or
+/// terminated, then die from the same signal.
+static void HandleServerStop(int Sig) {
+  unlink(ServerSocketPath);
+  signal(Sig, SIG_DFL);
+  raise(Sig);
+}
+
+// ChildExitPipe - Written by the SIGCHLD handler so the server's poll()
+// wakes up to report finished jobs.
+static int ChildExitPipe[2] = {-1, -1};
+
+static void HandleChildExit(int) {
+  int SavedErrno = errno;
+  char Byte = 0;
+  ssize_t Ignored = write(ChildExitPipe[1], &Byte, 1);
+  (void)Ignored;
+  errno = SavedErrno;
+}
+
+/// ReapJobs - Send the exit status of every finished job to its client.
+static void ReapJobs(std::map<pid_t, int> &Jobs) {
+  char Drain[64];
+  while (read(ChildExitPipe[0], Drain, sizeof(Drain)) > 0)
+    ;
+  int Status = 0;
+  pid_t Pid;
+  while ((Pid = waitpid(-1, &Status, WNOHANG)) > 0) {
+    auto It = Jobs.find(Pid);
+    if (It == Jobs.end())
+      continue;
+    int32_t ExitCode = WIFEXITED(Status) ? WEXITSTATUS(Status)
+                                         : 128 + WTERMSIG(Status);
+    ssize_t Ignored = write(It->second, &ExitCode, sizeof(ExitCode));
+    (void)Ignored;
+    close(It->second);
+    Jobs.erase(It);
+  }
+}
+
+/// RunServer - Serve pyxc-client requests on the --server socket until it
+/// has been idle for --server-idle-timeout seconds (forever by default).
+///
+/// Each connection is handled by a fork of this process (ServeRequest). The
+/// fork starts with everything a fresh pyxc would otherwise set up again —
+/// the loaded and relocated binary, LLVM's and lld's registered options,
+/// the initialised native target — and a job that crashes or calls exit()
+/// takes only itself down. Jobs run concurrently. The server is
+/// single-threaded, which keeps fork() safe.
+static int RunServer() {
+  sockaddr_un Addr = {};
+  Addr.sun_family = AF_UNIX;
+  if (ServerSocket.size() >= sizeof(Addr.sun_path)) {
+    fprintf(stderr, "Error: --server socket path is too long\n");
+    return 1;
+  }
+  memcpy(Addr.sun_path, ServerSocket.c_str(), ServerSocket.size() + 1);
+  memcpy(ServerSocketPath, Addr.sun_path, sizeof(ServerSocketPath));
+  auto *SockAddr = reinterpret_cast<sockaddr *>(&Addr);
+
+  // Replace a socket left behind by a server that died, but never take over
+  // a live one.
+  int Listen = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (Listen >= 0 && connect(Listen, SockAddr, sizeof(Addr)) == 0) {
+    fprintf(stderr, "Error: a pyxc server is already listening on '%s'\n",
+            ServerSocket.c_str());
+    close(Listen);
+    return 1;
+  }
+  if (Listen >= 0)
+    close(Listen);
+  unlink(ServerSocketPath);
+
+  // Only the server's user may connect: the socket is created 0600, with
+  // no window in which the umask's wider permissions apply.
+  Listen = socket(AF_UNIX, SOCK_STREAM, 0);
+  mode_t SavedMask = umask(077);
+  int Bound = Listen < 0 ? -1 : bind(Listen, SockAddr, sizeof(Addr));
+  umask(SavedMask);
+  if (Bound != 0 || chmod(ServerSocketPath, 0600) != 0 ||
+      listen(Listen, SOMAXCONN) != 0) {
+    fprintf(stderr, "Error: could not listen on '%s': %s\n",
+            ServerSocket.c_str(), strerror(errno));
+    return 1;
+  }
+  fcntl(Listen, F_SETFD, FD_CLOEXEC);
+  signal(SIGINT, HandleServerStop);
+  signal(SIGTERM, HandleServerStop);
+
+  if (pipe(ChildExitPipe) != 0) {
+    fprintf(stderr, "Error: could not start the server: %s\n",
+            strerror(errno));
+    return 1;
+  }
+  for (int FD : ChildExitPipe) {
+    fcntl(FD, F_SETFL, O_NONBLOCK);
+    fcntl(FD, F_SETFD, FD_CLOEXEC);
+  }
+  struct sigaction Action = {};
+  Action.sa_handler = HandleChildExit;
+  Action.sa_flags = SA_NOCLDSTOP;
+  sigaction(SIGCHLD, &Action, nullptr);
+  // A client that goes away must not kill the server when it is sent the
+  // exit status.
+  signal(SIGPIPE, SIG_IGN);
+
+  using Clock = std::chrono::steady_clock;
+  std::map<pid_t, int> Jobs;
+  Clock::time_point LastActivity = Clock::now();
+  for (;;) {
+    int TimeoutMs = -1;
+    if (ServerIdleTimeout > 0 && Jobs.empty()) {
+      auto Idle = std::chrono::duration_cast<std::chrono::milliseconds>(
+          Clock::now() - LastActivity);
+      long long Remaining = ServerIdleTimeout * 1000LL - Idle.count();
+      if (Remaining <= 0)
+        break;
+      TimeoutMs = static_cast<int>(Remaining);
+    }
+
+    pollfd Polled[2] = {{Listen, POLLIN, 0}, {ChildExitPipe[0], POLLIN, 0}};
+    if (poll(Polled, 2, TimeoutMs) < 0) {
+      if (errno == EINTR)
+        continue;
+      fprintf(stderr, "Error: pyxc server: %s\n", strerror(errno));
+      break;
+    }
+
+    if (Polled[1].revents) {
+      ReapJobs(Jobs);
+      LastActivity = Clock::now();
+    }
+    if (!(Polled[0].revents & POLLIN))
+      continue;
+
+    int Conn = accept(Listen, nullptr, nullptr);
+    if (Conn < 0)
+      continue;
+    LastActivity = Clock::now();
+    pid_t Pid = fork();
+    if (Pid == 0) {
+      // The job runs like an ordinary pyxc process: default signal
+      // handling, and none of the server's descriptors or files.
+      close(Listen);
+      close(ChildExitPipe[0]);
+      close(ChildExitPipe[1]);
+      for (auto &Job : Jobs)
+        close(Job.second);
+      signal(SIGCHLD, SIG_DFL);
+      signal(SIGPIPE, SIG_DFL);
+      signal(SIGINT, SIG_DFL);
+      signal(SIGTERM, SIG_DFL);
+      ServeRequest(Conn);
+    }
+    if (Pid < 0) {
+      int32_t ExitCode = 1;
+      ssize_t Ignored = write(Conn, &ExitCode, sizeof(ExitCode));
+      (void)Ignored;
+      close(Conn);
+      continue;
+    }
+    Jobs[Pid] = Conn;
+  }
+
+  close(Listen);
+  unlink(ServerSocketPath);
+  return 0;
+}
+
+#endif // _WIN32
+
+/// main - Entry point for the Pyxc compiler/REPL.
+///
+/// Parses the command line and initialises the LLVM native backend, then
+/// either runs the compiler or, with --server, serves pyxc-client requests.
+int main(int argc, const char **argv) {
+
+  int commandLineResult = ProcessCommandLine(argc, argv);
+  if (commandLineResult != 0) {
+    return commandLineResult;
+  }
+
+  // Initialise LLVM's backend for the host machine. These three calls
+  // register the native target's instruction set, assembler, and disassembler
+  // so both the JIT and the file-emission paths can generate code.
+  InitializeNativeTarget();
+  InitializeNativeTargetAsmPrinter();
+  InitializeNativeTargetAsmParser();
+
+#ifndef _WIN32
+  if (!ServerSocket.empty())
+    return RunServer();
+#endif
+
+  return RunCompiler();
+}
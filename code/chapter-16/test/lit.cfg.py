@@ -12,6 +12,10 @@ config.test_exec_root = config.test_source_root
 config.excludes = ["Inputs", "mandel.pyxc", "test.pyxc", "demo.pyxc"]
 
 chapter_dir = os.path.abspath(os.path.join(config.test_source_root, ".."))
+# %pyxc-client first: lit substitutes in order and %pyxc is its prefix.
+config.substitutions.append(
+    ("%pyxc-client", os.path.join(chapter_dir, "build", "pyxc-client"))
+)
 config.substitutions.append(("%pyxc", os.path.join(chapter_dir, "build", "pyxc")))
 
 # Ensure LLVM tools (FileCheck, llvm-dwarfdump, etc.) are on PATH.
@@ -33,10 +37,24 @@ dwarfdump = shutil.which("llvm-dwarfdump") or shutil.which("dwarfdump") or ""
 readelf = shutil.which("llvm-readelf") or shutil.which("readelf") or ""
 config.substitutions.append(("%dwarfdump", dwarfdump))
 config.substitutions.append(("%readelf", readelf))
+profdata = shutil.which("llvm-profdata") or ""
+config.substitutions.append(("%profdata", profdata))
 if dwarfdump:
   config.available_features.add("llvm-dwarfdump")
 if readelf:
   config.available_features.add("llvm-readelf")
+if profdata:
+  config.available_features.add("llvm-profdata")
+
+if os.name == "posix":
+  config.available_features.add("pyxc-server")
+
+# The counter --instrument=calls reads on this host: AArch64 user code may
+# not read the cycle counter.
+if platform.machine().lower() in ("arm64", "aarch64"):
+  config.substitutions.append(("%call_counter", "readsteadycounter"))
+else:
+  config.substitutions.append(("%call_counter", "readcyclecounter"))
 
 if platform.system() == "Darwin":
   config.available_features.add("system-darwin")
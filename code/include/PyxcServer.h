@@ -0,0 +1,32 @@
+/* PyxcServer.h — wire protocol between `pyxc --server` and pyxc-client.
+ *
+ * A request is sent on a Unix stream socket as:
+ *   - one message whose SCM_RIGHTS ancillary data carries the client's
+ *     stdin, stdout and stderr (PYXC_SERVER_NUM_FDS descriptors), and whose
+ *     data begins with a uint32_t payload length in native byte order (both
+ *     ends run on the same machine);
+ *   - the payload: NUL-terminated strings, namely PYXC_SERVER_PROTOCOL, the
+ *     client's working directory, then the pyxc arguments (without argv[0]).
+ *
+ * The server runs the job in a child process that writes diagnostics and
+ * output straight to the client's descriptors. When the child exits the
+ * server replies with an int32_t exit status (128 + N if the job was killed
+ * by signal N) and closes the connection.
+ *
+ * This header is shared by pyxc.cpp and tools/pyxc-client.c and must stay
+ * valid C.
+ */
+
+#ifndef PYXC_SERVER_H
+#define PYXC_SERVER_H
+
+/* Bump whenever the request or reply format changes. */
+#define PYXC_SERVER_PROTOCOL "pyxc-server-v1"
+
+#define PYXC_SERVER_NUM_FDS 3
+
+/* Upper bound on the payload, so a bad client cannot make the server
+ * allocate without limit. */
+#define PYXC_SERVER_MAX_REQUEST (1u << 20)
+
+#endif /* PYXC_SERVER_H */
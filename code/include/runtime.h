@@ -1,6 +1,8 @@
 #ifndef PYXC_RUNTIME_H
 #define PYXC_RUNTIME_H
 
+#include <stdint.h>
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -19,6 +21,35 @@ PYXC_RUNTIME_EXPORT double seedrand(double Seed);
 PYXC_RUNTIME_EXPORT double randd(double MaxExclusive);
 PYXC_RUNTIME_EXPORT double clockms(void);
 
+/* Driver hook: select the file descriptor putchard/printd write to. */
+PYXC_RUNTIME_EXPORT void __pyxc_set_output_fd(int FD);
+
+/* @parallel loops. The compiler outlines the loop body into a function that
+ * runs iterations [Begin, End) as chunk number Chunk. __pyxc_parallel_for
+ * splits NumIters iterations into min(NumIters, PYXC_PARALLEL_MAX_CHUNKS)
+ * chunks, runs them on the runtime's worker threads, and returns when all
+ * are done. Chunk boundaries depend only on NumIters, so per-chunk results
+ * combined in chunk order are the same on every run. */
+#define PYXC_PARALLEL_MAX_CHUNKS 256
+
+typedef void (*PyxcParallelBody)(void *Env, int64_t Chunk, int64_t Begin,
+                                 int64_t End);
+
+PYXC_RUNTIME_EXPORT void __pyxc_parallel_for(PyxcParallelBody Body, void *Env,
+                                             int64_t NumIters);
+
+/* --instrument=calls. Every instrumented function owns a zero-initialized
+ * Slot. On each return it calls __pyxc_profile_call with the slot, its name
+ * and the counter ticks since entry (CPU cycles on x86, the fixed-rate
+ * system counter on AArch64), so a function's ticks include its callees'.
+ * The first call fills the slot with a runtime-owned record, shared by every
+ * function of that name, so the table outlives JIT'd code.
+ * __pyxc_profile_report prints the table to stderr, busiest function
+ * first; it runs at exit once anything has been recorded. */
+PYXC_RUNTIME_EXPORT void __pyxc_profile_call(int64_t *Slot, const char *Name,
+                                             int64_t Ticks);
+PYXC_RUNTIME_EXPORT void __pyxc_profile_report(void);
+
 #ifdef __cplusplus
 }
 #endif
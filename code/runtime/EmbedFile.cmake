@@ -0,0 +1,16 @@
+# EmbedFile.cmake — write a binary file out as a C array.
+#
+# Usage: cmake -DINPUT=<file> -DOUTPUT=<file.inc> -DNAME=<symbol> -P EmbedFile.cmake
+#
+# pyxc uses this to embed the compiled runtime object (runtime.c), which it
+# writes back out for --emit exe links.
+
+file(READ "${INPUT}" _hex HEX)
+# 16 bytes per line keeps the generated file readable in a diff or debugger.
+# (CMake regexes have no {n} repetition, so spell the 32 hex digits out.)
+string(REPEAT "[0-9a-f]" 32 _line)
+string(REGEX REPLACE "(${_line})" "\\1\n  " _hex "${_hex}")
+string(REGEX REPLACE "([0-9a-f][0-9a-f])" "0x\\1," _bytes "${_hex}")
+file(WRITE "${OUTPUT}"
+  "// Generated from ${INPUT} by EmbedFile.cmake. Do not edit.\n"
+  "static const unsigned char ${NAME}[] = {\n  ${_bytes}\n};\n")
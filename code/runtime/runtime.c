@@ -0,0 +1,523 @@
+/* runtime.c — the pyxc runtime library (printd, putchard, flushd).
+ *
+ * One implementation serves every way pyxc code runs:
+ *   - JIT:  compiled into the pyxc binary, which resolves 'extern def printd'
+ *           and friends against these symbols in its own process. pyxc
+ *           points the output at stderr and flushes after every top-level
+ *           call, so output stays in order with its own messages.
+ *   - exe:  the CMake build embeds this file's object code in pyxc, and
+ *           --emit exe links it into every executable (GetRuntimeObject).
+ *   - obj:  lit tests link --emit obj output against test/runtime.c, which
+ *           includes this file.
+ *
+ * Output goes through one large user-space buffer and reaches the OS in big
+ * write() calls instead of one stdio call per value. The buffer is flushed
+ * when full, by flushd(), and at exit. A mutex guards the buffer, so @parallel
+ * loop bodies may print; their output interleaves value by value.
+ *
+ * @parallel loops run on a work-stealing pool of worker threads, started on
+ * the first parallel loop (see __pyxc_parallel_for).
+ *
+ * Programs built with --instrument=calls record per-function call counts and
+ * ticks here; the table is printed to stderr at exit.
+ */
+
+#include "../include/runtime.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <io.h>
+#include <windows.h>
+#define PYXC_WRITE _write
+#else
+#include <pthread.h>
+#include <unistd.h>
+#define PYXC_WRITE write
+#endif
+
+/* Threads, locks and atomics, shared by the output buffer, @parallel loops
+ * and --instrument=calls. */
+#ifdef _WIN32
+typedef SRWLOCK PyxcMutex;
+typedef CONDITION_VARIABLE PyxcCond;
+#define PYXC_MUTEX_INIT SRWLOCK_INIT
+#define PYXC_COND_INIT CONDITION_VARIABLE_INIT
+#define PYXC_THREAD_LOCAL __declspec(thread)
+static void Lock(PyxcMutex *M) { AcquireSRWLockExclusive(M); }
+static void Unlock(PyxcMutex *M) { ReleaseSRWLockExclusive(M); }
+static void Wait(PyxcCond *C, PyxcMutex *M) {
+  SleepConditionVariableSRW(C, M, INFINITE, 0);
+}
+static void Broadcast(PyxcCond *C) { WakeAllConditionVariable(C); }
+static int64_t AtomicLoad(volatile int64_t *P) {
+  return InterlockedCompareExchange64(P, 0, 0);
+}
+static void AtomicStore(volatile int64_t *P, int64_t V) {
+  InterlockedExchange64(P, V);
+}
+static int AtomicCAS(volatile int64_t *P, int64_t Expected, int64_t Desired) {
+  return InterlockedCompareExchange64(P, Desired, Expected) == Expected;
+}
+static void AtomicAdd(volatile int64_t *P, int64_t V) {
+  InterlockedExchangeAdd64(P, V);
+}
+#else
+typedef pthread_mutex_t PyxcMutex;
+typedef pthread_cond_t PyxcCond;
+#define PYXC_MUTEX_INIT PTHREAD_MUTEX_INITIALIZER
+#define PYXC_COND_INIT PTHREAD_COND_INITIALIZER
+#define PYXC_THREAD_LOCAL __thread
+static void Lock(PyxcMutex *M) { pthread_mutex_lock(M); }
+static void Unlock(PyxcMutex *M) { pthread_mutex_unlock(M); }
+static void Wait(PyxcCond *C, PyxcMutex *M) { pthread_cond_wait(C, M); }
+static void Broadcast(PyxcCond *C) { pthread_cond_broadcast(C); }
+static int64_t AtomicLoad(volatile int64_t *P) {
+  return __atomic_load_n(P, __ATOMIC_ACQUIRE);
+}
+static void AtomicStore(volatile int64_t *P, int64_t V) {
+  __atomic_store_n(P, V, __ATOMIC_RELEASE);
+}
+static int AtomicCAS(volatile int64_t *P, int64_t Expected, int64_t Desired) {
+  return __atomic_compare_exchange_n(P, &Expected, Desired, 0,
+                                     __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+}
+static void AtomicAdd(volatile int64_t *P, int64_t V) {
+  __atomic_fetch_add(P, V, __ATOMIC_RELAXED);
+}
+#endif
+
+#define PYXC_OUTPUT_BUFFER_SIZE (64 * 1024)
+
+/* Longest "%f" rendering of a double: sign, 309 integer digits, '.', six
+ * fraction digits, '\n'. */
+#define PYXC_MAX_DOUBLE_CHARS 320
+
+/* OutputLock guards everything below it. */
+static PyxcMutex OutputLock = PYXC_MUTEX_INIT;
+static char OutputBuffer[PYXC_OUTPUT_BUFFER_SIZE];
+static size_t OutputLen = 0;
+static int OutputFD = 1;
+static int FlushAtExitRegistered = 0;
+
+static void WriteAll(const char *Data, size_t Len) {
+  while (Len > 0) {
+    int Written = (int)PYXC_WRITE(OutputFD, Data, (unsigned)Len);
+    if (Written <= 0)
+      return; /* nowhere to report it; drop the output like stdio would */
+    Data += Written;
+    Len -= (size_t)Written;
+  }
+}
+
+/* FlushLocked - Write out the buffer. Called with OutputLock held. */
+static void FlushLocked(void) {
+  WriteAll(OutputBuffer, OutputLen);
+  OutputLen = 0;
+}
+
+static void FlushAtExit(void) { flushd(); }
+
+/* Reserve - Make room for Len more bytes, flushing if the buffer is full.
+ * Called with OutputLock held; the caller appends at the returned pointer
+ * and advances OutputLen before unlocking. */
+static char *Reserve(size_t Len) {
+  if (!FlushAtExitRegistered) {
+    FlushAtExitRegistered = 1;
+    atexit(FlushAtExit);
+  }
+  if (OutputLen + Len > sizeof(OutputBuffer))
+    FlushLocked();
+  return OutputBuffer + OutputLen;
+}
+
+/* FormatDouble - Write X as printf("%f\n") would, returning the length.
+ *
+ * Whole numbers below 2^53 in magnitude (counters, loop indices, character
+ * codes) are printed exactly with integer arithmetic. Everything else goes
+ * through snprintf, which is still cheap next to a system call per value.
+ */
+static size_t FormatDouble(char *Out, double X) {
+  if (X > -9007199254740992.0 && X < 9007199254740992.0 &&
+      X == (double)(long long)X) {
+    char Digits[20];
+    size_t NumDigits = 0, Len = 0;
+    long long I = (long long)X;
+    unsigned long long U = I < 0 ? 0ULL - (unsigned long long)I
+                           : (unsigned long long)I;
+    if (signbit(X))
+      Out[Len++] = '-';
+    do {
+      Digits[NumDigits++] = (char)('0' + U % 10);
+      U /= 10;
+    } while (U);
+    while (NumDigits)
+      Out[Len++] = Digits[--NumDigits];
+    for (const char *Tail = ".000000\n"; *Tail; ++Tail)
+      Out[Len++] = *Tail;
+    return Len;
+  }
+  return (size_t)snprintf(Out, PYXC_MAX_DOUBLE_CHARS, "%f\n", X);
+}
+
+/* __pyxc_set_output_fd - Select the file descriptor printd/putchard write
+ * to (1 by default). The pyxc JIT selects 2 so program output goes to
+ * stderr, as in earlier chapters. Pending output is flushed first. */
+PYXC_RUNTIME_EXPORT void __pyxc_set_output_fd(int FD) {
+  Lock(&OutputLock);
+  FlushLocked();
+  OutputFD = FD;
+  Unlock(&OutputLock);
+}
+
+/* putchard - Write X, truncated to char. Returns 0.0. */
+PYXC_RUNTIME_EXPORT double putchard(double X) {
+  Lock(&OutputLock);
+  *Reserve(1) = (char)X;
+  ++OutputLen;
+  Unlock(&OutputLock);
+  return 0;
+}
+
+/* printd - Write X as "%f\n". Returns 0.0. */
+PYXC_RUNTIME_EXPORT double printd(double X) {
+  Lock(&OutputLock);
+  char *Out = Reserve(PYXC_MAX_DOUBLE_CHARS);
+  OutputLen += FormatDouble(Out, X);
+  Unlock(&OutputLock);
+  return 0;
+}
+
+/* flushd - Write out everything buffered by printd/putchard. Returns 0.0. */
+PYXC_RUNTIME_EXPORT double flushd(void) {
+  Lock(&OutputLock);
+  FlushLocked();
+  Unlock(&OutputLock);
+  return 0;
+}
+
+/*===----------------------------------------------------------------------===
+ * @parallel loops
+ *===----------------------------------------------------------------------===
+ *
+ * Each worker owns a queue holding a contiguous range of chunk numbers,
+ * packed into one 64-bit word (next chunk in the low half, end in the high
+ * half) so that both ends can be updated with a single compare-and-swap. A
+ * worker takes chunks from the front of its own range; when that is empty it
+ * steals the back half of another worker's range into its own queue. The
+ * calling thread is worker 0, so a loop never waits for a thread to wake up
+ * before making progress.
+ *
+ * One loop runs on the pool at a time. A loop started while the pool is busy
+ * (from another thread, or nested inside a @parallel body) runs its chunks
+ * in order on the calling thread, which gives the same results.
+ */
+
+/* Upper bound on worker threads, including the caller. */
+#define PYXC_MAX_WORKERS 64
+
+/* ChunkQueue - One worker's chunk range, padded to its own cache line. */
+typedef struct {
+  volatile int64_t Range;
+  char Pad[64 - sizeof(int64_t)];
+} ChunkQueue;
+
+static int64_t PackRange(int64_t Next, int64_t End) {
+  return (int64_t)(((uint64_t)End << 32) | (uint64_t)Next);
+}
+static int64_t RangeNext(int64_t Range) { return Range & 0xffffffff; }
+static int64_t RangeEnd(int64_t Range) { return (uint64_t)Range >> 32; }
+
+static PyxcMutex PoolLock = PYXC_MUTEX_INIT;
+static PyxcCond WorkReady = PYXC_COND_INIT; /* a new loop was published */
+static PyxcCond WorkDone = PYXC_COND_INIT;  /* ActiveWorkers reached 0 */
+static int NumWorkers = 0;                  /* 0 until the pool is started */
+static int PoolBusy = 0;
+static unsigned Generation = 0;
+static int ActiveWorkers = 0; /* pool threads inside the current loop */
+
+/* The loop being run; written under PoolLock before Generation changes. */
+static PyxcParallelBody LoopBody;
+static void *LoopEnv;
+static int64_t LoopIters, LoopChunks;
+static ChunkQueue Queues[PYXC_MAX_WORKERS];
+
+static PYXC_THREAD_LOCAL int InParallelLoop = 0;
+
+/* RunChunk - Run chunk C of the current loop. Chunks differ in size by at
+ * most one iteration. */
+static void RunChunk(PyxcParallelBody Body, void *Env, int64_t NumIters,
+                     int64_t NumChunks, int64_t C) {
+  int64_t Base = NumIters / NumChunks, Extra = NumIters % NumChunks;
+  int64_t Begin = C * Base + (C < Extra ? C : Extra);
+  Body(Env, C, Begin, Begin + Base + (C < Extra ? 1 : 0));
+}
+
+/* PopChunk - Take the next chunk from the front of Q. */
+static int PopChunk(ChunkQueue *Q, int64_t *Chunk) {
+  for (;;) {
+    int64_t R = AtomicLoad(&Q->Range);
+    int64_t Next = RangeNext(R), End = RangeEnd(R);
+    if (Next >= End)
+      return 0;
+    if (AtomicCAS(&Q->Range, R, PackRange(Next + 1, End))) {
+      *Chunk = Next;
+      return 1;
+    }
+  }
+}
+
+/* StealChunks - Move the back half of some other worker's range to worker
+ * Self and return its first chunk. Fails once every queue is empty. */
+static int StealChunks(int Self, int64_t *Chunk) {
+  int I;
+  for (I = 1; I < NumWorkers; ++I) {
+    ChunkQueue *Victim = &Queues[(Self + I) % NumWorkers];
+    for (;;) {
+      int64_t R = AtomicLoad(&Victim->Range);
+      int64_t Next = RangeNext(R), End = RangeEnd(R);
+      int64_t Mid = Next + (End - Next) / 2;
+      if (Next >= End)
+        break;
+      if (AtomicCAS(&Victim->Range, R, PackRange(Next, Mid))) {
+        /* Our own queue is empty, so no one else updates it. */
+        AtomicStore(&Queues[Self].Range, PackRange(Mid + 1, End));
+        *Chunk = Mid;
+        return 1;
+      }
+    }
+  }
+  return 0;
+}
+
+static void RunWorker(int Self) {
+  int64_t Chunk;
+  while (PopChunk(&Queues[Self], &Chunk) || StealChunks(Self, &Chunk))
+    RunChunk(LoopBody, LoopEnv, LoopIters, LoopChunks, Chunk);
+}
+
+/* WorkerMain - Pool thread: run each published loop until it is drained. */
+static void WorkerMain(int Self) {
+  unsigned Seen = 0;
+  InParallelLoop = 1;
+  for (;;) {
+    Lock(&PoolLock);
+    while (Generation == Seen)
+      Wait(&WorkReady, &PoolLock);
+    Seen = Generation;
+    ++ActiveWorkers;
+    Unlock(&PoolLock);
+
+    RunWorker(Self);
+
+    Lock(&PoolLock);
+    if (--ActiveWorkers == 0)
+      Broadcast(&WorkDone);
+    Unlock(&PoolLock);
+  }
+}
+
+#ifdef _WIN32
+static DWORD WINAPI WorkerThread(LPVOID Arg) {
+  WorkerMain((int)(intptr_t)Arg);
+  return 0;
+}
+#else
+static void *WorkerThread(void *Arg) {
+  WorkerMain((int)(intptr_t)Arg);
+  return NULL;
+}
+#endif
+
+/* StartPool - Start the worker threads: $PYXC_NUM_THREADS in total if set,
+ * otherwise one per online processor. Called with PoolLock held. */
+static void StartPool(void) {
+  const char *Env = getenv("PYXC_NUM_THREADS");
+  int Want = Env ? atoi(Env) : 0;
+  int I;
+  if (Want <= 0) {
+#ifdef _WIN32
+    SYSTEM_INFO Info;
+    GetSystemInfo(&Info);
+    Want = (int)Info.dwNumberOfProcessors;
+#else
+    Want = (int)sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+  }
+  if (Want < 1)
+    Want = 1;
+  if (Want > PYXC_MAX_WORKERS)
+    Want = PYXC_MAX_WORKERS;
+
+  NumWorkers = 1;
+  for (I = 1; I < Want; ++I) {
+#ifdef _WIN32
+    HANDLE T = CreateThread(NULL, 0, WorkerThread, (LPVOID)(intptr_t)I, 0,
+                            NULL);
+    if (!T)
+      break;
+    CloseHandle(T);
+#else
+    pthread_t T;
+    if (pthread_create(&T, NULL, WorkerThread, (void *)(intptr_t)I) != 0)
+      break;
+    pthread_detach(T);
+#endif
+    NumWorkers = I + 1;
+  }
+}
+
+PYXC_RUNTIME_EXPORT void __pyxc_parallel_for(PyxcParallelBody Body, void *Env,
+                                             int64_t NumIters) {
+  int64_t NumChunks, C;
+  int W, UsePool = 0;
+  if (NumIters <= 0)
+    return;
+  NumChunks = NumIters < PYXC_PARALLEL_MAX_CHUNKS ? NumIters
+                                                  : PYXC_PARALLEL_MAX_CHUNKS;
+
+  if (!InParallelLoop) {
+    Lock(&PoolLock);
+    if (!NumWorkers)
+      StartPool();
+    if (!PoolBusy && NumWorkers > 1) {
+      /* Workers from the previous loop may still be scanning its queues. */
+      while (ActiveWorkers > 0)
+        Wait(&WorkDone, &PoolLock);
+      PoolBusy = UsePool = 1;
+      LoopBody = Body;
+      LoopEnv = Env;
+      LoopIters = NumIters;
+      LoopChunks = NumChunks;
+      for (W = 0; W < NumWorkers; ++W)
+        AtomicStore(&Queues[W].Range,
+                    PackRange(W * NumChunks / NumWorkers,
+                              (W + 1) * NumChunks / NumWorkers));
+      ++Generation;
+      Broadcast(&WorkReady);
+    }
+    Unlock(&PoolLock);
+  }
+
+  if (!UsePool) {
+    for (C = 0; C < NumChunks; ++C)
+      RunChunk(Body, Env, NumIters, NumChunks, C);
+    return;
+  }
+
+  InParallelLoop = 1;
+  RunWorker(0);
+  InParallelLoop = 0;
+
+  Lock(&PoolLock);
+  while (ActiveWorkers > 0)
+    Wait(&WorkDone, &PoolLock);
+  PoolBusy = 0;
+  Unlock(&PoolLock);
+}
+
+/*===----------------------------------------------------------------------===
+ * --instrument=calls
+ *===----------------------------------------------------------------------===
+ *
+ * Records are created under ProfileLock the first time a function returns
+ * and are never freed. After that a call only loads its slot and does two
+ * atomic adds, so @parallel bodies can call instrumented functions at full
+ * speed.
+ */
+
+/* CallProfile - Totals for every function of one name. */
+typedef struct CallProfile {
+  struct CallProfile *Next;
+  volatile int64_t Calls;
+  volatile int64_t Ticks;
+  char Name[1]; /* NUL-terminated, allocated with the record */
+} CallProfile;
+
+static PyxcMutex ProfileLock = PYXC_MUTEX_INIT;
+static CallProfile *Profiles = NULL;
+static int NumProfiles = 0;
+
+static void ReportAtExit(void) { __pyxc_profile_report(); }
+
+/* FindProfile - The record for Name, created on first use. Called with
+ * ProfileLock held; returns NULL only if out of memory. */
+static CallProfile *FindProfile(const char *Name) {
+  CallProfile *P;
+  size_t Len = strlen(Name);
+  for (P = Profiles; P; P = P->Next)
+    if (strcmp(P->Name, Name) == 0)
+      return P;
+  P = (CallProfile *)calloc(1, sizeof(CallProfile) + Len);
+  if (!P)
+    return NULL;
+  memcpy(P->Name, Name, Len + 1);
+  if (!Profiles)
+    atexit(ReportAtExit);
+  P->Next = Profiles;
+  Profiles = P;
+  ++NumProfiles;
+  return P;
+}
+
+PYXC_RUNTIME_EXPORT void __pyxc_profile_call(int64_t *Slot, const char *Name,
+                                             int64_t Ticks) {
+  CallProfile *P = (CallProfile *)(intptr_t)AtomicLoad(Slot);
+  if (!P) {
+    Lock(&ProfileLock);
+    P = (CallProfile *)(intptr_t)AtomicLoad(Slot);
+    if (!P) {
+      P = FindProfile(Name);
+      AtomicStore(Slot, (int64_t)(intptr_t)P);
+    }
+    Unlock(&ProfileLock);
+    if (!P)
+      return;
+  }
+  AtomicAdd(&P->Calls, 1);
+  AtomicAdd(&P->Ticks, Ticks);
+}
+
+static int CompareProfiles(const void *A, const void *B) {
+  const CallProfile *PA = *(const CallProfile *const *)A;
+  const CallProfile *PB = *(const CallProfile *const *)B;
+  if (PA->Ticks != PB->Ticks)
+    return PA->Ticks < PB->Ticks ? 1 : -1;
+  return strcmp(PA->Name, PB->Name);
+}
+
+PYXC_RUNTIME_EXPORT void __pyxc_profile_report(void) {
+  CallProfile **Sorted;
+  CallProfile *P;
+  int I, N = 0;
+
+  Lock(&ProfileLock);
+  Sorted = NumProfiles
+               ? (CallProfile **)malloc(NumProfiles * sizeof(CallProfile *))
+               : NULL;
+  if (Sorted)
+    for (P = Profiles; P; P = P->Next)
+      Sorted[N++] = P;
+  Unlock(&ProfileLock);
+  if (!Sorted)
+    return;
+
+  /* Keep the report after the program's own output. */
+  flushd();
+  qsort(Sorted, (size_t)N, sizeof(CallProfile *), CompareProfiles);
+  fprintf(stderr, "pyxc: call profile (ticks include callees)\n");
+  fprintf(stderr, "%14s %20s %14s  %s\n", "calls", "ticks", "ticks/call",
+          "function");
+  for (I = 0; I < N; ++I) {
+    int64_t Calls = AtomicLoad(&Sorted[I]->Calls);
+    int64_t Ticks = AtomicLoad(&Sorted[I]->Ticks);
+    fprintf(stderr, "%14lld %20lld %14lld  %s\n", (long long)Calls,
+            (long long)Ticks, (long long)(Calls ? Ticks / Calls : 0),
+            Sorted[I]->Name);
+  }
+  fflush(stderr);
+  free(Sorted);
+}
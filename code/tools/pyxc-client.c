@@ -0,0 +1,177 @@
+/* pyxc-client.c — forward a pyxc job to a running `pyxc --server`.
+ *
+ *   pyxc-client [--server=<socket>] <pyxc arguments>...
+ *
+ * The socket defaults to $PYXC_SERVER. The client hands the server its
+ * standard streams, working directory and arguments (see PyxcServer.h), so
+ * diagnostics appear exactly as if pyxc had run here, and exits with the
+ * job's exit status. It is plain C with no LLVM dependency so that starting
+ * it costs next to nothing; the LLVM start-up work is paid once by the
+ * server.
+ */
+
+#include "../include/PyxcServer.h"
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+/* How long to keep retrying while the server is still starting up. */
+#define CONNECT_RETRY_MS 5000
+#define CONNECT_RETRY_STEP_MS 10
+
+static int Fail(const char *Message) {
+  fprintf(stderr, "pyxc-client: %s: %s\n", Message, strerror(errno));
+  return 1;
+}
+
+/* Connect - Connect to the server at Path, waiting briefly if the socket
+ * does not exist or is not accepting yet. Returns the socket or -1. */
+static int Connect(const char *Path) {
+  struct sockaddr_un Addr;
+  struct timespec Step = {0, CONNECT_RETRY_STEP_MS * 1000000L};
+  int Waited = 0;
+
+  memset(&Addr, 0, sizeof(Addr));
+  Addr.sun_family = AF_UNIX;
+  if (strlen(Path) >= sizeof(Addr.sun_path)) {
+    errno = ENAMETOOLONG;
+    return -1;
+  }
+  strcpy(Addr.sun_path, Path);
+
+  for (;;) {
+    int FD = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (FD < 0)
+      return -1;
+    if (connect(FD, (struct sockaddr *)&Addr, sizeof(Addr)) == 0)
+      return FD;
+    close(FD);
+    if ((errno != ENOENT && errno != ECONNREFUSED) ||
+        Waited >= CONNECT_RETRY_MS)
+      return -1;
+    nanosleep(&Step, NULL);
+    Waited += CONNECT_RETRY_STEP_MS;
+  }
+}
+
+/* WriteAll - Write Len bytes of Data to FD. Returns 0 on success. */
+static int WriteAll(int FD, const char *Data, size_t Len) {
+  while (Len > 0) {
+    ssize_t N = write(FD, Data, Len);
+    if (N < 0 && errno == EINTR)
+      continue;
+    if (N <= 0)
+      return -1;
+    Data += N;
+    Len -= (size_t)N;
+  }
+  return 0;
+}
+
+/* Append - Append String and its NUL to the payload. */
+static int Append(char **Payload, size_t *Len, const char *String) {
+  size_t Add = strlen(String) + 1;
+  char *Grown;
+  if (*Len + Add > PYXC_SERVER_MAX_REQUEST) {
+    errno = E2BIG;
+    return -1;
+  }
+  Grown = realloc(*Payload, *Len + Add);
+  if (!Grown)
+    return -1;
+  memcpy(Grown + *Len, String, Add);
+  *Payload = Grown;
+  *Len += Add;
+  return 0;
+}
+
+int main(int argc, char **argv) {
+  const char *SocketPath = getenv("PYXC_SERVER");
+  char Cwd[4096];
+  char *Payload = NULL;
+  size_t PayloadLen = 0;
+  uint32_t Len32;
+  int FDs[PYXC_SERVER_NUM_FDS] = {0, 1, 2};
+  union {
+    struct cmsghdr Align;
+    char Buf[CMSG_SPACE(sizeof(FDs))];
+  } Control;
+  struct iovec IOV;
+  struct msghdr Msg;
+  struct cmsghdr *Header;
+  int32_t ExitCode;
+  int Conn, I, FirstArg = 1;
+
+  if (argc > 1 && strncmp(argv[1], "--server=", 9) == 0) {
+    SocketPath = argv[1] + 9;
+    FirstArg = 2;
+  }
+  if (!SocketPath || !*SocketPath) {
+    fprintf(stderr, "pyxc-client: no server socket; pass --server=<socket> "
+                    "or set PYXC_SERVER\n");
+    return 1;
+  }
+  if (!getcwd(Cwd, sizeof(Cwd)))
+    return Fail("could not get the working directory");
+
+  if (Append(&Payload, &PayloadLen, PYXC_SERVER_PROTOCOL) ||
+      Append(&Payload, &PayloadLen, Cwd))
+    return Fail("could not build the request");
+  for (I = FirstArg; I < argc; ++I)
+    if (Append(&Payload, &PayloadLen, argv[I]))
+      return Fail("could not build the request");
+
+  Conn = Connect(SocketPath);
+  if (Conn < 0) {
+    fprintf(stderr, "pyxc-client: could not connect to '%s': %s\n",
+            SocketPath, strerror(errno));
+    return 1;
+  }
+
+  /* The length travels with the descriptors; the payload follows. */
+  Len32 = (uint32_t)PayloadLen;
+  IOV.iov_base = &Len32;
+  IOV.iov_len = sizeof(Len32);
+  memset(&Msg, 0, sizeof(Msg));
+  memset(&Control, 0, sizeof(Control));
+  Msg.msg_iov = &IOV;
+  Msg.msg_iovlen = 1;
+  Msg.msg_control = Control.Buf;
+  Msg.msg_controllen = sizeof(Control.Buf);
+  Header = CMSG_FIRSTHDR(&Msg);
+  Header->cmsg_level = SOL_SOCKET;
+  Header->cmsg_type = SCM_RIGHTS;
+  Header->cmsg_len = CMSG_LEN(sizeof(FDs));
+  memcpy(CMSG_DATA(Header), FDs, sizeof(FDs));
+  if (sendmsg(Conn, &Msg, 0) != (ssize_t)sizeof(Len32) ||
+      WriteAll(Conn, Payload, PayloadLen))
+    return Fail("could not send the request");
+  free(Payload);
+
+  /* Output arrives directly on our streams; wait for the exit status. */
+  {
+    char *Out = (char *)&ExitCode;
+    size_t Want = sizeof(ExitCode);
+    while (Want > 0) {
+      ssize_t N = read(Conn, Out, Want);
+      if (N < 0 && errno == EINTR)
+        continue;
+      if (N <= 0) {
+        fprintf(stderr, "pyxc-client: the server closed the connection "
+                        "without a result\n");
+        return 1;
+      }
+      Out += N;
+      Want -= (size_t)N;
+    }
+  }
+  close(Conn);
+  return (int)ExitCode;
+}